@@ -0,0 +1,58 @@
+# CRC-32 (bitwise, reflected polynomial) and FNV-1a (64-bit) over a 4 KiB
+# buffer, PASSES times; prints the CRC of the last pass and the FNV hash,
+# which runs on across passes
+
+    .equ LEN, 4096
+    .equ PASSES, 40
+    .equ BUF, 0x10000
+
+    .text
+_start:
+    li s0, BUF
+    li t0, 0
+    li t1, LEN
+fill:                           # buf[i] = i * 7 + 3
+    slli t2, t0, 3
+    sub t2, t2, t0
+    addi t2, t2, 3
+    add t3, s0, t0
+    sb t2, 0(t3)
+    addi t0, t0, 1
+    bne t0, t1, fill
+
+    li s3, 0xedb88320           # CRC polynomial
+    li s4, 0xffffffff
+    li s5, 0x100000001b3        # FNV prime
+    li s7, 0xcbf29ce484222325   # FNV offset basis, then the hash
+    li s1, PASSES
+    add s6, s0, t1              # End of the buffer
+pass:
+    mv s2, s4
+    mv t0, s0
+byte:
+    lbu t2, 0(t0)
+    xor s2, s2, t2
+    li t3, 8
+bit:
+    slli t4, s2, 63             # All ones if the low bit is set
+    srai t4, t4, 63
+    and t4, t4, s3
+    srli s2, s2, 1
+    xor s2, s2, t4
+    addi t3, t3, -1
+    bnez t3, bit
+    xor s7, s7, t2
+    mul s7, s7, s5
+    addi t0, t0, 1
+    bne t0, s6, byte
+    xor s2, s2, s4
+    addi s1, s1, -1
+    bnez s1, pass
+
+    mv a0, s2
+    jal ra, print_hex
+    mv a0, s7
+    jal ra, print_hex
+    j exit
+
+    .include "lib.s"
@@ -0,0 +1,142 @@
+# Dhrystone-like kernel: per iteration a string copy and compare, integer
+# arithmetic with a divide, a record copy through nested calls with stack
+# frames, an enumeration switch and array updates; prints a checksum
+
+    .equ RUNS, 20000
+    .equ STR_A, 0x10000
+    .equ STR_B, 0x10040
+    .equ REC_1, 0x10080         # Records: next, int_comp, enum_comp, count
+    .equ REC_2, 0x100c0
+    .equ ARR, 0x10100           # 50 doublewords
+
+    .text
+_start:
+    la a1, message              # Copy the constant string to STR_A
+    li a0, STR_A
+    jal ra, strcpy
+    li s0, 1                    # Iteration
+    li s1, 0                    # Checksum
+    li s9, RUNS + 1
+loop:
+    li a0, STR_B
+    li a1, STR_A
+    jal ra, strcpy
+    li a0, STR_A
+    li a1, STR_B
+    jal ra, strcmp
+    add s1, s1, a0
+
+    andi s2, s0, 7              # int1; the ints are 32 bits, as in C
+    addiw s3, s2, 3             # int2
+    mulw s4, s3, s2             # int3 = (int2 * int1 - int1) / (int1 + 1)
+    subw s4, s4, s2
+    addiw t0, s2, 1
+    divw s4, s4, t0
+
+    li a0, REC_1
+    li a1, REC_2
+    mv a2, s4
+    jal ra, record
+
+    slli t0, s2, 3              # arr[int1 + 5] = int3; arr[int1 + 6] = arr[int1 + 5]
+    li t1, ARR
+    add t0, t0, t1
+    sd s4, 40(t0)
+    ld t2, 40(t0)
+    sd t2, 48(t0)
+    sd s0, 240(t0)              # arr[int1 + 30] = iteration
+
+    li t1, 33                   # checksum = checksum * 33 + int3 + rec1.int_comp
+    mul s1, s1, t1              #            + rec2.enum_comp + arr[int1 + 6]
+    add s1, s1, s4
+    li t1, REC_1
+    ld t3, 8(t1)
+    add s1, s1, t3
+    li t1, REC_2
+    ld t3, 16(t1)
+    add s1, s1, t3
+    add s1, s1, t2
+
+    addi s0, s0, 1
+    bne s0, s9, loop
+    mv a0, s1
+    jal ra, print_hex
+    j exit
+
+# Copy the NUL-terminated string at a1 to a0
+strcpy:
+    lbu t0, 0(a1)
+    sb t0, 0(a0)
+    addi a0, a0, 1
+    addi a1, a1, 1
+    bnez t0, strcpy
+    ret
+
+# a0 = first difference between the strings at a0 and a1, or 0
+strcmp:
+    lbu t0, 0(a0)
+    lbu t1, 0(a1)
+    bne t0, t1, 1f
+    addi a0, a0, 1
+    addi a1, a1, 1
+    bnez t0, strcmp
+1:  sub a0, t0, t1
+    ret
+
+# Copy record a0 to a1, then a1.int_comp = a2 + a0.int_comp,
+# a0.int_comp = a1.int_comp & 255, a1.enum_comp = next_enum(a0.enum_comp),
+# a0.enum_comp = a1.enum_comp and count both
+record:
+    addi sp, sp, -32
+    sd ra, 0(sp)
+    sd s0, 8(sp)
+    sd s1, 16(sp)
+    mv s0, a0
+    mv s1, a1
+    ld t0, 0(s0)
+    ld t1, 8(s0)
+    ld t2, 16(s0)
+    ld t3, 24(s0)
+    sd t0, 0(s1)
+    sd t1, 8(s1)
+    sd t2, 16(s1)
+    sd t3, 24(s1)
+    add t1, t1, a2
+    sd t1, 8(s1)
+    andi t1, t1, 255
+    sd t1, 8(s0)
+    mv a0, t2
+    jal ra, next_enum
+    sd a0, 16(s1)
+    sd a0, 16(s0)
+    ld t0, 24(s0)
+    addi t0, t0, 1
+    sd t0, 24(s0)
+    sd t0, 24(s1)
+    ld ra, 0(sp)
+    ld s0, 8(sp)
+    ld s1, 16(sp)
+    addi sp, sp, 32
+    ret
+
+# Enumeration switch: 0 -> 2, 1 -> 3, 2 -> 1, anything else -> 0
+next_enum:
+    beqz a0, 1f
+    li t0, 1
+    beq a0, t0, 2f
+    li t0, 2
+    beq a0, t0, 3f
+    li a0, 0
+    ret
+1:  li a0, 2
+    ret
+2:  li a0, 3
+    ret
+3:  li a0, 1
+    ret
+
+message:
+    .asciz "DHRYSTONE PROGRAM, 1'ST STRING"
+    .byte 0                     # Pad to a whole instruction
+
+    .include "lib.s"
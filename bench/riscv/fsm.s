@@ -0,0 +1,133 @@
+# Branch-heavy state machine: a six-state DFA over a stream of two-bit
+# symbols from xorshift64, dispatched through a jump table on the state and
+# compare chains on the symbol; counts entries to the accepting state 5 and
+# repeated symbols, and prints both
+
+    .equ STEPS, 400000
+    .equ STATE_BYTES, 44         # Eleven instructions per state
+
+    .text
+_start:
+    li s0, 0                    # State
+    li s1, 0                    # Accepting entries
+    li s2, 0                    # Repeated symbols
+    li s3, 0x2545F491           # xorshift state
+    li s4, STEPS
+    li s5, -1                   # Previous symbol
+    la s6, state0
+step:
+    slli t0, s3, 13
+    xor s3, s3, t0
+    srli t0, s3, 7
+    xor s3, s3, t0
+    slli t0, s3, 17
+    xor s3, s3, t0
+    srli a1, s3, 11
+    andi a1, a1, 3              # Symbol
+    bne a1, s5, 1f
+    addi s2, s2, 1
+1:  mv s5, a1
+    la t0, table
+    slli t3, s0, 2
+    add t0, t0, t3
+    lw t0, 0(t0)
+    add t0, s6, t0
+    li t1, 1
+    li t2, 2
+    jr t0
+
+state0:
+    beqz a1, 1f
+    beq a1, t1, 2f
+    beq a1, t2, 3f
+    li s0, 0
+    j next
+1:  li s0, 1
+    j next
+2:  li s0, 0
+    j next
+3:  li s0, 2
+    j next
+state1:
+    beqz a1, 1f
+    beq a1, t1, 2f
+    beq a1, t2, 3f
+    li s0, 0
+    j next
+1:  li s0, 1
+    j next
+2:  li s0, 3
+    j next
+3:  li s0, 2
+    j next
+state2:
+    beqz a1, 1f
+    beq a1, t1, 2f
+    beq a1, t2, 3f
+    li s0, 1
+    j next
+1:  li s0, 4
+    j next
+2:  li s0, 0
+    j next
+3:  li s0, 2
+    j next
+state3:
+    beqz a1, 1f
+    beq a1, t1, 2f
+    beq a1, t2, 3f
+    li s0, 3
+    j next
+1:  li s0, 1
+    j next
+2:  li s0, 0
+    j next
+3:  li s0, 5
+    j accept
+state4:
+    beqz a1, 1f
+    beq a1, t1, 2f
+    beq a1, t2, 3f
+    li s0, 5
+    j accept
+1:  li s0, 4
+    j next
+2:  li s0, 3
+    j next
+3:  li s0, 0
+    j next
+state5:
+    beqz a1, 1f
+    beq a1, t1, 2f
+    beq a1, t2, 3f
+    li s0, 3
+    j next
+1:  li s0, 0
+    j next
+2:  li s0, 1
+    j next
+3:  li s0, 2
+    j next
+accept:
+    addi s1, s1, 1
+next:
+    addi s4, s4, -1
+    bnez s4, step
+
+    mv a0, s1
+    jal ra, print_hex
+    mv a0, s2
+    jal ra, print_hex
+    j exit
+
+# Offsets from state0; a label difference would need a linker relocation,
+# and every state block is the same size
+table:
+    .word 0 * STATE_BYTES
+    .word 1 * STATE_BYTES
+    .word 2 * STATE_BYTES
+    .word 3 * STATE_BYTES
+    .word 4 * STATE_BYTES
+    .word 5 * STATE_BYTES
+
+    .include "lib.s"
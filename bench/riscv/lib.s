@@ -0,0 +1,26 @@
+# Helpers shared by the RISC-V benchmarks, .include'd at the end of each
+
+# Print a0 as 16 hex digits and a newline; clobbers t0-t3, a0, a7
+print_hex:
+    mv t0, a0
+    li t1, 60
+    li a7, 2
+1:  srl t2, t0, t1
+    andi t2, t2, 15
+    addi t3, t2, -10
+    bltz t3, 2f
+    addi a0, t2, 'a' - 10
+    j 3f
+2:  addi a0, t2, '0'
+3:  ecall
+    addi t1, t1, -4
+    bgtz t1, 1b
+    beqz t1, 1b
+    li a0, '\n'
+    ecall
+    ret
+
+# Exit the simulator
+exit:
+    li a7, 0
+    ecall
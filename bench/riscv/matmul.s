@@ -0,0 +1,93 @@
+# Matrix multiply: C = A * B for 32x32 matrices of 64-bit integers, PASSES
+# times, with A replaced by a byte hashed from C after each pass; prints the
+# sum of the last C
+
+    .equ N, 32
+    .equ A, 0x10000
+    .equ B, 0x12000
+    .equ C, 0x14000
+    .equ PASSES, 40
+
+    .text
+_start:
+    li s0, A
+    li s1, B
+    li s2, C
+    li t0, 0                    # i
+    li t6, N
+init_row:
+    li t1, 0                    # j
+init_col:
+    slli t2, t0, 8              # Offset of [i][j]: (i * N + j) * 8
+    slli t3, t1, 3
+    add t2, t2, t3
+    slli t3, t0, 1              # A[i][j] = (i * 3 + j * 5) & 15
+    add t3, t3, t0
+    slli t4, t1, 2
+    add t4, t4, t1
+    add t3, t3, t4
+    andi t3, t3, 15
+    add t4, s0, t2
+    sd t3, 0(t4)
+    slli t3, t0, 3              # B[i][j] = (i * 7 + j) & 31
+    sub t3, t3, t0
+    add t3, t3, t1
+    andi t3, t3, 31
+    add t4, s1, t2
+    sd t3, 0(t4)
+    addi t1, t1, 1
+    bne t1, t6, init_col
+    addi t0, t0, 1
+    bne t0, t6, init_row
+
+    li s3, PASSES
+pass:
+    mv a2, s2                   # &C[i][j]
+    li t0, 0
+row:
+    li t1, 0
+col:
+    slli t2, t0, 8
+    add a0, s0, t2              # &A[i][0]
+    slli t2, t1, 3
+    add a1, s1, t2              # &B[0][j]
+    li t3, 0                    # Sum
+    li t4, N
+dot:
+    ld t5, 0(a0)
+    ld a3, 0(a1)
+    mul t5, t5, a3
+    add t3, t3, t5
+    addi a0, a0, 8
+    addi a1, a1, 256
+    addi t4, t4, -1
+    bnez t4, dot
+    sd t3, 0(a2)
+    addi a2, a2, 8
+    addi t1, t1, 1
+    bne t1, t6, col
+    addi t0, t0, 1
+    bne t0, t6, row
+
+    li a0, 0                    # Sum C, and A = (C ^ (C >> 7)) & 255
+    mv t0, s2
+    mv t1, s0
+    li t2, N * N
+next:
+    ld t3, 0(t0)
+    add a0, a0, t3
+    srli t4, t3, 7
+    xor t3, t3, t4
+    andi t3, t3, 255
+    sd t3, 0(t1)
+    addi t0, t0, 8
+    addi t1, t1, 8
+    addi t2, t2, -1
+    bnez t2, next
+    addi s3, s3, -1
+    bnez s3, pass
+
+    jal ra, print_hex
+    j exit
+
+    .include "lib.s"
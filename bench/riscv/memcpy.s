@@ -0,0 +1,70 @@
+# memset and memcpy between two 16 KiB buffers, PASSES times: fill the
+# source by doublewords, copy it by doublewords (unrolled four times), copy
+# it back three bytes along by bytes, then fold the source into a checksum,
+# which is printed at the end
+
+    .equ LEN, 16384
+    .equ SRC, 0x10000
+    .equ DST, 0x20000
+    .equ PASSES, 100
+
+    .text
+_start:
+    li s0, SRC
+    li s1, DST
+    li s2, PASSES
+    li s3, 0                    # Checksum
+    li s4, LEN
+    li s5, 0x0123456789abcdef   # Pattern multiplier
+    li s6, 31
+pass:
+    mul t1, s2, s5              # memset(src, pattern, LEN)
+    mv t0, s0
+    add t2, s0, s4
+set:
+    sd t1, 0(t0)
+    addi t0, t0, 8
+    bne t0, t2, set
+
+    mv t0, s0                   # memcpy(dst, src, LEN)
+    mv t1, s1
+copy:
+    ld t3, 0(t0)
+    ld t4, 8(t0)
+    ld t5, 16(t0)
+    ld t6, 24(t0)
+    sd t3, 0(t1)
+    sd t4, 8(t1)
+    sd t5, 16(t1)
+    sd t6, 24(t1)
+    addi t0, t0, 32
+    addi t1, t1, 32
+    bne t0, t2, copy
+
+    mv t0, s1                   # memcpy(src + 3, dst, LEN - 3), a byte at a time
+    addi t1, s0, 3
+    add t2, s1, s4
+    addi t2, t2, -3
+bytes:
+    lbu t3, 0(t0)
+    sb t3, 0(t1)
+    addi t0, t0, 1
+    addi t1, t1, 1
+    bne t0, t2, bytes
+
+    mv t0, s0
+    add t2, s0, s4
+fold:
+    ld t3, 0(t0)
+    mul s3, s3, s6
+    add s3, s3, t3
+    addi t0, t0, 8
+    bne t0, t2, fold
+    addi s2, s2, -1
+    bnez s2, pass
+
+    mv a0, s3
+    jal ra, print_hex
+    j exit
+
+    .include "lib.s"
@@ -0,0 +1,65 @@
+# Integer sort: fill an array with xorshift64 values and insertion-sort it,
+# PASSES times over fresh values, then print a checksum of the last sorted
+# array (the sum of a[i] * (i + 1))
+
+    .equ N, 1024
+    .equ PASSES, 8
+    .equ ARRAY, 0x10000
+
+    .text
+_start:
+    li s0, ARRAY
+    li s1, PASSES
+    li s2, 0x2545F491           # xorshift state
+pass:
+    mv t0, s0
+    li t1, N
+fill:
+    slli t2, s2, 13
+    xor s2, s2, t2
+    srli t2, s2, 7
+    xor s2, s2, t2
+    slli t2, s2, 17
+    xor s2, s2, t2
+    sd s2, 0(t0)
+    addi t0, t0, 8
+    addi t1, t1, -1
+    bnez t1, fill
+
+    li t0, 1                    # i
+    li t6, N
+outer:
+    slli t1, t0, 3
+    add t1, s0, t1              # Hole at &a[i]
+    ld t2, 0(t1)                # Key
+inner:
+    beq t1, s0, place
+    ld t3, -8(t1)
+    blt t2, t3, shift           # Move larger elements up one slot
+    j place
+shift:
+    sd t3, 0(t1)
+    addi t1, t1, -8
+    j inner
+place:
+    sd t2, 0(t1)
+    addi t0, t0, 1
+    bne t0, t6, outer
+    addi s1, s1, -1
+    bnez s1, pass
+
+    li a0, 0
+    mv t0, s0
+    li t1, 1
+sum:
+    ld t2, 0(t0)
+    mul t2, t2, t1
+    add a0, a0, t2
+    addi t0, t0, 8
+    addi t1, t1, 1
+    addi t3, t6, 1
+    bne t1, t3, sum
+    jal ra, print_hex
+    j exit
+
+    .include "lib.s"
@@ -0,0 +1,61 @@
+BITS 16
+
+; Branch-heavy classifier: walks a buffer of pseudo-random symbols 1-4 and
+; counts each kind in its own register through a chain of compares, PASSES
+; times. This core has no dec, sub or conditional jump other than je, so the
+; pass number lives in memory and is printed as a character after each pass.
+
+%define LEN 16384
+%define PASSES 60               ; Pass characters run from '!' upwards
+
+pass:
+    mov bx, BUF
+scan:
+    mov al, [bx]
+    inc bx
+    cmp al, 0
+    je end_pass
+    cmp al, 1
+    je one
+    cmp al, 2
+    je two
+    cmp al, 3
+    je three
+    inc bp
+    jmp scan
+one:
+    inc si
+    jmp scan
+two:
+    inc cx
+    jmp scan
+three:
+    inc dx
+    jmp scan
+
+end_pass:
+    mov ax, 0
+    mov bx, COUNT
+    mov al, [bx]
+    inc ax                      ; inc r8 is not decoded right by this core
+    mov di, COUNT
+    stosb
+    mov ah, 0x0e
+    int 0x10
+    cmp al, '!' + PASSES
+    je finish
+    jmp pass
+finish:
+    hlt
+
+COUNT:
+    db '!'
+
+; LEN symbols from a linear congruential generator, then a terminator
+BUF:
+%assign x 12345
+%rep LEN
+    %assign x (x * 1103515245 + 12345) & 0x7fffffff
+    db ((x >> 16) & 3) + 1
+%endrep
+    db 0
@@ -0,0 +1,75 @@
+BITS 16
+
+; memset, memcpy, memcmp and memmove on 8 KiB blocks with the rep string
+; instructions: fill a source block by words, copy it forwards, compare it
+; by bytes, smear its first byte across the copy with an overlapping movsb,
+; copy it back down from the top with the direction flag set, and compare
+; it again by words. The block runs INNER times per pass, and each pass
+; prints its number as a character, as in scan.asm.
+
+%define BYTES 8192
+%define WORDS BYTES / 2
+%define SRC 0x1000
+%define DST 0x4000
+%define INNER 100               ; cmp al takes a signed imm8
+%define PASSES 60
+
+block:
+    mov ax, 0x5aa5
+    mov di, SRC
+    mov cx, WORDS
+    rep stosw                   ; memset
+    mov si, SRC
+    mov di, DST
+    mov cx, WORDS
+    rep movsw                   ; memcpy
+    mov si, SRC
+    mov di, DST
+    mov cx, BYTES
+    repe cmpsb                  ; memcmp, equal to the end
+    mov si, DST
+    mov di, DST + 1
+    mov cx, BYTES - 1
+    rep movsb                   ; Each byte reads the one just written
+    std
+    mov si, SRC + BYTES - 2
+    mov di, DST + BYTES - 2
+    mov cx, WORDS
+    rep movsw                   ; memmove, from the top down
+    cld
+    mov si, SRC
+    mov di, DST
+    mov cx, WORDS
+    repe cmpsw
+
+    mov ax, 0                   ; inc r8 is not decoded right by this core
+    mov bx, INNER_COUNT
+    mov al, [bx]
+    inc ax
+    mov di, INNER_COUNT
+    stosb
+    cmp al, INNER
+    je pass
+    jmp block
+
+pass:
+    mov ax, 0
+    mov di, INNER_COUNT
+    stosb
+    mov bx, PASS_COUNT
+    mov al, [bx]
+    inc ax
+    mov di, PASS_COUNT
+    stosb
+    mov ah, 0x0e
+    int 0x10
+    cmp al, '!' + PASSES
+    je finish
+    jmp block
+finish:
+    hlt
+
+INNER_COUNT:
+    db 0
+PASS_COUNT:
+    db '!'
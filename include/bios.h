@@ -0,0 +1,61 @@
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include "replay.h"
+
+#ifndef BIOS_H
+#define BIOS_H
+
+const int BOOT_ADDRESS = 0x7c00;    // Where the BIOS loads the boot sector
+const int SECTOR_SIZE = 512;
+const int BIOS_OUT_SIZE = 1 << 12;  // Teletype output is flushed in 4 KiB writes
+
+// Floppy geometry used to turn CHS addresses into disk image offsets (1.44 MB)
+const int SECTORS_PER_TRACK = 18;
+const int NUM_HEADS = 2;
+
+class Machine;
+
+// A read-only view of a file mapped into memory
+struct MappedFile {
+    const uint8_t* data;
+    size_t size;
+
+    MappedFile();
+    ~MappedFile();
+    bool open(const char*);
+};
+
+// Emulated BIOS services for running boot sectors without a real firmware:
+// int 0x10 - Video (buffered teletype output)
+// int 0x13 - Disk (sector reads from a disk image)
+// int 0x16 - Keyboard (keystrokes read from a file)
+class Bios {
+    MappedFile disk;        // Disk image, served to int 0x13
+    MappedFile keyboard;    // Keystrokes, served to int 0x16
+    size_t keyPos;          // Next unread keystroke
+    InputLog* input;        // Records or replays keystrokes, if set
+
+    char out[BIOS_OUT_SIZE]; // Teletype output buffer
+    size_t outLen;
+
+    // SERVICES
+    void video(Machine &);
+    void disk_service(Machine &);
+    void keyboard_service(Machine &);
+
+    public:
+        Bios();
+        ~Bios();
+        bool open_disk(const char*);
+        bool open_keyboard(const char*);
+        void rewind();
+        void set_input_log(InputLog*);
+        int boot(Machine &, char*);
+
+        void interrupt(Machine &, uint8_t);
+        void putc(char);
+        void flush();
+};
+
+#endif
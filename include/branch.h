@@ -0,0 +1,556 @@
+#include <algorithm>
+#include <cinttypes>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#ifndef BRANCH_H
+#define BRANCH_H
+
+enum BranchKind : uint8_t {
+    BRANCH_COND,
+    BRANCH_JUMP,        // Direct, unconditional
+    BRANCH_CALL,        // Direct or indirect, links a return address
+    BRANCH_RETURN,
+    BRANCH_INDIRECT,
+    BRANCH_KINDS
+};
+
+// One resolved control transfer
+struct BranchEvent {
+    uint64_t pc;
+    uint64_t target;        // Where control went if taken
+    uint64_t fallthrough;   // The next instruction in memory, where a call returns to
+    uint8_t kind;           // BranchKind
+    bool taken;
+};
+
+struct BranchPrediction {
+    bool taken;
+    bool hasTarget;         // Direction-only predictors leave the target to someone else
+    uint64_t target;
+};
+
+// A predictor sees predict() for a branch (knowing only its PC and kind),
+// then update() with the outcome, before the next branch
+class BranchPredictor {
+public:
+    virtual ~BranchPredictor() {}
+    virtual std::string name() const = 0;
+    virtual BranchPrediction predict(const BranchEvent &e) = 0;
+    virtual void update(const BranchEvent &e, const BranchPrediction &p) = 0;
+};
+
+inline uint64_t branch_hash(uint64_t pc) {
+    return pc ^ (pc >> 2);  // Spreads 4-byte aligned and byte aligned PCs alike
+}
+
+// Two-bit saturating counters indexed by PC
+class BimodalPredictor : public BranchPredictor {
+    int bits;
+    std::vector<uint8_t> counters;
+
+public:
+    explicit BimodalPredictor(int indexBits) : bits(indexBits), counters(1 << indexBits, 1) {}
+    std::string name() const {
+        return "bimodal:" + std::to_string(bits);
+    }
+    BranchPrediction predict(const BranchEvent &e) {
+        bool taken = e.kind != BRANCH_COND || counters[branch_hash(e.pc) & (counters.size() - 1)] >= 2;
+        return BranchPrediction{taken, false, 0};
+    }
+    void update(const BranchEvent &e, const BranchPrediction &) {
+        if (e.kind != BRANCH_COND) return;
+        uint8_t &c = counters[branch_hash(e.pc) & (counters.size() - 1)];
+        if (e.taken) c += c < 3;
+        else c -= c > 0;
+    }
+};
+
+// Two-bit counters indexed by PC xor the global history of directions
+class GsharePredictor : public BranchPredictor {
+    int bits;
+    uint64_t history = 0;
+    std::vector<uint8_t> counters;
+
+    size_t index(uint64_t pc) const {
+        return (branch_hash(pc) ^ history) & (counters.size() - 1);
+    }
+
+public:
+    explicit GsharePredictor(int indexBits) : bits(indexBits), counters(1 << indexBits, 1) {}
+    std::string name() const {
+        return "gshare:" + std::to_string(bits);
+    }
+    BranchPrediction predict(const BranchEvent &e) {
+        return BranchPrediction{e.kind != BRANCH_COND || counters[index(e.pc)] >= 2, false, 0};
+    }
+    void update(const BranchEvent &e, const BranchPrediction &) {
+        if (e.kind != BRANCH_COND) return;
+        uint8_t &c = counters[index(e.pc)];
+        if (e.taken) c += c < 3;
+        else c -= c > 0;
+        history = (history << 1) | e.taken;
+    }
+};
+
+// A small TAGE: a bimodal base and four tagged tables looked up with
+// geometrically longer slices of the global history. The longest table
+// whose tag matches provides the prediction; a misprediction allocates an
+// entry in a longer table.
+class TagePredictor : public BranchPredictor {
+    static const int TABLES = 4;
+    static const int TABLE_BITS = 11;
+    static const int TAG_BITS = 10;
+    static const int BASE_BITS = 12;
+    static const uint64_t RESET_PERIOD = 1 << 18;   // Branches between halvings of the useful bits
+
+    struct Entry {
+        uint16_t tag;
+        int8_t counter;     // -4..3, taken when >= 0
+        uint8_t useful;     // 0..3
+    };
+
+    const int lengths[TABLES] = { 5, 12, 27, 64 };
+    std::vector<Entry> tables[TABLES];
+    std::vector<uint8_t> base;
+    uint64_t history = 0;
+    uint64_t updates = 0;
+
+    // Lookup state between predict() and update()
+    size_t indices[TABLES];
+    uint16_t tags[TABLES];
+    int provider;           // Table, or -1 for the base
+    bool providerTaken;
+    bool altTaken;
+
+    static uint64_t fold(uint64_t h, int length, int bits) {
+        if (length < 64) h &= (1ULL << length) - 1;
+        uint64_t r = 0;
+        for (; h; h >>= bits) r ^= h & ((1ULL << bits) - 1);
+        return r;
+    }
+    size_t base_index(uint64_t pc) const {
+        return branch_hash(pc) & ((1 << BASE_BITS) - 1);
+    }
+
+public:
+    TagePredictor() : base(1 << BASE_BITS, 1) {
+        for (int t = 0; t < TABLES; t++) tables[t].assign(1 << TABLE_BITS, Entry{0, 0, 0});
+    }
+    std::string name() const {
+        return "tage";
+    }
+    BranchPrediction predict(const BranchEvent &e) {
+        if (e.kind != BRANCH_COND) return BranchPrediction{true, false, 0};
+        uint64_t h = branch_hash(e.pc);
+        provider = -1;
+        int alt = -1;
+        for (int t = 0; t < TABLES; t++) {
+            indices[t] = (h ^ (h >> TABLE_BITS) ^ fold(history, lengths[t], TABLE_BITS)) & ((1 << TABLE_BITS) - 1);
+            tags[t] = (h ^ fold(history, lengths[t], TAG_BITS - 1) ^ (fold(history, lengths[t], TAG_BITS - 2) << 1))
+                      & ((1 << TAG_BITS) - 1);
+            if (tables[t][indices[t]].tag == tags[t]) {
+                alt = provider;
+                provider = t;
+            }
+        }
+        bool baseTaken = base[base_index(e.pc)] >= 2;
+        altTaken = alt >= 0 ? tables[alt][indices[alt]].counter >= 0 : baseTaken;
+        providerTaken = provider >= 0 ? tables[provider][indices[provider]].counter >= 0 : baseTaken;
+        return BranchPrediction{providerTaken, false, 0};
+    }
+    void update(const BranchEvent &e, const BranchPrediction &) {
+        if (e.kind != BRANCH_COND) return;
+        if (provider >= 0) {
+            Entry &entry = tables[provider][indices[provider]];
+            if (e.taken) entry.counter += entry.counter < 3;
+            else entry.counter -= entry.counter > -4;
+            if (providerTaken != altTaken) {
+                if (providerTaken == e.taken) entry.useful += entry.useful < 3;
+                else entry.useful -= entry.useful > 0;
+            }
+        }
+        else {
+            uint8_t &c = base[base_index(e.pc)];
+            if (e.taken) c += c < 3;
+            else c -= c > 0;
+        }
+
+        if (providerTaken != e.taken && provider < TABLES - 1) {
+            bool allocated = false;
+            for (int t = provider + 1; t < TABLES && !allocated; t++) {
+                Entry &entry = tables[t][indices[t]];
+                if (entry.useful == 0) {
+                    entry = Entry{tags[t], (int8_t)(e.taken ? 0 : -1), 0};
+                    allocated = true;
+                }
+            }
+            if (!allocated) {
+                for (int t = provider + 1; t < TABLES; t++) tables[t][indices[t]].useful--;
+            }
+        }
+        if (++updates % RESET_PERIOD == 0) {
+            for (int t = 0; t < TABLES; t++) {
+                for (Entry &entry : tables[t]) entry.useful >>= 1;
+            }
+        }
+        history = (history << 1) | e.taken;
+    }
+};
+
+// Branch target buffer with two-bit counters for direction, and a return
+// address stack for returns. Unlike the others it predicts targets, so a
+// jump to the wrong place counts against it.
+class BtbPredictor : public BranchPredictor {
+    static const size_t RAS_DEPTH = 16;
+
+    struct Entry {
+        uint64_t pc;
+        uint64_t target;
+        uint8_t counter;
+    };
+
+    int bits;
+    std::vector<Entry> entries;
+    uint64_t ras[RAS_DEPTH];
+    size_t rasTop = 0;      // Pushes minus pops; wraps, overwriting the oldest
+
+    Entry &entry(uint64_t pc) {
+        return entries[branch_hash(pc) & (entries.size() - 1)];
+    }
+
+public:
+    explicit BtbPredictor(int indexBits) : bits(indexBits), entries(1 << indexBits, Entry{UINT64_MAX, 0, 0}) {}
+    std::string name() const {
+        return "btb:" + std::to_string(bits);
+    }
+    BranchPrediction predict(const BranchEvent &e) {
+        if (e.kind == BRANCH_RETURN) {
+            if (rasTop == 0) return BranchPrediction{true, true, 0};
+            return BranchPrediction{true, true, ras[(rasTop - 1) % RAS_DEPTH]};
+        }
+        Entry &found = entry(e.pc);
+        bool hit = found.pc == e.pc;
+        if (e.kind == BRANCH_COND) return BranchPrediction{hit && found.counter >= 2, true, found.target};
+        return BranchPrediction{true, true, hit ? found.target : 0};
+    }
+    void update(const BranchEvent &e, const BranchPrediction &) {
+        if (e.kind == BRANCH_RETURN) {
+            if (rasTop) rasTop--;
+            return;
+        }
+        if (e.kind == BRANCH_CALL) ras[rasTop++ % RAS_DEPTH] = e.fallthrough;
+        Entry &found = entry(e.pc);
+        if (found.pc != e.pc) {
+            if (!e.taken) return;   // Only taken branches get an entry
+            found = Entry{e.pc, e.target, 2};
+        }
+        else if (e.taken) {
+            found.target = e.target;
+            found.counter += found.counter < 3;
+        }
+        else found.counter -= found.counter > 0;
+    }
+};
+
+// "name" or "name:bits" with name bimodal, gshare, tage or btb; null if unknown
+inline std::unique_ptr<BranchPredictor> make_predictor(const std::string &spec) {
+    size_t colon = spec.find(':');
+    std::string name = spec.substr(0, colon);
+    int bits = colon == std::string::npos ? 0 : atoi(spec.c_str() + colon + 1);
+    if (colon != std::string::npos && (bits < 1 || bits > 24)) return nullptr;
+    if (name == "bimodal") return std::unique_ptr<BranchPredictor>(new BimodalPredictor(bits ? bits : 12));
+    if (name == "gshare") return std::unique_ptr<BranchPredictor>(new GsharePredictor(bits ? bits : 14));
+    if (name == "tage") return std::unique_ptr<BranchPredictor>(new TagePredictor());
+    if (name == "btb") return std::unique_ptr<BranchPredictor>(new BtbPredictor(bits ? bits : 10));
+    return nullptr;
+}
+
+const char *const DEFAULT_PREDICTORS = "bimodal,gshare,tage,btb";
+
+// Runs several predictors side by side over the same branches and counts
+// their mispredictions, overall, per kind of branch and per static branch
+class BranchBench {
+    struct Static {
+        uint8_t kind;
+        uint64_t executed;
+        uint64_t taken;
+        std::vector<uint64_t> misses;   // Per predictor
+    };
+
+    std::vector<std::unique_ptr<BranchPredictor>> predictors;
+    std::vector<std::vector<uint64_t>> misses;  // Per predictor, per kind
+    uint64_t branches[BRANCH_KINDS] = {};
+    std::unordered_map<uint64_t, Static> statics;
+
+    static bool correct(const BranchEvent &e, const BranchPrediction &p) {
+        if (e.kind == BRANCH_COND && p.taken != e.taken) return false;
+        if (!e.taken || !p.hasTarget) return true;
+        return p.taken && p.target == e.target;
+    }
+
+public:
+    // A comma-separated list of make_predictor() specs; false (after
+    // printing which) if one is unknown
+    bool add(const char *specs) {
+        std::string all(specs);
+        size_t at = 0;
+        while (at <= all.size()) {
+            size_t comma = all.find(',', at);
+            if (comma == std::string::npos) comma = all.size();
+            std::string spec = all.substr(at, comma - at);
+            at = comma + 1;
+            std::unique_ptr<BranchPredictor> p = make_predictor(spec);
+            if (!p) {
+                fprintf(stderr, "unknown branch predictor %s\n", spec.c_str());
+                return false;
+            }
+            predictors.push_back(std::move(p));
+            misses.push_back(std::vector<uint64_t>(BRANCH_KINDS, 0));
+        }
+        return true;
+    }
+
+    void resolve(const BranchEvent &e) {
+        branches[e.kind]++;
+        Static &s = statics[e.pc];
+        if (s.misses.empty()) {
+            s.kind = e.kind;
+            s.misses.assign(predictors.size(), 0);
+        }
+        s.executed++;
+        s.taken += e.taken;
+        for (size_t p = 0; p < predictors.size(); p++) {
+            BranchPrediction prediction = predictors[p]->predict(e);
+            if (!correct(e, prediction)) {
+                misses[p][e.kind]++;
+                s.misses[p]++;
+            }
+            predictors[p]->update(e, prediction);
+        }
+    }
+
+    void report(FILE *out, uint64_t instructions, size_t top) const {
+        static const char *KINDS[BRANCH_KINDS] = { "cond", "jump", "call", "return", "indirect" };
+        double kilo = instructions ? instructions / 1000.0 : 1.0;
+        uint64_t total = 0;
+        for (int k = 0; k < BRANCH_KINDS; k++) total += branches[k];
+
+        fprintf(out, "Branch predictors (%" PRIu64 " instructions, %" PRIu64 " branches)\n", instructions, total);
+        fprintf(out, "  %-14s %10s %8s %9s", "predictor", "misses", "MPKI", "accuracy");
+        for (int k = 0; k < BRANCH_KINDS; k++) {
+            if (branches[k]) fprintf(out, " %10s", KINDS[k]);
+        }
+        fputc('\n', out);
+        for (size_t p = 0; p < predictors.size(); p++) {
+            uint64_t m = 0;
+            for (int k = 0; k < BRANCH_KINDS; k++) m += misses[p][k];
+            fprintf(out, "  %-14s %10" PRIu64 " %8.3f %8.2f%%", predictors[p]->name().c_str(), m, m / kilo,
+                    total ? 100.0 * (total - m) / total : 100.0);
+            for (int k = 0; k < BRANCH_KINDS; k++) {
+                if (branches[k]) fprintf(out, " %10" PRIu64, misses[p][k]);
+            }
+            fputc('\n', out);
+        }
+        fprintf(out, "  %-14s %10s %8s %9s", "executed", "", "", "");
+        for (int k = 0; k < BRANCH_KINDS; k++) {
+            if (branches[k]) fprintf(out, " %10" PRIu64, branches[k]);
+        }
+        fputc('\n', out);
+
+        std::vector<std::pair<uint64_t, const Static *>> hot;
+        for (const auto &s : statics) hot.push_back(std::make_pair(s.first, &s.second));
+        auto worst = [](const Static *s) {
+            return *std::max_element(s->misses.begin(), s->misses.end());
+        };
+        std::sort(hot.begin(), hot.end(), [&](const std::pair<uint64_t, const Static *> &a,
+                                              const std::pair<uint64_t, const Static *> &b) {
+            return worst(a.second) != worst(b.second) ? worst(a.second) > worst(b.second) : a.first < b.first;
+        });
+        fprintf(out, "\nStatic branches by mispredictions (%zu of %zu)\n", std::min(top, hot.size()), hot.size());
+        fprintf(out, "  %-10s %-8s %10s %7s", "pc", "kind", "executed", "taken");
+        for (const auto &p : predictors) fprintf(out, " %14s", p->name().c_str());
+        fputc('\n', out);
+        for (size_t i = 0; i < hot.size() && i < top; i++) {
+            const Static &s = *hot[i].second;
+            fprintf(out, "  0x%08" PRIx64 " %-8s %10" PRIu64 " %6.1f%%", hot[i].first, KINDS[s.kind], s.executed,
+                    100.0 * s.taken / s.executed);
+            for (uint64_t m : s.misses) fprintf(out, " %14" PRIu64, m);
+            fputc('\n', out);
+        }
+    }
+};
+
+// Branch trace file: the magic "CPUB", a version byte, an 8-byte ISA name,
+// then per branch:
+//   varint  instructions retired since the previous branch, this one included
+//   varint  (index + 1) << 2 | new target << 1 | taken
+//   varint  PC, byte kind, varint fall-through - PC   if index is a new static branch
+//   varint  zigzag target - PC                          if new target
+// Static branches are numbered in order of first appearance, and a target
+// is only written when it differs from that branch's last one, so most
+// branches take two bytes. A word of 0 ends the trace, after the
+// instructions retired since the last branch.
+class BranchTraceCodec {
+protected:
+    static const uint8_t VERSION = 1;
+
+    struct Known {
+        uint64_t pc;
+        uint64_t fallthrough;
+        uint64_t target;
+        uint8_t kind;
+    };
+    std::vector<Known> known;
+
+    static uint64_t zigzag(int64_t v) {
+        return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);
+    }
+    static int64_t unzigzag(uint64_t v) {
+        return (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+    }
+};
+
+class BranchTraceWriter : BranchTraceCodec {
+    FILE *file = nullptr;
+    std::vector<uint8_t> out;
+    std::unordered_map<uint64_t, uint32_t> indices;
+    uint64_t lastRetired = 0;
+
+    void put_varint(uint64_t v) {
+        while (v >= 0x80) {
+            out.push_back((v & 0x7f) | 0x80);
+            v >>= 7;
+        }
+        out.push_back(v);
+    }
+    void flush() {
+        fwrite(out.data(), 1, out.size(), file);
+        out.clear();
+    }
+
+public:
+    ~BranchTraceWriter() {
+        if (file) fclose(file);
+    }
+
+    bool open(const char *path, const char *isa) {
+        file = fopen(path, "wb");
+        if (!file) return false;
+        char header[13] = { 'C', 'P', 'U', 'B', (char)VERSION };
+        strncpy(header + 5, isa, 8);
+        return fwrite(header, 1, sizeof(header), file) == sizeof(header);
+    }
+    bool is_open() const {
+        return file != nullptr;
+    }
+
+    // retired counts the branch itself
+    void write(const BranchEvent &e, uint64_t retired) {
+        put_varint(retired - lastRetired);
+        lastRetired = retired;
+        auto found = indices.find(e.pc);
+        bool fresh = found == indices.end();
+        uint32_t index = fresh ? known.size() : found->second;
+        if (fresh) {
+            indices[e.pc] = index;
+            known.push_back(Known{e.pc, e.fallthrough, 0, e.kind});
+        }
+        bool newTarget = e.taken && known[index].target != e.target;
+        put_varint(((uint64_t)(index + 1) << 2) | (newTarget << 1) | e.taken);
+        if (fresh) {
+            put_varint(e.pc);
+            out.push_back(e.kind);
+            put_varint(e.fallthrough - e.pc);
+        }
+        if (newTarget) {
+            put_varint(zigzag(e.target - e.pc));
+            known[index].target = e.target;
+        }
+        if (out.size() >= (1 << 16)) flush();
+    }
+
+    bool close(uint64_t retired) {
+        if (!file) return true;
+        put_varint(retired - lastRetired);
+        put_varint(0);
+        flush();
+        bool ok = fclose(file) == 0;
+        file = nullptr;
+        return ok;
+    }
+};
+
+class BranchTraceReader : BranchTraceCodec {
+    FILE *file = nullptr;
+    char isaName[9] = {};
+    uint64_t retired = 0;
+
+    bool get_varint(uint64_t &v) {
+        v = 0;
+        for (int shift = 0; shift < 64; shift += 7) {
+            int c = fgetc(file);
+            if (c == EOF) return false;
+            v |= (uint64_t)(c & 0x7f) << shift;
+            if (!(c & 0x80)) return true;
+        }
+        return false;
+    }
+
+public:
+    ~BranchTraceReader() {
+        if (file) fclose(file);
+    }
+
+    bool open(const char *path) {
+        file = fopen(path, "rb");
+        if (!file) return false;
+        char magic[5];
+        return fread(magic, 1, 5, file) == 5 && !memcmp(magic, "CPUB", 4) && magic[4] == VERSION
+            && fread(isaName, 1, 8, file) == 8;
+    }
+    const char *isa() const {
+        return isaName;
+    }
+    // Instructions retired up to the last branch read (the whole run at the end)
+    uint64_t instructions() const {
+        return retired;
+    }
+
+    // False at the end of the trace, or where a truncated one stops
+    bool next(BranchEvent &e) {
+        uint64_t gap, word, v;
+        if (!get_varint(gap) || !get_varint(word)) return false;
+        retired += gap;
+        if (word == 0) return false;
+        uint64_t index = (word >> 2) - 1;
+        if (index > known.size()) return false;
+        if (index == known.size()) {
+            Known k = {};
+            int kind;
+            if (!get_varint(k.pc) || (kind = fgetc(file)) == EOF || kind >= BRANCH_KINDS || !get_varint(v)) return false;
+            k.kind = kind;
+            k.fallthrough = k.pc + v;
+            known.push_back(k);
+        }
+        Known &k = known[index];
+        if (word & 2) {
+            if (!get_varint(v)) return false;
+            k.target = k.pc + unzigzag(v);
+        }
+        e.pc = k.pc;
+        e.kind = k.kind;
+        e.fallthrough = k.fallthrough;
+        e.taken = word & 1;
+        e.target = e.taken ? k.target : k.fallthrough;
+        return true;
+    }
+};
+
+#endif
@@ -0,0 +1,441 @@
+#include <algorithm>
+#include <cinttypes>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#ifndef CACHE_H
+#define CACHE_H
+
+struct CacheConfig {
+    uint64_t size;          // Bytes
+    uint32_t ways;
+    int latency;            // Cycles for a hit
+};
+
+struct HierarchyConfig {
+    CacheConfig l1i = { 32 << 10, 8, 1 };
+    CacheConfig l1d = { 32 << 10, 8, 4 };
+    CacheConfig l2 = { 256 << 10, 8, 12 };
+    uint32_t line = 64;     // Bytes, the same at every level
+    bool plru = false;      // Tree pseudo-LRU instead of true LRU
+    bool writeThrough = false; // Write-through without allocation, instead of write-back
+    int prefetch = 1;       // Next lines fetched into L1D on a miss, 0 for none
+    int memoryLatency = 100;
+
+    // "key=value,..." with l1i, l1d and l2 as size/ways/latency (size may
+    // end in k or m), line, replace (lru or plru), write (back or through),
+    // prefetch and memory; false on anything malformed
+    bool parse(const char *spec) {
+        std::string all(spec);
+        size_t at = 0;
+        while (at < all.size()) {
+            size_t comma = all.find(',', at);
+            if (comma == std::string::npos) comma = all.size();
+            std::string item = all.substr(at, comma - at);
+            at = comma + 1;
+            size_t eq = item.find('=');
+            if (eq == std::string::npos) return false;
+            std::string key = item.substr(0, eq);
+            const char *value = item.c_str() + eq + 1;
+            if (key == "l1i" || key == "l1d" || key == "l2") {
+                CacheConfig &cache = key == "l1i" ? l1i : key == "l1d" ? l1d : l2;
+                char *end;
+                cache.size = strtoull(value, &end, 0);
+                if (*end == 'k' || *end == 'K') cache.size <<= 10, end++;
+                else if (*end == 'm' || *end == 'M') cache.size <<= 20, end++;
+                if (*end == '/') cache.ways = strtoul(end + 1, &end, 0);
+                if (*end == '/') cache.latency = strtol(end + 1, &end, 0);
+                if (*end) return false;
+            }
+            else if (key == "line") line = strtoul(value, nullptr, 0);
+            else if (key == "replace" && !strcmp(value, "lru")) plru = false;
+            else if (key == "replace" && !strcmp(value, "plru")) plru = true;
+            else if (key == "write" && !strcmp(value, "back")) writeThrough = false;
+            else if (key == "write" && !strcmp(value, "through")) writeThrough = true;
+            else if (key == "prefetch") prefetch = strtol(value, nullptr, 0);
+            else if (key == "memory") memoryLatency = strtol(value, nullptr, 0);
+            else return false;
+        }
+        return valid(l1i) && valid(l1d) && valid(l2) && prefetch >= 0;
+    }
+
+    // Sets, ways and lines must all be powers of two
+    bool valid(const CacheConfig &cache) const {
+        auto pow2 = [](uint64_t n) { return n && !(n & (n - 1)); };
+        return pow2(line) && pow2(cache.ways) && cache.ways <= 64 &&
+               cache.size % ((uint64_t)cache.ways * line) == 0 && pow2(cache.size / cache.ways / line);
+    }
+};
+
+// Fully associative LRU cache of as many lines as the cache it shadows. A
+// miss that the shadow would have hit is a conflict miss; one it misses too
+// is a capacity miss.
+class LruShadow {
+    std::unordered_map<uint64_t, uint32_t> where;
+    std::vector<uint64_t> lines;
+    std::vector<uint32_t> prev;     // Node 0 is the list head: next[0] is the MRU line
+    std::vector<uint32_t> next;
+    uint32_t capacity = 0;
+
+    void unlink(uint32_t node) {
+        next[prev[node]] = next[node];
+        prev[next[node]] = prev[node];
+    }
+    void push_front(uint32_t node) {
+        prev[node] = 0;
+        next[node] = next[0];
+        prev[next[0]] = node;
+        next[0] = node;
+    }
+
+public:
+    void init(uint32_t lineCount) {
+        capacity = lineCount;
+        where.clear();
+        where.reserve(lineCount * 2);
+        lines.assign(1, 0);
+        prev.assign(1, 0);
+        next.assign(1, 0);
+    }
+
+    bool contains(uint64_t line) const {
+        return where.count(line) != 0;
+    }
+
+    // True if the line was present; it is the most recent either way
+    bool touch(uint64_t line) {
+        auto found = where.find(line);
+        if (found != where.end()) {
+            unlink(found->second);
+            push_front(found->second);
+            return true;
+        }
+        uint32_t node;
+        if (lines.size() <= capacity) {
+            node = lines.size();
+            lines.push_back(line);
+            prev.push_back(0);
+            next.push_back(0);
+        }
+        else {
+            node = prev[0];             // LRU line
+            unlink(node);
+            where.erase(lines[node]);
+            lines[node] = line;
+        }
+        where[line] = node;
+        push_front(node);
+        return false;
+    }
+};
+
+enum MissKind {
+    MISS_COMPULSORY,
+    MISS_CAPACITY,
+    MISS_CONFLICT,
+    MISS_KINDS
+};
+
+// One set-associative cache level. Addresses are line numbers. Repeated
+// accesses to the line hit last are caught before the set is searched, which
+// keeps sequential fetches and stack traffic cheap: they change neither
+// the replacement state nor the shadow's order.
+class Cache {
+    static const uint8_t DIRTY = 1;
+    static const uint8_t PREFETCHED = 2;    // Filled by the prefetcher, not used yet
+    static constexpr uint64_t INVALID = UINT64_MAX;
+
+    std::vector<uint64_t> tags;     // sets x ways
+    std::vector<uint64_t> stamps;   // LRU: last use of each way
+    std::vector<uint64_t> trees;    // PLRU: ways - 1 bits per set, heap ordered from bit 1
+    std::vector<uint8_t> state;
+    uint64_t setMask = 0;
+    uint32_t ways = 0;
+    int wayBits = 0;
+    bool plru = false;
+    uint64_t clock = 0;
+    uint64_t lastLine = INVALID;
+    size_t lastSlot = 0;
+
+    LruShadow shadow;
+    std::unordered_set<uint64_t> seen;
+
+    void touch(size_t slot) {
+        if (!plru) {
+            stamps[slot] = ++clock;
+            return;
+        }
+        size_t set = slot >> wayBits;
+        uint32_t way = slot & (ways - 1);
+        uint64_t &tree = trees[set];
+        uint32_t node = 1;
+        for (int level = wayBits - 1; level >= 0; level--) {
+            uint32_t bit = (way >> level) & 1;
+            if (bit) tree &= ~(1ULL << node);   // Point away from the way just used
+            else tree |= 1ULL << node;
+            node = node * 2 + bit;
+        }
+    }
+    size_t victim(size_t set) const {
+        size_t first = set << wayBits;
+        for (uint32_t w = 0; w < ways; w++) {
+            if (tags[first + w] == INVALID) return first + w;
+        }
+        if (plru) {
+            uint32_t node = 1;
+            for (int level = 0; level < wayBits; level++) node = node * 2 + ((trees[set] >> node) & 1);
+            return first + (node - ways);
+        }
+        return std::min_element(stamps.begin() + first, stamps.begin() + first + ways) - stamps.begin();
+    }
+
+public:
+    const char *name = "";
+    int latency = 0;
+    uint64_t accesses[2] = {};      // Demand reads and writes
+    uint64_t misses[2] = {};
+    uint64_t kinds[MISS_KINDS] = {};
+    uint64_t writebacks = 0;        // Dirty lines evicted
+    uint64_t prefetches = 0;
+    uint64_t usefulPrefetches = 0;  // Prefetched lines hit by a demand access
+    uint64_t uselessPrefetches = 0; // Prefetched lines evicted unused
+
+    struct Result {
+        bool hit;
+        bool writeback;             // A dirty line was evicted
+        uint64_t victim;
+    };
+
+    void init(const char *cacheName, const CacheConfig &config, uint32_t line, bool pseudoLru) {
+        name = cacheName;
+        latency = config.latency;
+        ways = config.ways;
+        wayBits = __builtin_ctz(ways);
+        plru = pseudoLru;
+        uint64_t sets = config.size / ways / line;
+        setMask = sets - 1;
+        tags.assign(sets * ways, INVALID);
+        stamps.assign(sets * ways, 0);
+        trees.assign(sets, 0);
+        state.assign(sets * ways, 0);
+        shadow.init(sets * ways);
+    }
+
+    bool contains(uint64_t line) const {
+        size_t first = (line & setMask) << wayBits;
+        for (uint32_t w = 0; w < ways; w++) {
+            if (tags[first + w] == line) return true;
+        }
+        return false;
+    }
+
+    // A demand access. Without allocate a miss leaves the cache as it was.
+    Result access(uint64_t line, bool write, bool allocate, bool dirty) {
+        Result result = { true, false, 0 };
+        accesses[write]++;
+        if (line == lastLine) {
+            if (dirty) state[lastSlot] |= DIRTY;
+            return result;
+        }
+        size_t set = line & setMask;
+        size_t first = set << wayBits;
+        for (uint32_t w = 0; w < ways; w++) {
+            if (tags[first + w] != line) continue;
+            size_t slot = first + w;
+            touch(slot);
+            shadow.touch(line);
+            if (state[slot] & PREFETCHED) usefulPrefetches++;
+            state[slot] &= ~PREFETCHED;
+            if (dirty) state[slot] |= DIRTY;
+            lastLine = line;
+            lastSlot = slot;
+            return result;
+        }
+
+        // Lines not allocated stay out of the shadow too, so a later miss
+        // on them is not taken for a conflict
+        result.hit = false;
+        misses[write]++;
+        if (!seen.count(line)) kinds[MISS_COMPULSORY]++;
+        else kinds[shadow.contains(line) ? MISS_CONFLICT : MISS_CAPACITY]++;
+        if (allocate) {
+            seen.insert(line);
+            shadow.touch(line);
+            result = fill(line, dirty, false);
+        }
+        return result;
+    }
+
+    // Puts a line in without counting an access, as the prefetcher does
+    Result fill(uint64_t line, bool dirty, bool prefetched) {
+        Result result = { false, false, 0 };
+        size_t slot = victim(line & setMask);
+        if (tags[slot] != INVALID) {
+            if (state[slot] & DIRTY) {
+                result.writeback = true;
+                result.victim = tags[slot];
+                writebacks++;
+            }
+            if (state[slot] & PREFETCHED) uselessPrefetches++;
+            if (tags[slot] == lastLine) lastLine = INVALID;
+        }
+        tags[slot] = line;
+        state[slot] = (dirty ? DIRTY : 0) | (prefetched ? PREFETCHED : 0);
+        if (prefetched) prefetches++;
+        else {
+            lastLine = line;
+            lastSlot = slot;
+        }
+        touch(slot);
+        return result;
+    }
+
+    uint64_t total_accesses() const {
+        return accesses[0] + accesses[1];
+    }
+    uint64_t total_misses() const {
+        return misses[0] + misses[1];
+    }
+    double miss_rate() const {
+        return total_accesses() ? (double)total_misses() / total_accesses() : 0.0;
+    }
+};
+
+// L1 instruction and data caches over a unified L2 and memory, fed with
+// the addresses the functional model fetches, loads and stores. Write-back
+// caches allocate on a write miss; write-through caches pass every write
+// down and do not allocate. The prefetcher brings the next lines into L1D
+// (through L2) after each L1D miss.
+class CacheHierarchy {
+    HierarchyConfig config;
+    int lineShift = 0;
+    Cache l1i;
+    Cache l1d;
+    Cache l2;
+    uint64_t memoryReads = 0;
+    uint64_t memoryWrites = 0;
+    std::unordered_map<uint64_t, uint64_t> missPcs; // L1D misses by the PC of the load or store
+
+    void l2_access(uint64_t line, bool write) {
+        Cache::Result r = l2.access(line, write, !write || !config.writeThrough, write && !config.writeThrough);
+        if (!r.hit && !write) memoryReads++;
+        if (r.writeback || (write && config.writeThrough)) memoryWrites++;
+    }
+    // A line leaving L1D goes down to L2 if it is dirty
+    void evicted(const Cache::Result &r) {
+        if (r.writeback) l2_access(r.victim, true);
+    }
+    void prefetch(uint64_t line) {
+        for (int p = 1; p <= config.prefetch; p++) {
+            if (l1d.contains(line + p)) continue;
+            if (!l2.contains(line + p)) {
+                memoryReads++;
+                if (l2.fill(line + p, false, false).writeback) memoryWrites++;
+            }
+            evicted(l1d.fill(line + p, false, true));
+        }
+    }
+
+public:
+    explicit CacheHierarchy(const HierarchyConfig &cfg = HierarchyConfig()) : config(cfg) {
+        lineShift = __builtin_ctz(config.line);
+        l1i.init("L1I", config.l1i, config.line, config.plru);
+        l1d.init("L1D", config.l1d, config.line, config.plru);
+        l2.init("L2", config.l2, config.line, config.plru);
+    }
+
+    void fetch(uint64_t address, int bytes) {
+        uint64_t last = (address + bytes - 1) >> lineShift;
+        for (uint64_t line = address >> lineShift; line <= last; line++) {
+            Cache::Result r = l1i.access(line, false, true, false);
+            if (!r.hit) l2_access(line, false);
+        }
+    }
+    void read(uint64_t pc, uint64_t address, int bytes) {
+        uint64_t last = (address + bytes - 1) >> lineShift;
+        for (uint64_t line = address >> lineShift; line <= last; line++) {
+            Cache::Result r = l1d.access(line, false, true, false);
+            if (r.hit) continue;
+            missPcs[pc]++;
+            evicted(r);
+            l2_access(line, false);
+            prefetch(line);
+        }
+    }
+    void write(uint64_t pc, uint64_t address, int bytes) {
+        uint64_t last = (address + bytes - 1) >> lineShift;
+        for (uint64_t line = address >> lineShift; line <= last; line++) {
+            bool through = config.writeThrough;
+            Cache::Result r = l1d.access(line, true, !through, !through);
+            if (through) l2_access(line, true);
+            if (r.hit) continue;
+            missPcs[pc]++;
+            if (through) continue;
+            evicted(r);
+            l2_access(line, false); // Read for ownership
+            prefetch(line);
+        }
+    }
+    // A block of bytes read or written in order, upwards or downwards, as
+    // string instructions do
+    void block(uint64_t pc, uint64_t address, uint64_t bytes, bool store, bool down) {
+        if (!bytes) return;
+        uint64_t first = address >> lineShift;
+        uint64_t last = (address + bytes - 1) >> lineShift;
+        for (uint64_t i = 0; i <= last - first; i++) {
+            uint64_t line = down ? last - i : first + i;
+            uint64_t from = std::max(address, line << lineShift);
+            uint64_t to = std::min(address + bytes, (line + 1) << lineShift);
+            if (store) write(pc, from, to - from);
+            else read(pc, from, to - from);
+        }
+    }
+
+    // Average access time of an L1, from the measured local miss rates
+    double amat(const Cache &l1) const {
+        return l1.latency + l1.miss_rate() * (l2.latency + l2.miss_rate() * config.memoryLatency);
+    }
+
+    void report(FILE *out, size_t top) const {
+        fprintf(out, "Cache hierarchy (%u-byte lines, %s, write-%s, prefetch %d)\n", config.line,
+                config.plru ? "PLRU" : "LRU", config.writeThrough ? "through" : "back", config.prefetch);
+        fprintf(out, "  %-4s %8s %5s %4s %12s %12s %8s %12s %12s %12s %10s\n", "", "size", "ways", "lat",
+                "accesses", "misses", "miss", "compulsory", "capacity", "conflict", "writebacks");
+        const Cache *levels[3] = { &l1i, &l1d, &l2 };
+        const CacheConfig *configs[3] = { &config.l1i, &config.l1d, &config.l2 };
+        for (int l = 0; l < 3; l++) {
+            const Cache &c = *levels[l];
+            fprintf(out, "  %-4s %7" PRIu64 "K %5u %4d %12" PRIu64 " %12" PRIu64 " %7.2f%% %12" PRIu64 " %12" PRIu64
+                         " %12" PRIu64 " %10" PRIu64 "\n",
+                    c.name, configs[l]->size >> 10, configs[l]->ways, c.latency, c.total_accesses(),
+                    c.total_misses(), 100.0 * c.miss_rate(), c.kinds[MISS_COMPULSORY], c.kinds[MISS_CAPACITY],
+                    c.kinds[MISS_CONFLICT], c.writebacks);
+        }
+        fprintf(out, "  L1D reads %" PRIu64 " (%" PRIu64 " missed), writes %" PRIu64 " (%" PRIu64 " missed)\n",
+                l1d.accesses[0], l1d.misses[0], l1d.accesses[1], l1d.misses[1]);
+        fprintf(out, "  prefetches %" PRIu64 ", useful %" PRIu64 ", evicted unused %" PRIu64 "\n",
+                l1d.prefetches, l1d.usefulPrefetches, l1d.uselessPrefetches);
+        fprintf(out, "  memory reads %" PRIu64 ", writes %" PRIu64 " (lines)\n", memoryReads, memoryWrites);
+        fprintf(out, "\nAverage memory access time (memory %d cycles)\n", config.memoryLatency);
+        fprintf(out, "  instructions  %8.2f cycles\n", amat(l1i));
+        fprintf(out, "  data          %8.2f cycles\n", amat(l1d));
+
+        std::vector<std::pair<uint64_t, uint64_t>> hot(missPcs.begin(), missPcs.end());
+        std::sort(hot.begin(), hot.end(), [](const std::pair<uint64_t, uint64_t> &a,
+                                             const std::pair<uint64_t, uint64_t> &b) {
+            return a.second > b.second;
+        });
+        fprintf(out, "\nL1D misses by instruction (%zu of %zu)\n", std::min(top, hot.size()), hot.size());
+        for (size_t i = 0; i < hot.size() && i < top; i++) {
+            fprintf(out, "  0x%08" PRIx64 "  %12" PRIu64 "\n", hot[i].first, hot[i].second);
+        }
+    }
+};
+
+#endif
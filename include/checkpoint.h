@@ -0,0 +1,108 @@
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include "snapshot.h"
+
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+// Architectural state in the middle of a run: the PC, the registers and the
+// pages of memory that differ from the program image. Loading the binary and
+// then a Checkpoint resumes the guest where the checkpoint was taken, without
+// running everything before it.
+//
+// File layout: a Header, `regCount` int64 registers, then for each page its
+// uint32 page number followed by PAGE_SIZE bytes.
+struct Checkpoint {
+    uint64_t pc = 0;
+    uint64_t retired = 0;           // Instructions retired before this point
+    std::vector<int64_t> regs;
+    std::vector<uint32_t> pages;    // Page numbers, ascending
+    std::vector<char> data;         // PAGE_SIZE bytes per entry of pages
+
+    // Fill pages and data with the pages of memory that differ from image
+    void diff(const char *memory, const char *image, uint64_t size) {
+        pages.clear();
+        data.clear();
+        for (uint64_t offset = 0; offset < size; offset += PAGE_SIZE) {
+            uint64_t bytes = std::min<uint64_t>(PAGE_SIZE, size - offset);
+            if (!memcmp(memory + offset, image + offset, bytes)) continue;
+            pages.push_back(offset >> PAGE_SHIFT);
+            data.insert(data.end(), memory + offset, memory + offset + bytes);
+            data.resize(pages.size() * PAGE_SIZE, 0);
+        }
+    }
+
+    // Copy the saved pages into memory; false if one lies outside it
+    bool apply(char *memory, uint64_t size) const {
+        for (size_t i = 0; i < pages.size(); i++) {
+            uint64_t offset = (uint64_t)pages[i] << PAGE_SHIFT;
+            if (offset >= size) return false;
+            memcpy(memory + offset, data.data() + i * PAGE_SIZE, std::min<uint64_t>(PAGE_SIZE, size - offset));
+        }
+        return true;
+    }
+
+    bool write(const char *path, const char *isa) const {
+        Header header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, "CPUK", 4);
+        header.version = VERSION;
+        memcpy(header.isa, isa, std::min(strlen(isa), sizeof(header.isa)));
+        header.pc = pc;
+        header.retired = retired;
+        header.regCount = regs.size();
+        header.pageCount = pages.size();
+        FILE *f = fopen(path, "wb");
+        if (!f) return false;
+        bool ok = fwrite(&header, sizeof(header), 1, f) == 1 &&
+                  fwrite(regs.data(), sizeof(int64_t), regs.size(), f) == regs.size();
+        for (size_t i = 0; ok && i < pages.size(); i++) {
+            ok = fwrite(&pages[i], sizeof(uint32_t), 1, f) == 1 &&
+                 fwrite(data.data() + i * PAGE_SIZE, 1, PAGE_SIZE, f) == PAGE_SIZE;
+        }
+        return (fclose(f) == 0) && ok;
+    }
+
+    // False if the file is missing, truncated, or for another ISA
+    bool read(const char *path, const char *isa) {
+        FILE *f = fopen(path, "rb");
+        if (!f) return false;
+        Header header;
+        char name[8] = {};
+        memcpy(name, isa, std::min(strlen(isa), sizeof(name)));
+        bool ok = fread(&header, sizeof(header), 1, f) == 1 && !memcmp(header.magic, "CPUK", 4) &&
+                  header.version == VERSION && !memcmp(header.isa, name, sizeof(name));
+        if (ok) {
+            pc = header.pc;
+            retired = header.retired;
+            regs.resize(header.regCount);
+            pages.resize(header.pageCount);
+            data.resize((uint64_t)header.pageCount * PAGE_SIZE);
+            ok = fread(regs.data(), sizeof(int64_t), regs.size(), f) == regs.size();
+        }
+        for (size_t i = 0; ok && i < pages.size(); i++) {
+            ok = fread(&pages[i], sizeof(uint32_t), 1, f) == 1 &&
+                 fread(data.data() + i * PAGE_SIZE, 1, PAGE_SIZE, f) == PAGE_SIZE;
+        }
+        fclose(f);
+        return ok;
+    }
+
+private:
+    static const uint32_t VERSION = 1;
+
+    struct Header {
+        char magic[4];
+        uint32_t version;
+        char isa[8];
+        uint64_t pc;
+        uint64_t retired;
+        uint32_t regCount;
+        uint32_t pageCount;
+    };
+};
+
+#endif
@@ -0,0 +1,78 @@
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sys/ipc.h>
+#include <sys/shm.h>
+
+#ifndef COVERAGE_H
+#define COVERAGE_H
+
+const int COVERAGE_SHIFT = 16;
+const int COVERAGE_MAP_SIZE = 1 << COVERAGE_SHIFT; // AFL's MAP_SIZE
+
+enum CoverageMode {
+    COVERAGE_EDGES,  // One counter per (previous PC, next PC) pair
+    COVERAGE_BLOCKS  // One counter per basic block entered
+};
+
+// AFL-compatible coverage bitmap fed by control transfers only. Every branch
+// or jump ends a basic block, so straight-line instructions never touch the
+// map. Under afl-fuzz (or any harness that sets __AFL_SHM_ID) the map lives in
+// the harness's System V shared memory segment.
+class EdgeCoverage {
+    uint8_t *map;
+    uint8_t localMap[COVERAGE_MAP_SIZE];
+    bool shared = false;
+    CoverageMode mode = COVERAGE_EDGES;
+
+    static uint32_t hash(uint64_t pc) {
+        return (pc * 0x9e3779b97f4a7c15ULL) >> (64 - COVERAGE_SHIFT);
+    }
+
+public:
+    EdgeCoverage() {
+        map = localMap;
+        memset(localMap, 0, sizeof(localMap));
+    }
+    ~EdgeCoverage() {
+        if (shared) shmdt(map);
+    }
+
+    void set_mode(CoverageMode m) {
+        mode = m;
+    }
+
+    // Uses the map afl-fuzz hands over in __AFL_SHM_ID, if there is one
+    bool attach_afl() {
+        const char *id = getenv("__AFL_SHM_ID");
+        if (!id) return false;
+        void *mem = shmat(atoi(id), nullptr, 0);
+        if (mem == (void*)-1) return false;
+        map = static_cast<uint8_t*>(mem);
+        shared = true;
+        return true;
+    }
+
+    // Called on every control transfer
+    void edge(uint64_t from, uint64_t to) {
+        uint32_t index = hash(to);
+        if (mode == COVERAGE_EDGES) index ^= hash(from) >> 1;
+        map[index]++;
+    }
+
+    void clear() {
+        memset(map, 0, COVERAGE_MAP_SIZE);
+    }
+    const uint8_t *data() const {
+        return map;
+    }
+    bool write(const char *path) const {
+        FILE *f = fopen(path, "wb");
+        if (!f) return false;
+        bool ok = fwrite(map, 1, COVERAGE_MAP_SIZE, f) == (size_t)COVERAGE_MAP_SIZE;
+        return fclose(f) == 0 && ok;
+    }
+};
+
+#endif
@@ -0,0 +1,97 @@
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include "snapshot.h"
+
+#ifndef DIGEST_H
+#define DIGEST_H
+
+// 64-bit mixing hash for comparing runs. It is fast and well distributed,
+// which is all divergence checks need; it is not meant to resist tampering.
+inline uint64_t digest_mix(uint64_t h) {
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+inline uint64_t digest_bytes(const void *data, size_t size, uint64_t seed) {
+    const uint8_t *p = static_cast<const uint8_t*>(data);
+    uint64_t h = seed ^ (size * 0x9e3779b97f4a7c15ULL);
+    for (; size >= 8; p += 8, size -= 8) {
+        uint64_t word;
+        memcpy(&word, p, 8);
+        h = (h ^ (word * 0x87c37b91114253d5ULL)) * 0x4cf5ad432745937fULL;
+        h = (h << 31) | (h >> 33);
+    }
+    for (; size; p++, size--) h = (h ^ *p) * 0x100000001b3ULL;
+    return digest_mix(h);
+}
+inline uint64_t digest_pair(uint64_t left, uint64_t right) {
+    return digest_mix(left ^ digest_mix(right + 0x9e3779b97f4a7c15ULL));
+}
+
+// Merkle tree over the pages of guest memory. Writes mark their pages; a
+// query rehashes only those pages and the nodes on their paths to the root,
+// so comparing two machines costs one hash compare instead of a memory diff.
+class StateDigest {
+    const char *memory;
+    size_t pages;
+    size_t leaves;                 // pages rounded up to a power of two
+    std::vector<uint64_t> tree;    // Heap order: node i has children 2i and 2i+1
+    DirtyPages changed;            // Pages written since the last query
+    std::vector<uint32_t> parents; // Scratch list of nodes to rehash
+
+public:
+    void attach(const char *mem, size_t size) {
+        memory = mem;
+        pages = (size + PAGE_SIZE - 1) >> PAGE_SHIFT;
+        for (leaves = 1; leaves < pages; leaves <<= 1);
+        tree.assign(2 * leaves, 0);
+        changed.resize(size);
+        for (size_t page = 0; page < pages; page++) {
+            tree[leaves + page] = digest_bytes(memory + (page << PAGE_SHIFT), PAGE_SIZE, page);
+        }
+        for (size_t node = leaves - 1; node > 0; node--) {
+            tree[node] = digest_pair(tree[2 * node], tree[2 * node + 1]);
+        }
+    }
+
+    void touch(uint64_t address, uint64_t size) {
+        changed.mark_range(address, size);
+    }
+
+    // Root hash of memory as of now
+    uint64_t memory_root() {
+        if (changed.pages().empty()) return tree[1];
+        parents.clear();
+        for (uint32_t page : changed.pages()) {
+            tree[leaves + page] = digest_bytes(memory + ((size_t)page << PAGE_SHIFT), PAGE_SIZE, page);
+            parents.push_back((leaves + page) >> 1);
+        }
+        changed.clear();
+        // Walk up one level at a time. Sorted, siblings' shared parent shows
+        // up twice in a row, and the order survives the shift to the next level.
+        std::sort(parents.begin(), parents.end());
+        while (parents[0] != 0) {
+            size_t out = 0;
+            for (uint32_t node : parents) {
+                if (out && parents[out - 1] == node) continue;
+                tree[node] = digest_pair(tree[2 * node], tree[2 * node + 1]);
+                parents[out++] = node;
+            }
+            parents.resize(out);
+            for (uint32_t &node : parents) node >>= 1;
+        }
+        return tree[1];
+    }
+
+    // Digest of the whole architectural state: memory, registers and PC
+    uint64_t state(const void *regs, size_t regsSize, uint64_t pc) {
+        return digest_pair(memory_root(), digest_bytes(regs, regsSize, pc));
+    }
+};
+
+#endif
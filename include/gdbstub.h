@@ -0,0 +1,503 @@
+#include <algorithm>
+#include <cinttypes>
+#include <csignal>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <ucontext.h>
+#include <unistd.h>
+#include "predecode.h"
+
+#ifndef GDBSTUB_H
+#define GDBSTUB_H
+
+// Why a debugger-driven run (a Machine's debug_run) came back
+enum GdbStop {
+    GDB_STOP_LIMIT,     // Ran the instructions it was given
+    GDB_STOP_BREAK,     // About to run an instruction with a breakpoint on it
+    GDB_STOP_WATCH,     // An instruction touched a watched page
+    GDB_STOP_EXIT,      // The guest halted or ran off the end of its program
+};
+
+// What the server needs from a simulator: registers in the order GDB's
+// architecture numbers them, flat guest memory, and a way to run
+class GdbTarget {
+public:
+    virtual ~GdbTarget() {}
+    virtual int registers() const = 0;          // In a 'g' packet
+    virtual int register_bytes() const = 0;
+    virtual int pc_register() const = 0;
+    virtual uint64_t get_register(int) = 0;
+    virtual void set_register(int, uint64_t) = 0;
+    virtual char *memory() = 0;                 // Page aligned
+    virtual uint64_t memory_size() const = 0;
+    virtual void memory_written(uint64_t address, uint64_t length) = 0; // By the debugger
+    virtual bool breakpoint(uint64_t address, bool insert) = 0;
+    // Runs at most limit instructions, returning early when stop is set.
+    // resuming skips a breakpoint on the first instruction, the one the
+    // debugger continues from.
+    virtual GdbStop run(volatile bool &stop, uint64_t limit, bool resuming) = 0;
+};
+
+// Breakpoints kept in the flags of a predecoded program: a marked record
+// fails the decode fast path, and the slow path tells the run loop to stop.
+// Instructions without one run exactly as fast as they do without a debugger.
+// Self-modifying code only clears PREDECODE_VALID, so breakpoints survive it.
+template<typename Record>
+class BreakpointTable {
+    std::vector<Record> owned;
+    Record *records = nullptr;
+    size_t count = 0;
+    std::vector<size_t> slots;  // With a breakpoint
+
+    void mark(Record &r, bool on) {
+        if (on && !(r.flags & PREDECODE_BREAK)) {
+            r.flags |= PREDECODE_BREAK | ((r.flags & PREDECODE_VALID) ? PREDECODE_PARKED : 0);
+            r.flags &= ~PREDECODE_VALID;
+        }
+        else if (!on && (r.flags & PREDECODE_BREAK)) {
+            r.flags |= (r.flags & PREDECODE_PARKED) ? PREDECODE_VALID : 0;
+            r.flags &= ~(PREDECODE_BREAK | PREDECODE_PARKED);
+        }
+    }
+
+public:
+    ~BreakpointTable() {
+        clear();
+    }
+
+    // Sets breakpoints in table, the count records a machine already runs from
+    void adopt(Record *table, size_t n) {
+        records = table;
+        count = n;
+    }
+    // Storage of our own to predecode count slots into, for a machine that
+    // runs without a table
+    Record *build(size_t n) {
+        owned.assign(n, Record());
+        adopt(owned.data(), n);
+        return records;
+    }
+    bool set(size_t slot, bool insert) {
+        if (slot >= count) return false;
+        auto found = std::find(slots.begin(), slots.end(), slot);
+        if (insert && found == slots.end()) slots.push_back(slot);
+        if (!insert && found != slots.end()) slots.erase(found);
+        mark(records[slot], insert);
+        return true;
+    }
+    // Leaves the table as it was before any breakpoint was set
+    void clear() {
+        for (size_t slot : slots) mark(records[slot], false);
+        slots.clear();
+    }
+    Record *data() {
+        return records;
+    }
+};
+
+// Where the SIGSEGV handler leaves a watchpoint hit. Watched pages are
+// protected while the guest runs; the first access to one faults, and the
+// handler opens the page, notes the address and sets stop, so the faulting
+// access completes and the run loop stops after its instruction.
+struct GdbFault {
+    char *base = nullptr;
+    size_t size = 0;
+    size_t page = 4096;
+    volatile bool stop = false;
+    char *volatile address = nullptr;   // First faulting access
+    volatile bool write = false;
+    volatile bool known = false;        // Whether write is known
+};
+inline GdbFault gdbFault;
+
+inline void gdb_fault(int, siginfo_t *info, void *context) {
+    GdbFault &f = gdbFault;
+    char *at = static_cast<char *>(info->si_addr);
+    if (at < f.base || at >= f.base + f.size) { // Not the guest: a real crash
+        signal(SIGSEGV, SIG_DFL);
+        return;
+    }
+    mprotect(f.base + (at - f.base) / f.page * f.page, f.page, PROT_READ | PROT_WRITE);
+    if (!f.address) {
+        f.address = at;
+#if defined(__x86_64__) && defined(REG_ERR)
+        f.write = (static_cast<ucontext_t *>(context)->uc_mcontext.gregs[REG_ERR] & 2) != 0;
+        f.known = true;
+#endif
+    }
+    f.stop = true;
+}
+
+// A GDB Remote Serial Protocol server on a TCP port or a Unix socket. It
+// handles one debugger at a time: registers and memory, single step and
+// continue, software breakpoints (through a BreakpointTable) and write,
+// read and access watchpoints (through page protection). Between stops the
+// guest runs in slices of SLICE instructions, checking for a ^C from the
+// debugger in between.
+class GdbServer {
+    static const uint64_t SLICE = 1 << 20;
+
+    struct Watch {
+        uint64_t address;
+        uint64_t length;
+        int type;           // 2 write, 3 read, 4 access, as in Z packets
+    };
+
+    int listener = -1;
+    int conn = -1;
+    std::string unixPath;   // Unlinked when done
+    std::string pending;    // Received and not yet parsed
+    bool noAck = false;
+    std::vector<uint64_t> breakpoints;
+    std::vector<Watch> watches;
+
+    bool read_byte(char &c) {
+        if (pending.empty()) {
+            char buf[4096];
+            ssize_t n = recv(conn, buf, sizeof(buf), 0);
+            if (n <= 0) return false;
+            pending.assign(buf, n);
+        }
+        c = pending[0];
+        pending.erase(0, 1);
+        return true;
+    }
+
+    // The body of the next well-formed packet, or false when the debugger is gone
+    bool receive(std::string &packet) {
+        char c;
+        for (;;) {
+            do {
+                if (!read_byte(c)) return false;
+            } while (c != '$');
+            packet.clear();
+            uint8_t sum = 0;
+            while (read_byte(c) && c != '#') {
+                packet += c;
+                sum += c;
+            }
+            char check[3] = {0, 0, 0};
+            if (c != '#' || !read_byte(check[0]) || !read_byte(check[1])) return false;
+            bool ok = strtoul(check, nullptr, 16) == sum;
+            if (!noAck && send(conn, ok ? "+" : "-", 1, MSG_NOSIGNAL) != 1) return false;
+            if (ok) return true;
+        }
+    }
+
+    bool reply(const std::string &packet) {
+        uint8_t sum = 0;
+        for (char c : packet) sum += c;
+        char check[4];
+        snprintf(check, sizeof(check), "#%02x", sum);
+        std::string framed = "$" + packet + check;
+        for (;;) {
+            if (send(conn, framed.data(), framed.size(), MSG_NOSIGNAL) != (ssize_t)framed.size()) return false;
+            if (noAck) return true;
+            char c;
+            do {
+                if (!read_byte(c)) return false;
+            } while (c != '+' && c != '-');
+            if (c == '+') return true;
+        }
+    }
+
+    // A ^C sent while the guest runs
+    bool interrupted() {
+        if (pending.empty()) {
+            pollfd p = { conn, POLLIN, 0 };
+            if (poll(&p, 1, 0) <= 0) return false;
+            char buf[4096];
+            ssize_t n = recv(conn, buf, sizeof(buf), 0);
+            if (n <= 0) return true; // Gone; the next receive() notices
+            pending.assign(buf, n);
+        }
+        if (pending[0] != '\x03') return false;
+        pending.erase(0, 1);
+        return true;
+    }
+
+    static std::string hex(const void *data, size_t n) {
+        static const char digits[] = "0123456789abcdef";
+        const uint8_t *bytes = static_cast<const uint8_t *>(data);
+        std::string out;
+        for (size_t i = 0; i < n; i++) {
+            out += digits[bytes[i] >> 4];
+            out += digits[bytes[i] & 15];
+        }
+        return out;
+    }
+    static bool unhex(const char *text, size_t n, std::vector<uint8_t> &out) {
+        out.clear();
+        for (size_t i = 0; i < n; i++) {
+            char pair[3] = { text[2 * i], text[2 * i] ? text[2 * i + 1] : '\0', 0 };
+            char *end;
+            out.push_back(strtoul(pair, &end, 16));
+            if (end != pair + 2) return false;
+        }
+        return true;
+    }
+    // Registers are sent little-endian, register_bytes() each
+    std::string register_hex(GdbTarget &t, int n) {
+        uint64_t value = t.get_register(n);
+        uint8_t bytes[8];
+        for (int i = 0; i < 8; i++) bytes[i] = value >> (8 * i);
+        return hex(bytes, t.register_bytes());
+    }
+    uint64_t register_value(GdbTarget &t, const char *text) {
+        std::vector<uint8_t> bytes;
+        unhex(text, t.register_bytes(), bytes);
+        uint64_t value = 0;
+        for (size_t i = 0; i < bytes.size(); i++) value |= (uint64_t)bytes[i] << (8 * i);
+        return value;
+    }
+
+    bool in_memory(GdbTarget &t, uint64_t address, uint64_t length) {
+        return address <= t.memory_size() && length <= t.memory_size() - address;
+    }
+
+    // Read and access watches need the whole page closed, write watches
+    // only writes
+    void protect() {
+        for (const Watch &w : watches) {
+            uint64_t first = w.address / gdbFault.page;
+            uint64_t last = (w.address + w.length - 1) / gdbFault.page;
+            for (uint64_t page = first; page <= last; page++) {
+                int prot = PROT_READ;
+                for (const Watch &o : watches) {
+                    bool overlaps = o.address / gdbFault.page <= page && (o.address + o.length - 1) / gdbFault.page >= page;
+                    if (overlaps && o.type != 2) prot = PROT_NONE;
+                }
+                mprotect(gdbFault.base + page * gdbFault.page, gdbFault.page, prot);
+            }
+        }
+    }
+    void unprotect() {
+        mprotect(gdbFault.base, gdbFault.size, PROT_READ | PROT_WRITE);
+    }
+
+    // The stop reply for the watch the fault hit, or "" if it only hit a
+    // watched page. Accesses are at most 8 bytes wide.
+    std::string watch_hit() {
+        if (!gdbFault.address) return "";
+        uint64_t at = gdbFault.address - gdbFault.base;
+        for (const Watch &w : watches) {
+            if (at + 8 <= w.address || at >= w.address + w.length) continue;
+            if (gdbFault.known && (w.type == 2) != gdbFault.write && w.type != 4) continue;
+            static const char *kinds[] = { "watch", "rwatch", "awatch" };
+            char stop[64];
+            snprintf(stop, sizeof(stop), "T05%s:%" PRIx64 ";", kinds[w.type - 2], std::max(at, w.address));
+            return stop;
+        }
+        return "";
+    }
+
+    // Runs the guest until something stops it; the stop reply
+    std::string resume(GdbTarget &t, bool step) {
+        protect();
+        std::string stop;
+        // Only the first run starts on the instruction gdb stopped at; later
+        // slices must stop at a breakpoint on their first instruction
+        for (bool resuming = true;; resuming = false) {
+            gdbFault.stop = false;
+            gdbFault.address = nullptr;
+            gdbFault.known = false;
+            GdbStop why = t.run(gdbFault.stop, step ? 1 : SLICE, resuming);
+            if (why == GDB_STOP_WATCH) {
+                stop = watch_hit();
+                if (!stop.empty()) break;
+                protect();  // Only the page: close it again and carry on
+                if (step) {
+                    stop = "S05";
+                    break;
+                }
+            }
+            else if (why == GDB_STOP_LIMIT && !step) {
+                if (!interrupted()) continue;
+                stop = "S02";
+                break;
+            }
+            else {
+                stop = why == GDB_STOP_EXIT ? "W00" : "S05";
+                break;
+            }
+        }
+        unprotect();
+        return stop;
+    }
+
+    void remove_breakpoints(GdbTarget &t) {
+        for (uint64_t address : breakpoints) t.breakpoint(address, false);
+        breakpoints.clear();
+    }
+
+public:
+    ~GdbServer() {
+        if (conn >= 0) close(conn);
+        if (listener >= 0) close(listener);
+        if (!unixPath.empty()) unlink(unixPath.c_str());
+    }
+
+    // where is [host:]port (host defaults to the loopback address) or unix:path
+    bool listen(const char *where) {
+        if (!strncmp(where, "unix:", 5)) {
+            sockaddr_un addr;
+            memset(&addr, 0, sizeof(addr));
+            addr.sun_family = AF_UNIX;
+            if (strlen(where + 5) >= sizeof(addr.sun_path)) return false;
+            strcpy(addr.sun_path, where + 5);
+            unlink(addr.sun_path);
+            listener = socket(AF_UNIX, SOCK_STREAM, 0);
+            if (listener < 0 || bind(listener, (sockaddr *)&addr, sizeof(addr)) < 0) return false;
+            unixPath = addr.sun_path;
+        }
+        else {
+            const char *colon = strrchr(where, ':');
+            std::string host = colon ? std::string(where, colon - where) : "";
+            std::string port = colon ? colon + 1 : where;
+            if (host.empty()) host = "127.0.0.1";
+            addrinfo hints, *found;
+            memset(&hints, 0, sizeof(hints));
+            hints.ai_family = AF_UNSPEC;
+            hints.ai_socktype = SOCK_STREAM;
+            if (getaddrinfo(host.c_str(), port.c_str(), &hints, &found)) return false;
+            listener = socket(found->ai_family, SOCK_STREAM, 0);
+            int on = 1;
+            bool ok = listener >= 0 && setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) == 0 &&
+                      bind(listener, found->ai_addr, found->ai_addrlen) == 0;
+            freeaddrinfo(found);
+            if (!ok) return false;
+        }
+        return ::listen(listener, 1) == 0;
+    }
+
+    // Waits for a debugger and does what it asks until it detaches (true:
+    // the caller runs the rest of the guest as usual) or kills the guest
+    // (false). Losing the connection counts as a detach.
+    bool serve(GdbTarget &t) {
+        conn = accept(listener, nullptr, nullptr);
+        if (conn < 0) return true;
+        int on = 1;
+        setsockopt(conn, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on)); // Fails harmlessly on Unix sockets
+
+        gdbFault.base = t.memory();
+        gdbFault.size = t.memory_size();
+        gdbFault.page = sysconf(_SC_PAGESIZE);
+        struct sigaction action, previous;
+        memset(&action, 0, sizeof(action));
+        action.sa_sigaction = gdb_fault;
+        action.sa_flags = SA_SIGINFO | SA_NODEFER;
+        sigaction(SIGSEGV, &action, &previous);
+
+        bool keepRunning = true;
+        std::string last = "S05";   // Stop reply for '?'
+        std::string packet;
+        while (receive(packet)) {
+            const char *p = packet.c_str();
+            std::string out;
+            char *end;
+            if (packet == "?") out = last;
+            else if (packet == "g") {
+                for (int n = 0; n < t.registers(); n++) out += register_hex(t, n);
+            }
+            else if (p[0] == 'G') {
+                for (int n = 0; n < t.registers() && strlen(p + 1) >= (size_t)(n + 1) * 2 * t.register_bytes(); n++) {
+                    t.set_register(n, register_value(t, p + 1 + n * 2 * t.register_bytes()));
+                }
+                out = "OK";
+            }
+            else if (p[0] == 'p') {
+                int n = strtol(p + 1, nullptr, 16);
+                out = n < t.registers() ? register_hex(t, n) : "E01";
+            }
+            else if (p[0] == 'P') {
+                int n = strtol(p + 1, &end, 16);
+                if (n < t.registers() && *end == '=') {
+                    t.set_register(n, register_value(t, end + 1));
+                    out = "OK";
+                }
+                else out = "E01";
+            }
+            else if (p[0] == 'm') {
+                uint64_t address = strtoull(p + 1, &end, 16);
+                uint64_t length = *end == ',' ? strtoull(end + 1, nullptr, 16) : 0;
+                out = in_memory(t, address, length) ? hex(t.memory() + address, length) : "E01";
+            }
+            else if (p[0] == 'M') {
+                uint64_t address = strtoull(p + 1, &end, 16);
+                uint64_t length = *end == ',' ? strtoull(end + 1, &end, 16) : 0;
+                std::vector<uint8_t> bytes;
+                if (*end == ':' && in_memory(t, address, length) && unhex(end + 1, length, bytes)) {
+                    memcpy(t.memory() + address, bytes.data(), length);
+                    t.memory_written(address, length);
+                    out = "OK";
+                }
+                else out = "E01";
+            }
+            else if (p[0] == 'c' || p[0] == 's') {
+                if (p[1]) t.set_register(t.pc_register(), strtoull(p + 1, nullptr, 16));
+                out = last = resume(t, p[0] == 's');
+            }
+            else if ((p[0] == 'Z' || p[0] == 'z') && p[1] >= '0' && p[1] <= '4' && p[2] == ',') {
+                bool insert = p[0] == 'Z';
+                int type = p[1] - '0';
+                uint64_t address = strtoull(p + 3, &end, 16);
+                uint64_t length = *end == ',' ? strtoull(end + 1, nullptr, 16) : 0;
+                out = "E01";
+                if (type < 2) { // Software and hardware breakpoints work the same way
+                    auto found = std::find(breakpoints.begin(), breakpoints.end(), address);
+                    if (t.breakpoint(address, insert)) {
+                        if (insert && found == breakpoints.end()) breakpoints.push_back(address);
+                        if (!insert && found != breakpoints.end()) breakpoints.erase(found);
+                        out = "OK";
+                    }
+                }
+                else if (length && in_memory(t, address, length)) {
+                    auto found = std::find_if(watches.begin(), watches.end(), [&](const Watch &w) {
+                        return w.address == address && w.length == length && w.type == type;
+                    });
+                    if (insert && found == watches.end()) watches.push_back(Watch{address, length, type});
+                    if (!insert && found != watches.end()) watches.erase(found);
+                    out = "OK";
+                }
+            }
+            else if (!strncmp(p, "qSupported", 10)) out = "PacketSize=4000;QStartNoAckMode+";
+            else if (packet == "QStartNoAckMode") {
+                if (!reply("OK")) break;
+                noAck = true;
+                continue;
+            }
+            else if (packet == "qAttached") out = "1";
+            else if (packet == "qfThreadInfo") out = "m1";
+            else if (packet == "qsThreadInfo") out = "l";
+            else if (p[0] == 'H') out = "OK";
+            else if (packet == "k") {
+                keepRunning = false;
+                break;
+            }
+            else if (p[0] == 'D') {
+                reply("OK");
+                break;
+            }
+            if (!reply(out)) break; // Anything else gets the empty "unsupported" reply
+        }
+
+        remove_breakpoints(t);
+        watches.clear();
+        sigaction(SIGSEGV, &previous, nullptr);
+        close(conn);
+        conn = -1;
+        return keepRunning;
+    }
+};
+
+#endif
@@ -0,0 +1,212 @@
+#include <algorithm>
+#include <cerrno>
+#include <cinttypes>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#ifndef HOSTPERF_H
+#define HOSTPERF_H
+
+const int HOSTPERF_CATEGORIES = 256; // Opcode categories (RISC-V) or opcodes (x86)
+
+enum HostEvent {
+    HOST_CYCLES,
+    HOST_INSTRUCTIONS,
+    HOST_BRANCH_MISSES,
+    HOST_L1I_MISSES,
+    HOST_L1D_MISSES,
+    HOST_TASK_CLOCK,    // Software: nanoseconds, there even without a PMU
+    HOST_EVENTS
+};
+
+// Host hardware counters (perf_event_open) around the simulator's own run
+// loop. Reading the counters costs a system call, so they are read around
+// one guest instruction in every `every`; the cost of the read itself is
+// measured once at open() and taken off each sample. The deltas are
+// charged to the sampled instruction's opcode category, which gives the
+// host cost of each guest opcode's handler.
+//
+// Any event the host does not allow (a VM without a PMU, a strict
+// perf_event_paranoid) is left out; the software task clock then still
+// gives time per opcode. If nothing can be opened the profiler stays off
+// and the run goes on without it.
+class HostPerf {
+    struct Event {
+        const char *name;
+        uint32_t type;
+        uint64_t config;
+    };
+    static const Event *events() {
+        static const Event list[HOST_EVENTS] = {
+            { "cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+            { "instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+            { "branch-misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+            { "L1I-misses", PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1I |
+                (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16) },
+            { "L1D-misses", PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D |
+                (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16) },
+            { "task-clock-ns", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK },
+        };
+        return list;
+    }
+
+    int leader = -1;
+    std::vector<int> fds;
+    int slot[HOST_EVENTS];          // Position of each event in a group read, -1 if not open
+    uint64_t every = 0;
+    uint64_t countdown = 0;
+    uint64_t before[1 + HOST_EVENTS];
+    uint64_t overhead[HOST_EVENTS] = {};
+    uint64_t loopStart[1 + HOST_EVENTS];
+    uint64_t loopTotal[HOST_EVENTS] = {};
+    uint64_t loopRetired = 0;       // Guest instructions inside start_loop()/stop_loop()
+
+    uint64_t samples[HOSTPERF_CATEGORIES] = {};
+    uint64_t sums[HOSTPERF_CATEGORIES][HOST_EVENTS] = {};
+
+    bool read_group(uint64_t *values) {
+        size_t bytes = sizeof(uint64_t) * (1 + fds.size());
+        return read(leader, values, bytes) == (ssize_t)bytes;
+    }
+    uint64_t delta(const uint64_t *after, const uint64_t *from, int event) const {
+        return after[1 + slot[event]] - from[1 + slot[event]];
+    }
+
+public:
+    ~HostPerf() {
+        for (int fd : fds) close(fd);
+    }
+
+    // Opens the counters and measures the cost of a read; false (with
+    // the reason in why) if no counter is available
+    bool open(uint64_t sampleEvery, std::string &why) {
+        for (int e = 0; e < HOST_EVENTS; e++) {
+            slot[e] = -1;
+            perf_event_attr attr;
+            memset(&attr, 0, sizeof(attr));
+            attr.size = sizeof(attr);
+            attr.type = events()[e].type;
+            attr.config = events()[e].config;
+            attr.disabled = leader < 0;
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            attr.read_format = PERF_FORMAT_GROUP;
+            int fd = syscall(__NR_perf_event_open, &attr, 0, -1, leader, 0);
+            if (fd < 0) {
+                if (why.empty()) why = std::string(events()[e].name) + ": " + strerror(errno);
+                continue;
+            }
+            if (leader < 0) leader = fd;
+            slot[e] = fds.size();
+            fds.push_back(fd);
+        }
+        if (leader < 0) return false;
+        why.clear();
+        every = countdown = sampleEvery ? sampleEvery : 1;
+        ioctl(leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+        ioctl(leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+
+        // An empty sample: what a begin()/end() pair counts on its own
+        const int CALIBRATION = 1001;
+        std::vector<uint64_t> empty[HOST_EVENTS];
+        uint64_t after[1 + HOST_EVENTS];
+        for (int i = 0; i < CALIBRATION; i++) {
+            if (!read_group(before) || !read_group(after)) break;
+            for (int e = 0; e < HOST_EVENTS; e++) {
+                if (slot[e] >= 0) empty[e].push_back(delta(after, before, e));
+            }
+        }
+        for (int e = 0; e < HOST_EVENTS; e++) {
+            if (empty[e].empty()) continue;
+            std::nth_element(empty[e].begin(), empty[e].begin() + empty[e].size() / 2, empty[e].end());
+            overhead[e] = empty[e][empty[e].size() / 2];
+        }
+        return true;
+    }
+    bool active() const {
+        return leader >= 0;
+    }
+
+    // Around the whole run loop, given the retired count at each end
+    void start_loop(uint64_t retired) {
+        loopRetired -= retired;
+        if (active()) read_group(loopStart);
+    }
+    void stop_loop(uint64_t retired) {
+        uint64_t after[1 + HOST_EVENTS];
+        loopRetired += retired;
+        if (!active() || !read_group(after)) return;
+        for (int e = 0; e < HOST_EVENTS; e++) {
+            if (slot[e] >= 0) loopTotal[e] += delta(after, loopStart, e);
+        }
+    }
+
+    // True when the next instruction is sampled; bracket it with begin()/end()
+    bool sample() {
+        return active() && --countdown == 0;
+    }
+    void begin() {
+        read_group(before);
+    }
+    void end(int category) {
+        uint64_t after[1 + HOST_EVENTS];
+        countdown = every;
+        if (!read_group(after)) return;
+        category &= HOSTPERF_CATEGORIES - 1;
+        samples[category]++;
+        for (int e = 0; e < HOST_EVENTS; e++) {
+            if (slot[e] < 0) continue;
+            uint64_t d = delta(after, before, e);
+            sums[category][e] += d > overhead[e] ? d - overhead[e] : 0;
+        }
+    }
+
+    // Host cost per guest instruction, overall and per opcode category
+    template<typename Name>
+    void report(FILE *out, Name name) const {
+        const Event *list = events();
+        uint64_t retired = loopRetired;
+        fprintf(out, "Run loop, per guest instruction (%" PRIu64 " retired)\n", retired);
+        for (int e = 0; e < HOST_EVENTS; e++) {
+            if (slot[e] < 0) fprintf(out, "  %-14s unavailable\n", list[e].name);
+            else fprintf(out, "  %-14s %10.2f\n", list[e].name, retired ? (double)loopTotal[e] / retired : 0.0);
+        }
+
+        // Categories are ranked by cycles, or by time without a PMU
+        int key = slot[HOST_CYCLES] >= 0 ? HOST_CYCLES : HOST_TASK_CLOCK;
+        std::vector<int> order;
+        uint64_t sampledTotal = 0;
+        for (int c = 0; c < HOSTPERF_CATEGORIES; c++) {
+            if (!samples[c]) continue;
+            order.push_back(c);
+            sampledTotal += sums[c][key];
+        }
+        std::sort(order.begin(), order.end(), [this, key](int a, int b) {
+            return sums[a][key] > sums[b][key];
+        });
+
+        fprintf(out, "\nSampled cost per guest instruction (1 in %" PRIu64 ", read cost of %" PRIu64 " %s removed)\n",
+                every, overhead[key], list[key].name);
+        fprintf(out, "  %-12s %10s", "category", "samples");
+        for (int e = 0; e < HOST_EVENTS; e++) {
+            if (slot[e] >= 0) fprintf(out, " %14s", list[e].name);
+        }
+        fprintf(out, " %7s\n", "share");
+        for (int c : order) {
+            fprintf(out, "  %-12s %10" PRIu64, name(c).c_str(), samples[c]);
+            for (int e = 0; e < HOST_EVENTS; e++) {
+                if (slot[e] >= 0) fprintf(out, " %14.2f", (double)sums[c][e] / samples[c]);
+            }
+            fprintf(out, " %6.1f%%\n", sampledTotal ? 100.0 * sums[c][key] / sampledTotal : 0.0);
+        }
+    }
+};
+
+#endif
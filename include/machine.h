@@ -1,136 +1,238 @@
-#include <fstream>
-#include <iostream>
-#include <iomanip>
-#include <sstream>
-#include <climits>
-
-#ifndef MACHINE_H
-#define MACHINE_H
-
-const int MEM_SIZE = 1 << 18; // 262144
-const int NUM_REGS = 16;
-const int EFLAGS_REG = 14;
-
-const std::string reg_name[] {
-    "AL", "CL", "DL", "BL", "AH", "CH", "DH", "BH", // 8-Bit Registers
-    "AX", "CX", "DX", "BX", "SP", "BP", "SI", "DI", // 16-Bit Registers
-    "NO REG"
-};
-
-class Machine {
-    char* memory;           // Memory
-    int memorySize;         // Size of Memory (Should be MEM_SIZE)
-    int16_t programCounter; // Program Counter
-    int16_t registers[NUM_REGS]; // Registers:
-                                 // 0 - AX
-                                 // 1 - CX
-                                 // 2 - DX
-                                 // 3 - BX 
-                                 // 4 - SP
-                                 // 5 - BP
-                                 // 6 - SI
-                                 // 7 - DI
-                                 // 8 - SS
-                                 // 9 - CS
-                                 // 10 - DS
-                                 // 11 - ES
-                                 // 12 - FS
-                                 // 13 - GS
-                                 // 14 - EFLAGS
-                                 // 15 - IP
-
-    // INSTRUCTION CYCLE 
-
-    struct Fetch {
-        uint16_t opcode;
-
-        friend std::ostream& operator<<(std::ostream &out, const Fetch &fo){
-            std::ostringstream sout;
-            sout << std::hex << "0x" << std::setw(2) << std::setfill('0') << fo.opcode;
-            return out << sout.str();
-        }
-    };
-
-    struct Decode {
-        std::string instruction;
-        int16_t immediate;
-        uint16_t reg;
-        uint16_t regi;
-        int16_t leftOperand;
-        int16_t rightOperand;
-
-        friend std::ostream &operator<<(std::ostream &out, const Decode &dec) {
-            std::ostringstream sout;
-            sout << "Instruction: " << std::hex << dec.instruction << '\n';
-            sout << "Register 1: " << reg_name[dec.reg] << '\n';
-            sout << "Immediate: 0x" << std::hex << std::setw(2) << std::setfill('0') << dec.immediate << '\n';
-            sout << "Left Operand: " << std::dec << dec.leftOperand << '\n';
-            sout << "Right Operand: " << std::dec << dec.rightOperand;
-            return out << sout.str();
-        }
-    };
-
-    struct Execute {
-        int16_t result;
-        friend std::ostream &operator<<(std::ostream &out, const Execute &exe) {
-            std::ostringstream sout;
-            sout << "Result: ";
-            if (exe.result == 0xff) {
-                sout << "NO ALU" << '\n';
-            }
-            else sout << std::dec << exe.result << '\n';
-            return out << sout.str();
-        }
-    };
-
-    // struct Memory {
-    //     int16_t value;
-    // };
-
-    // Objects
-    Fetch fetchObj;
-    Decode decodeObj;
-    Execute executeObj;
-    // Memory memoryObj;
-
-    // Memory
-    template<typename T>
-    T memory_read(int16_t) const;
-    template<typename T>
-    void memory_write(int16_t, T);
-    int8_t next_byte();
-    void byte_to_word(int16_t*);
-    
-    // EFLAGS
-    void set_carry_flag();
-    void set_zero_flag();
-    void set_sign_flag();
-    void unset_carry_flag();
-    void unset_zero_flag();
-    void unset_sign_flag();
-    bool check_carry_flag();
-    bool check_zero_flag();
-    bool check_sign_flag();
-
-    public: 
-        // CPU
-        Machine(char *, int);
-        int16_t get_pc() const;
-        void set_pc(int16_t);
-        int16_t get_xreg(int) const;
-        void set_xreg(int, int16_t);
-        int16_t reg_to_register(uint16_t*);
-        
-        // INSTRUCTION CYCLE
-        void fetch();
-        void decode();
-        void execute();
-        // void memory_access();
-        void write_back();
-        Fetch &debug_fetch_out();
-        Decode &debug_decode_out();
-        Execute &debug_execute_out();
-        // Memory &debug_memory_out();
-};
-
+#include <fstream>
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <climits>
+#include <vector>
+#include "bios.h"
+#include "branch.h"
+#include "cache.h"
+#include "coverage.h"
+#include "digest.h"
+#include "gdbstub.h"
+#include "hostperf.h"
+#include "metrics.h"
+#include "predecode.h"
+#include "profile.h"
+#include "reuse.h"
+#include "snapshot.h"
+#include "textrace.h"
+#include "trace.h"
+#include "window.h"
+
+#ifndef MACHINE_H
+#define MACHINE_H
+
+const int MEM_SIZE = 1 << 18; // 262144
+const int NUM_REGS = 16;
+const int EFLAGS_REG = 14;
+
+const std::string reg_name[] {
+    "AL", "CL", "DL", "BL", "AH", "CH", "DH", "BH", // 8-Bit Registers
+    "AX", "CX", "DX", "BX", "SP", "BP", "SI", "DI", // 16-Bit Registers
+    "NO REG"
+};
+// The register file by index, for the text trace
+const char *const REGISTER_NAMES[NUM_REGS] {
+    "AX", "CX", "DX", "BX", "SP", "BP", "SI", "DI",
+    "SS", "CS", "DS", "ES", "FS", "GS", "EFLAGS", "IP"
+};
+
+// Decoded form of the instruction starting at one byte of the program; the
+// operands that depend on registers or memory are still read at decode time
+struct Predecoded {
+    uint8_t opcode;         // As execute() and write_back() see it
+    uint8_t length;         // Bytes after the first (prefix included)
+    uint8_t rep;
+    uint8_t flags;          // PREDECODE_VALID, PREDECODE_LEADER
+    uint16_t reg;
+    uint16_t regi;
+    int16_t immediate;
+    char instruction[14];   // Mnemonic, "repne cmpsb" at the longest
+};
+const int MAX_INSTRUCTION_LENGTH = 4; // Bytes a predecoded instruction may span
+
+class MicroBench;
+
+class Machine {
+    friend class Bios;
+    friend class MicroBench;
+
+    char* memory;           // Memory
+    int memorySize;         // Size of Memory (Should be MEM_SIZE)
+    int16_t programCounter; // Program Counter
+    int16_t registers[NUM_REGS]; // Registers:
+                                 // 0 - AX
+                                 // 1 - CX
+                                 // 2 - DX
+                                 // 3 - BX 
+                                 // 4 - SP
+                                 // 5 - BP
+                                 // 6 - SI
+                                 // 7 - DI
+                                 // 8 - SS
+                                 // 9 - CS
+                                 // 10 - DS
+                                 // 11 - ES
+                                 // 12 - FS
+                                 // 13 - GS
+                                 // 14 - EFLAGS
+                                 // 15 - IP
+    Bios* bios;             // BIOS services behind the int instruction
+    bool halted;            // Set by hlt
+    DirtyPages dirty;       // Pages written since the last snapshot
+    uint64_t retired;       // Instructions retired so far
+    EdgeCoverage* coverage; // Fed by jmp and je, if set
+    StateDigest* digest;    // Kept current on every write, if set
+    Predecoded* predecoded; // One record per byte of [codeStart, codeEnd), if set
+    int codeStart;
+    int codeEnd;
+    bool breakHit;          // decode() reached a breakpoint (see debug_run)
+
+    // INSTRUCTION CYCLE 
+
+    struct Fetch {
+        uint16_t opcode;
+
+        friend std::ostream& operator<<(std::ostream &out, const Fetch &fo){
+            std::ostringstream sout;
+            sout << std::hex << "0x" << std::setw(2) << std::setfill('0') << fo.opcode;
+            return out << sout.str();
+        }
+    };
+
+    struct Decode {
+        std::string instruction;
+        int16_t immediate;
+        uint16_t reg;
+        uint16_t regi;
+        int16_t leftOperand;
+        int16_t rightOperand;
+        uint8_t rep;        // rep/repe (0xf3) or repne (0xf2) prefix, 0 if none
+        uint8_t length;     // Bytes, prefix included
+
+        friend std::ostream &operator<<(std::ostream &out, const Decode &dec) {
+            std::ostringstream sout;
+            sout << "Instruction: " << std::hex << dec.instruction << '\n';
+            sout << "Register 1: " << reg_name[dec.reg] << '\n';
+            sout << "Immediate: 0x" << std::hex << std::setw(2) << std::setfill('0') << dec.immediate << '\n';
+            sout << "Left Operand: " << std::dec << dec.leftOperand << '\n';
+            sout << "Right Operand: " << std::dec << dec.rightOperand;
+            return out << sout.str();
+        }
+    };
+
+    struct Execute {
+        int16_t result;
+        uint32_t elements;  // String instructions: elements processed
+        friend std::ostream &operator<<(std::ostream &out, const Execute &exe) {
+            std::ostringstream sout;
+            sout << "Result: ";
+            if (exe.result == 0xff) {
+                sout << "NO ALU" << '\n';
+            }
+            else sout << std::dec << exe.result << '\n';
+            return out << sout.str();
+        }
+    };
+
+    // struct Memory {
+    //     int16_t value;
+    // };
+
+    // Objects
+    Fetch fetchObj;
+    Decode decodeObj;
+    Execute executeObj;
+    // Memory memoryObj;
+
+    // Memory
+    template<typename T>
+    T memory_read(int16_t) const;
+    template<typename T>
+    void memory_write(int16_t, T);
+    void code_written(int, size_t);
+    int8_t next_byte();
+    void byte_to_word(int16_t*);
+    
+    // EFLAGS
+    void set_carry_flag();
+    void set_zero_flag();
+    void set_sign_flag();
+    void set_direction_flag();
+    void unset_carry_flag();
+    void unset_zero_flag();
+    void unset_sign_flag();
+    void unset_direction_flag();
+    bool check_carry_flag();
+    bool check_zero_flag();
+    bool check_sign_flag();
+    bool check_direction_flag();
+    void set_compare_flags(uint16_t, uint16_t, int);
+
+    // DECODE
+    bool decode_fields();
+    void decode_operands();
+
+    // STRING
+    void string_move(int);
+    void string_store(int);
+    void string_compare(int);
+
+    template<typename Visit>
+    void data_accesses(int16_t, Visit) const;
+
+    public: 
+        // The architectural state needed to rewind a Machine
+        struct Snapshot {
+            int16_t programCounter;
+            int16_t registers[NUM_REGS];
+            bool halted;
+            uint64_t retired;
+            std::vector<char> memory;
+        };
+
+        // CPU
+        Machine(char *, int);
+        int16_t get_pc() const;
+        void set_pc(int16_t);
+        int16_t get_xreg(int) const;
+        void set_xreg(int, int16_t);
+        int16_t reg_to_register(uint16_t*);
+        void set_bios(Bios*);
+        void set_coverage(EdgeCoverage*);
+        void set_digest(StateDigest*);
+        void predecode(Predecoded*, int, int);
+        void set_predecode(Predecoded*, int, int);
+        void written(uint16_t, size_t);
+        uint64_t state_digest();
+        bool is_halted() const;
+        uint64_t get_retired() const;
+        int get_category() const;
+        void snapshot(Snapshot &);
+        void restore(const Snapshot &);
+        void trace(TraceRecord &, int16_t) const;
+        void profile(Profiler &, int16_t) const;
+        void count(Metrics &, int16_t) const;
+        void cache(CacheHierarchy &, int16_t) const;
+        bool branch(BranchEvent &, int16_t) const;
+        void reuse(ReuseAnalyzer &, int16_t) const;
+        std::string disassemble(int16_t);
+        char *disassemble(char *, int16_t) const;
+        static std::string opcode_name(int);
+        
+        // INSTRUCTION CYCLE
+        void fetch();
+        void decode();
+        void execute();
+        // void memory_access();
+        void write_back();
+        void step();
+        GdbStop debug_run(volatile bool &, uint64_t, int, int, bool);
+        Fetch &debug_fetch_out();
+        Decode &debug_decode_out();
+        Execute &debug_execute_out();
+        // Memory &debug_memory_out();
+};
+
 #endif
\ No newline at end of file
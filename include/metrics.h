@@ -0,0 +1,153 @@
+#include <chrono>
+#include <cinttypes>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+
+#ifndef METRICS_H
+#define METRICS_H
+
+const int METRICS_CATEGORIES = 256; // Opcode categories (RISC-V) or opcodes (x86)
+const int METRICS_WIDTHS = 4;       // Loads and stores of 1, 2, 4 and 8 bytes
+const int METRICS_STALLS = 8;       // Room for a timing model's stall reasons
+
+// Run counters for one hart. They are plain integers owned by the loop that
+// runs the hart, so counting never contends; a simulator running several
+// harts keeps one Metrics each and merge()s them for the summary.
+class Metrics {
+    typedef std::chrono::steady_clock Clock;
+
+    Clock::time_point started;
+    bool running = false;
+    double elapsed = 0;         // Seconds between earlier start() and stop() calls
+    double lastSeconds = 0;     // At the previous snapshot
+    uint64_t lastRetired = 0;
+
+public:
+    uint64_t retired = 0;
+    uint64_t categories[METRICS_CATEGORIES] = {};
+    uint64_t loads[METRICS_WIDTHS] = {};   // Indexed by log2 of the width
+    uint64_t stores[METRICS_WIDTHS] = {};
+    uint64_t branchesTaken = 0;
+    uint64_t branchesNotTaken = 0;
+    uint64_t jumps = 0;                    // Unconditional transfers
+    uint64_t syscalls = 0;                 // ecall, int
+
+    // Filled in by a timing model at the end of the run (--pipeline), if
+    // one ran: its cycle count and stall cycles by reason
+    int stallReasons = 0;
+    const char *const *stallNames = nullptr;
+    uint64_t cycles = 0;
+    uint64_t stalls[METRICS_STALLS] = {};
+
+    // The wall clock runs only between start() and stop(), so that the time
+    // and MIPS cover the instructions counted here and not a fast-forward
+    // or the reports written after the run. Both are no-ops when the clock
+    // is already in that state, so the run loop can call them every
+    // instruction.
+    void start() {
+        if (running) return;
+        started = Clock::now();
+        running = true;
+    }
+    void stop() {
+        if (!running) return;
+        elapsed += std::chrono::duration<double>(Clock::now() - started).count();
+        running = false;
+    }
+
+    static int width_index(int bytes) {
+        return bytes >= 8 ? 3 : bytes >= 4 ? 2 : bytes >= 2 ? 1 : 0;
+    }
+    void load(int bytes, uint64_t count = 1) {
+        loads[width_index(bytes)] += count;
+    }
+    void store(int bytes, uint64_t count = 1) {
+        stores[width_index(bytes)] += count;
+    }
+    void branch(bool taken) {
+        if (taken) branchesTaken++;
+        else branchesNotTaken++;
+    }
+
+    void merge(const Metrics &other) {
+        retired += other.retired;
+        for (int c = 0; c < METRICS_CATEGORIES; c++) categories[c] += other.categories[c];
+        for (int w = 0; w < METRICS_WIDTHS; w++) {
+            loads[w] += other.loads[w];
+            stores[w] += other.stores[w];
+        }
+        branchesTaken += other.branchesTaken;
+        branchesNotTaken += other.branchesNotTaken;
+        jumps += other.jumps;
+        syscalls += other.syscalls;
+        if (other.stallReasons) {
+            stallReasons = other.stallReasons;
+            stallNames = other.stallNames;
+        }
+        cycles += other.cycles;
+        for (int r = 0; r < METRICS_STALLS; r++) stalls[r] += other.stalls[r];
+    }
+
+    double seconds() const {
+        if (!running) return elapsed;
+        return elapsed + std::chrono::duration<double>(Clock::now() - started).count();
+    }
+
+    // One JSON object per call on its own line: totals so far and the
+    // throughput since the previous snapshot
+    void write_snapshot(FILE *out) {
+        double now = seconds();
+        double interval = now - lastSeconds;
+        fprintf(out, "{\"retired\": %" PRIu64 ", \"seconds\": %.6f, \"mips\": %.3f, "
+                     "\"loads\": %" PRIu64 ", \"stores\": %" PRIu64 ", \"branches\": %" PRIu64 "}\n",
+                retired, now, interval > 0 ? (retired - lastRetired) / interval / 1e6 : 0.0,
+                loads[0] + loads[1] + loads[2] + loads[3], stores[0] + stores[1] + stores[2] + stores[3],
+                branchesTaken + branchesNotTaken);
+        fflush(out);
+        lastSeconds = now;
+        lastRetired = retired;
+    }
+
+    // Summary of the whole run; name(category) labels the category counts
+    template<typename Name>
+    void write_json(FILE *out, const char *isa, Name name) const {
+        static const char *WIDTH_NAMES[METRICS_WIDTHS] = { "1", "2", "4", "8" };
+        double wall = seconds();
+        fprintf(out, "{\n  \"isa\": \"%s\",\n", isa);
+        fprintf(out, "  \"retired\": %" PRIu64 ",\n", retired);
+        fprintf(out, "  \"wall_seconds\": %.6f,\n", wall);
+        fprintf(out, "  \"mips\": %.3f,\n", wall > 0 ? retired / wall / 1e6 : 0.0);
+        fprintf(out, "  \"categories\": {");
+        const char *sep = "";
+        for (int c = 0; c < METRICS_CATEGORIES; c++) {
+            if (!categories[c]) continue;
+            fprintf(out, "%s\n    \"%s\": %" PRIu64, sep, name(c).c_str(), categories[c]);
+            sep = ",";
+        }
+        fprintf(out, "\n  },\n");
+        for (int kind = 0; kind < 2; kind++) {
+            const uint64_t *counts = kind ? stores : loads;
+            fprintf(out, "  \"%s\": {", kind ? "stores" : "loads");
+            for (int w = 0; w < METRICS_WIDTHS; w++) {
+                fprintf(out, "%s\"%s\": %" PRIu64, w ? ", " : "", WIDTH_NAMES[w], counts[w]);
+            }
+            fprintf(out, "},\n");
+        }
+        fprintf(out, "  \"branches\": {\"taken\": %" PRIu64 ", \"not_taken\": %" PRIu64 "},\n",
+                branchesTaken, branchesNotTaken);
+        fprintf(out, "  \"jumps\": %" PRIu64 ",\n", jumps);
+        fprintf(out, "  \"syscalls\": %" PRIu64, syscalls);
+        if (stallReasons) {
+            fprintf(out, ",\n  \"pipeline\": {\"cycles\": %" PRIu64 ", \"cpi\": %.3f, \"stalls\": {",
+                    cycles, retired ? cycles / (double)retired : 0.0);
+            for (int r = 0; r < stallReasons; r++) {
+                fprintf(out, "%s\"%s\": %" PRIu64, r ? ", " : "", stallNames[r], stalls[r]);
+            }
+            fprintf(out, "}}");
+        }
+        fprintf(out, "\n}\n");
+    }
+};
+
+#endif
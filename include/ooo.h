@@ -0,0 +1,341 @@
+#include <algorithm>
+#include <cinttypes>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <queue>
+#include <unordered_map>
+#include <vector>
+#include "pipeline.h"
+
+#ifndef OOO_H
+#define OOO_H
+
+struct OooConfig {
+    int width = 4;              // Dispatch, issue and commit per cycle
+    int rob = 128;              // Reorder buffer entries
+    int iq = 48;                // Issue queue entries
+    int lsq = 32;               // Load/store queue entries
+    int frontend = 5;           // Cycles from fetch to dispatch, refilled after a mispredict
+    int aluUnits = 4;
+    int memPorts = 2;
+    int aluLatency = 1;
+    int mulLatency = 3;         // Pipelined
+    int divLatency = 20;        // One divider, not pipelined
+    int loadLatency = 3;        // L1 hit
+
+    // "key=value,key=value" with the member names above; false on an unknown key
+    bool parse(const char *spec) {
+        struct { const char *name; int *value; } keys[] = {
+            { "width", &width }, { "rob", &rob }, { "iq", &iq }, { "lsq", &lsq },
+            { "frontend", &frontend }, { "alu", &aluUnits }, { "mem", &memPorts },
+            { "alu-latency", &aluLatency }, { "mul", &mulLatency }, { "div", &divLatency },
+            { "load", &loadLatency },
+        };
+        while (*spec) {
+            const char *eq = strchr(spec, '=');
+            if (!eq) return false;
+            size_t len = eq - spec;
+            bool found = false;
+            for (auto &key : keys) {
+                if (strlen(key.name) == len && !strncmp(spec, key.name, len)) {
+                    *key.value = std::max(1, atoi(eq + 1));
+                    found = true;
+                }
+            }
+            if (!found) return false;
+            const char *comma = strchr(eq, ',');
+            spec = comma ? comma + 1 : eq + strlen(eq);
+        }
+        return true;
+    }
+};
+
+// What held an instruction's commit back, charged with the cycles between
+// its commit and the previous one
+enum CriticalReason {
+    CRIT_FRONTEND,      // Dispatch bandwidth and pipeline fill
+    CRIT_MISPREDICT,    // Front end refilling after a mispredicted branch
+    CRIT_ROB_FULL,
+    CRIT_IQ_FULL,
+    CRIT_LSQ_FULL,
+    CRIT_DATA,          // Waiting on a source operand
+    CRIT_FU_BUSY,       // Ready, but no free unit or issue slot
+    CRIT_EXECUTE,       // Its own latency
+    CRIT_COMMIT,        // Commit bandwidth
+    CRIT_REASONS
+};
+
+// Out-of-order core model driven by the instructions the functional model
+// retires, in program order. Renaming is assumed perfect, so only true
+// (RAW) dependencies order execution, through the cycle each architectural
+// register's latest value is ready. For each instruction the model finds
+// its dispatch cycle (front end width and refills; free ROB, issue queue
+// and load/store queue entries), issue cycle (operands, units, issue width),
+// completion and in-order commit. Everything is computed once per
+// instruction; there is no cycle loop.
+class OutOfOrderCore {
+    static const int SLOT_BITS = 16;
+    static const int SLOT_MASK = (1 << SLOT_BITS) - 1;
+
+    // Issue bandwidth reserved per future cycle, tagged with the cycle
+    struct Slot {
+        uint64_t cycle;
+        uint8_t issued;
+        uint8_t alu;
+        uint8_t mul;
+        uint8_t mem;
+    };
+
+    OooConfig config;
+    std::vector<Slot> slots;
+    std::vector<uint64_t> dispatched;   // Ring of the last `width` dispatch cycles
+    std::vector<uint64_t> committed;    // Ring of the last `width` commit cycles
+    std::deque<uint64_t> robCommits;    // Commit cycles of instructions in the ROB
+    std::deque<uint64_t> lsqCommits;    // ... of loads and stores in the LSQ
+    std::priority_queue<uint64_t, std::vector<uint64_t>, std::greater<uint64_t>> iqIssues;
+    uint64_t ready[32] = {};
+    uint64_t divFree = 0;
+    uint64_t refill = 0;                // First dispatch cycle after a mispredict
+    uint64_t lastDispatch = 0;          // Dispatch is in order: nothing goes before this
+    int lastDispatchReason = CRIT_FRONTEND;
+    uint64_t lastCommit = 0;
+    std::vector<uint64_t> ras;          // Return address stack for jalr
+    struct StoreInfo {
+        uint64_t done;
+        uint64_t commit;
+    };
+    std::unordered_map<uint64_t, StoreInfo> stores; // Latest store per 8-byte word
+
+    uint64_t instructions = 0;
+    uint64_t mispredicts = 0;
+    uint64_t forwarded = 0;             // Loads fed by an in-flight store
+    uint64_t reasons[CRIT_REASONS] = {};
+
+    // ROB occupancy histogram, finished up to histCycle
+    std::vector<uint64_t> occupancy;
+    std::deque<uint64_t> inflight;      // Commit cycles, oldest first
+    uint64_t histCycle = 0;
+
+    // Critical cycles per static instruction
+    struct PcCost {
+        uint64_t cycles;
+        uint64_t count;
+        uint64_t reasons[CRIT_REASONS];
+    };
+    std::unordered_map<uint64_t, PcCost> pcs;
+
+    Slot &slot(uint64_t cycle) {
+        Slot &s = slots[cycle & SLOT_MASK];
+        if (s.cycle != cycle) s = Slot{cycle, 0, 0, 0, 0};
+        return s;
+    }
+
+    // Histogram every cycle before `until`; nothing dispatched later can
+    // be in the ROB before then
+    void advance(uint64_t until) {
+        while (histCycle < until) {
+            while (!inflight.empty() && inflight.front() <= histCycle) inflight.pop_front();
+            uint64_t next = until;
+            if (!inflight.empty()) next = std::min(next, inflight.front());
+            occupancy[std::min(inflight.size(), occupancy.size() - 1)] += next - histCycle;
+            histCycle = next;
+        }
+    }
+
+    bool predicted(const PipeOp &op) {
+        switch (op.kind) {
+            case PIPE_BRANCH: // Static: backward taken, forward not taken
+                return op.redirect == (op.next < op.pc);
+            case PIPE_JUMP:
+                if (op.rd == 1) ras.push_back(op.pc + 4);
+                return true;
+            case PIPE_JUMP_REG: {
+                bool ok = false;
+                if (op.rd == 0 && op.rs1 == 1 && !ras.empty()) { // Return
+                    ok = ras.back() == op.next;
+                    ras.pop_back();
+                }
+                if (op.rd == 1) ras.push_back(op.pc + 4);
+                return ok;
+            }
+            default:
+                return true;
+        }
+    }
+
+public:
+    explicit OutOfOrderCore(const OooConfig &cfg = OooConfig())
+        : config(cfg), slots(1 << SLOT_BITS, Slot{UINT64_MAX, 0, 0, 0, 0}),
+          dispatched(cfg.width, 0), committed(cfg.width, 0), occupancy(cfg.rob + 1, 0) {}
+
+    void retire(const PipeOp &op) {
+        uint64_t n = instructions++;
+        bool isMem = op.kind == PIPE_LOAD || op.kind == PIPE_STORE;
+
+        // Dispatch
+        int dispatchReason = CRIT_FRONTEND;
+        uint64_t dispatch = std::max<uint64_t>(dispatched[n % config.width] + 1, config.frontend);
+        if (lastDispatch > dispatch) { // Behind whatever held up the one before
+            dispatch = lastDispatch;
+            dispatchReason = lastDispatchReason;
+        }
+        if (refill > dispatch) {
+            dispatch = refill;
+            dispatchReason = CRIT_MISPREDICT;
+        }
+        while (!robCommits.empty() && robCommits.front() <= dispatch) robCommits.pop_front();
+        if ((int)robCommits.size() >= config.rob) {
+            dispatch = robCommits.front();
+            dispatchReason = CRIT_ROB_FULL;
+            while (!robCommits.empty() && robCommits.front() <= dispatch) robCommits.pop_front();
+        }
+        while (!iqIssues.empty() && iqIssues.top() <= dispatch) iqIssues.pop();
+        if ((int)iqIssues.size() >= config.iq) {
+            dispatch = iqIssues.top();
+            dispatchReason = CRIT_IQ_FULL;
+            while (!iqIssues.empty() && iqIssues.top() <= dispatch) iqIssues.pop();
+        }
+        if (isMem) {
+            while (!lsqCommits.empty() && lsqCommits.front() <= dispatch) lsqCommits.pop_front();
+            if ((int)lsqCommits.size() >= config.lsq) {
+                dispatch = lsqCommits.front();
+                dispatchReason = CRIT_LSQ_FULL;
+                while (!lsqCommits.empty() && lsqCommits.front() <= dispatch) lsqCommits.pop_front();
+            }
+        }
+        dispatched[n % config.width] = dispatch;
+        lastDispatch = dispatch;
+        lastDispatchReason = dispatchReason;
+        advance(dispatch);
+
+        // Issue: operands, then a cycle with a free slot and unit
+        uint64_t operands = dispatch + 1;
+        uint8_t sources[2] = { op.rs1, op.rs2 };
+        for (uint8_t r : sources) {
+            if (r) operands = std::max(operands, ready[r]);
+        }
+        bool dataWait = operands > dispatch + 1;
+        uint64_t issue = operands;
+        if (op.kind == PIPE_DIV) issue = std::max(issue, divFree);
+        for (;; issue++) {
+            Slot &s = slot(issue);
+            if (s.issued >= config.width) continue;
+            if (isMem ? s.mem >= config.memPorts
+                      : op.kind == PIPE_MUL ? s.mul >= 1
+                      : op.kind != PIPE_DIV && s.alu >= config.aluUnits) continue;
+            s.issued++;
+            if (isMem) s.mem++;
+            else if (op.kind == PIPE_MUL) s.mul++;
+            else if (op.kind != PIPE_DIV) s.alu++;
+            break;
+        }
+        bool fuWait = issue > operands;
+        iqIssues.push(issue);
+
+        int latency = op.kind == PIPE_MUL ? config.mulLatency
+                    : op.kind == PIPE_DIV ? config.divLatency
+                    : op.kind == PIPE_LOAD ? config.loadLatency
+                    : config.aluLatency;
+        if (op.kind == PIPE_DIV) divFree = issue + latency;
+        uint64_t done = issue + latency;
+        if (op.kind == PIPE_LOAD) {
+            auto found = stores.find(op.address >> 3);
+            if (found != stores.end() && found->second.commit > issue) { // Store still in the LSQ
+                forwarded++;
+                if (found->second.done + 1 > done) {
+                    done = found->second.done + 1;
+                    dataWait = true;
+                }
+            }
+        }
+        if (op.rd) ready[op.rd] = done;
+
+        if (!predicted(op)) {
+            mispredicts++;
+            refill = done + config.frontend;
+        }
+
+        // Commit, in order and `width` per cycle
+        uint64_t commit = std::max({done + 1, lastCommit, committed[n % config.width] + 1});
+        int reason;
+        if (commit > done + 1) reason = CRIT_COMMIT;
+        else if (fuWait) reason = CRIT_FU_BUSY;
+        else if (dataWait) reason = CRIT_DATA;
+        else if (latency > 1 && issue == dispatch + 1) reason = CRIT_EXECUTE;
+        else reason = dispatchReason;
+        uint64_t cost = n ? commit - lastCommit : commit;
+        reasons[reason] += cost;
+        PcCost &pc = pcs[op.pc];
+        pc.cycles += cost;
+        pc.count++;
+        pc.reasons[reason] += cost;
+
+        committed[n % config.width] = commit;
+        lastCommit = commit;
+        robCommits.push_back(commit);
+        inflight.push_back(commit);
+        if (isMem) lsqCommits.push_back(commit);
+        if (op.kind == PIPE_STORE) stores[op.address >> 3] = StoreInfo{done, commit};
+        if (stores.size() > (size_t)config.lsq * 64) stores.clear(); // Long since committed
+    }
+
+    uint64_t cycles() const {
+        return lastCommit + 1;
+    }
+
+    void report(FILE *out, size_t top) {
+        static const char *REASONS[CRIT_REASONS] = {
+            "frontend", "mispredict", "rob-full", "iq-full", "lsq-full",
+            "data", "fu-busy", "execute", "commit"
+        };
+        advance(lastCommit + 1);
+        uint64_t total = cycles();
+        double t = (double)total;
+
+        fprintf(out, "Out-of-order core (width %d, ROB %d, IQ %d, LSQ %d)\n",
+                config.width, config.rob, config.iq, config.lsq);
+        fprintf(out, "  instructions  %12" PRIu64 "\n", instructions);
+        fprintf(out, "  cycles        %12" PRIu64 "\n", total);
+        fprintf(out, "  IPC           %12.3f\n", instructions / t);
+        fprintf(out, "  mispredicts   %12" PRIu64 "\n", mispredicts);
+        fprintf(out, "  store-to-load %12" PRIu64 "\n", forwarded);
+
+        fprintf(out, "\nCritical path (cycles between commits, by what held them)\n");
+        for (int r = 0; r < CRIT_REASONS; r++) {
+            fprintf(out, "  %-13s %12" PRIu64 "  %5.1f%%\n", REASONS[r], reasons[r], 100.0 * reasons[r] / t);
+        }
+
+        const int BUCKETS = 8;
+        fprintf(out, "\nROB occupancy (share of cycles)\n");
+        for (int b = 0; b < BUCKETS; b++) {
+            size_t lo = (size_t)config.rob * b / BUCKETS + (b ? 1 : 0);
+            size_t hi = (size_t)config.rob * (b + 1) / BUCKETS;
+            uint64_t sum = 0;
+            for (size_t o = lo; o <= hi; o++) sum += occupancy[o];
+            fprintf(out, "  %4zu-%-4zu %6.1f%%  ", lo, hi, 100.0 * sum / t);
+            for (int bar = 0; bar < (int)(50.0 * sum / t + 0.5); bar++) fputc('#', out);
+            fputc('\n', out);
+        }
+
+        std::vector<std::pair<uint64_t, PcCost>> hot;
+        for (const auto &pc : pcs) {
+            if (pc.second.cycles) hot.push_back(pc);
+        }
+        std::sort(hot.begin(), hot.end(), [](const std::pair<uint64_t, PcCost> &a,
+                                             const std::pair<uint64_t, PcCost> &b) {
+            return a.second.cycles > b.second.cycles;
+        });
+        fprintf(out, "\nInstructions charged with critical cycles (%zu of %zu)\n", std::min(top, hot.size()), hot.size());
+        for (size_t i = 0; i < hot.size() && i < top; i++) {
+            const PcCost &pc = hot[i].second;
+            int worst = std::max_element(pc.reasons, pc.reasons + CRIT_REASONS) - pc.reasons;
+            fprintf(out, "  0x%08" PRIx64 "  %12" PRIu64 " cycles  %5.1f%%  %10" PRIu64 " times  mostly %s\n",
+                    hot[i].first, pc.cycles, 100.0 * pc.cycles / t, pc.count, REASONS[worst]);
+        }
+    }
+};
+
+#endif
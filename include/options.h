@@ -0,0 +1,175 @@
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+#ifndef OPTIONS_H
+#define OPTIONS_H
+
+// Command-line options shared by the simulators:
+// decode [options] <binary>
+struct Options {
+    const char* binary = nullptr;   // Program loaded at address 0
+    const char* disk = nullptr;     // --disk <image>: boot the image through the BIOS
+    const char* keyboard = nullptr; // --keyboard <file>: keystrokes for int 0x16
+    long runs = 1;                  // --runs <n>: rerun from a snapshot of the loaded program
+    const char* record = nullptr;   // --record <log>: log every external input
+    const char* replay = nullptr;   // --replay <log>: feed a recorded log back in
+    const char* coverage = nullptr; // --coverage <file>: write the edge coverage bitmap
+    bool coverageBlocks = false;    // --coverage-blocks: count blocks instead of edges
+    const char* digest = nullptr;   // --digest <file>: write state digests
+    long digestEvery = 0;           // --digest-every <n>: a digest every n instructions, not just at exit
+    const char* predecode = nullptr; // --predecode <dir>: cache decoded programs in dir
+    const char* trace = nullptr;    // --trace <file>: stream a binary execution trace
+    const char* textTrace = nullptr; // --text-trace <file>: write a disassembled trace, one line per instruction
+    const char* profile = nullptr;  // --profile <file>: write a hot-block report
+    const char* folded = nullptr;   // --folded <file>: write folded stacks for flame graphs
+    const char* metrics = nullptr;  // --metrics <file>: write a JSON summary of the run
+    const char* metricsLog = nullptr; // --metrics-log <file>: append JSON snapshots while running
+    long metricsEvery = 1000000;    // --metrics-every <n>: instructions between snapshots
+    const char* hostperf = nullptr; // --hostperf <file>: host counter cost per guest opcode
+    long hostperfEvery = 101;       // --hostperf-every <n>: sample one instruction in n
+    const char* pipeline = nullptr; // --pipeline <file>: in-order 5-stage timing report
+    bool noForwarding = false;      // --no-forwarding: pipeline without bypass paths
+    const char* ooo = nullptr;      // --ooo <file>: out-of-order core timing report
+    const char* oooConfig = nullptr; // --ooo-config <k=v,...>: width, rob, iq, lsq, latencies
+    const char* cache = nullptr;    // --cache <file>: L1I/L1D/L2 cache report
+    const char* cacheConfig = nullptr; // --cache-config <k=v,...>: sizes, ways, policies, prefetch
+    const char* branch = nullptr;   // --branch <file>: branch predictor report
+    const char* branchPredictors = nullptr; // --branch-predictors <list>: e.g. bimodal:12,gshare:14,tage,btb:10
+    const char* branchTrace = nullptr; // --branch-trace <file>: write a compact branch trace
+    const char* reuse = nullptr;    // --reuse <file>: reuse distance and working set report
+    const char* reuseCurve = nullptr; // --reuse-curve <file>: miss ratio of every LRU cache size, as CSV
+    long reuseWindow = 100000;      // --reuse-window <n>: instructions per working-set window
+    const char* bbv = nullptr;      // --bbv <file>: basic-block vectors in SimPoint's .bb format
+    const char* simpoint = nullptr; // --simpoint <prefix>: simulation points, weights and checkpoints
+    long simpointInterval = 10000000; // --simpoint-interval <n>: instructions per interval
+    long simpointK = 10;            // --simpoint-k <n>: most clusters to try
+    const char* restore = nullptr;  // --restore <file>: start from a checkpoint
+    long skip = 0;                  // --skip <n>: fast-forward n instructions before the detail window
+    long detail = 0;                // --detail <n>: instructions in the detail window (0: to the end)
+    long startPc = -1;              // --start-pc <addr>: open the detail window at this PC
+    bool marker = false;            // --marker: marker instructions open and close the detail window
+    bool exitAfter = false;         // --exit-after: stop when the detail window closes
+    bool debug = false;             // --debug: print every pipeline stage inside the detail window
+    const char* gdb = nullptr;      // --gdb <[host:]port | unix:path>: wait for a debugger before running
+};
+
+// A count or address option's value: a whole number of at least min, or
+// false (after printing why)
+inline bool parse_count(const char *arg, const char *value, long min, long &out) {
+    char *end;
+    errno = 0;
+    long n = strtol(value, &end, 0);
+    if (end == value || *end || errno || n < min) {
+        std::cerr << arg << " needs a whole number of at least " << min << ", not " << value << '\n';
+        return false;
+    }
+    out = n;
+    return true;
+}
+
+// Returns false (after printing why) if the command line is malformed
+inline bool parse_options(int argc, char **argv, Options &opts) {
+    for (int i = 1; i < argc; i++) {
+        const char *arg = argv[i];
+        if (arg[0] != '-') {
+            opts.binary = arg;
+            continue;
+        }
+
+        // Flags
+        if (!strcmp(arg, "--coverage-blocks")) {
+            opts.coverageBlocks = true;
+            continue;
+        }
+        if (!strcmp(arg, "--no-forwarding")) {
+            opts.noForwarding = true;
+            continue;
+        }
+        if (!strcmp(arg, "--marker")) {
+            opts.marker = true;
+            continue;
+        }
+        if (!strcmp(arg, "--exit-after")) {
+            opts.exitAfter = true;
+            continue;
+        }
+        if (!strcmp(arg, "--debug")) {
+            opts.debug = true;
+            continue;
+        }
+
+        // Options with a value
+        if (i + 1 >= argc) {
+            std::cerr << "missing value for " << arg << '\n';
+            return false;
+        }
+        const char *value = argv[++i];
+        if (!strcmp(arg, "--disk")) opts.disk = value;
+        else if (!strcmp(arg, "--keyboard")) opts.keyboard = value;
+        else if (!strcmp(arg, "--runs")) {
+            if (!parse_count(arg, value, 1, opts.runs)) return false;
+        }
+        else if (!strcmp(arg, "--record")) opts.record = value;
+        else if (!strcmp(arg, "--replay")) opts.replay = value;
+        else if (!strcmp(arg, "--coverage")) opts.coverage = value;
+        else if (!strcmp(arg, "--digest")) opts.digest = value;
+        else if (!strcmp(arg, "--digest-every")) {
+            if (!parse_count(arg, value, 0, opts.digestEvery)) return false;
+        }
+        else if (!strcmp(arg, "--predecode")) opts.predecode = value;
+        else if (!strcmp(arg, "--trace")) opts.trace = value;
+        else if (!strcmp(arg, "--text-trace")) opts.textTrace = value;
+        else if (!strcmp(arg, "--profile")) opts.profile = value;
+        else if (!strcmp(arg, "--folded")) opts.folded = value;
+        else if (!strcmp(arg, "--metrics")) opts.metrics = value;
+        else if (!strcmp(arg, "--metrics-log")) opts.metricsLog = value;
+        else if (!strcmp(arg, "--metrics-every")) {
+            if (!parse_count(arg, value, 1, opts.metricsEvery)) return false;
+        }
+        else if (!strcmp(arg, "--hostperf")) opts.hostperf = value;
+        else if (!strcmp(arg, "--hostperf-every")) {
+            if (!parse_count(arg, value, 1, opts.hostperfEvery)) return false;
+        }
+        else if (!strcmp(arg, "--pipeline")) opts.pipeline = value;
+        else if (!strcmp(arg, "--ooo")) opts.ooo = value;
+        else if (!strcmp(arg, "--ooo-config")) opts.oooConfig = value;
+        else if (!strcmp(arg, "--cache")) opts.cache = value;
+        else if (!strcmp(arg, "--cache-config")) opts.cacheConfig = value;
+        else if (!strcmp(arg, "--branch")) opts.branch = value;
+        else if (!strcmp(arg, "--branch-predictors")) opts.branchPredictors = value;
+        else if (!strcmp(arg, "--branch-trace")) opts.branchTrace = value;
+        else if (!strcmp(arg, "--reuse")) opts.reuse = value;
+        else if (!strcmp(arg, "--reuse-curve")) opts.reuseCurve = value;
+        else if (!strcmp(arg, "--reuse-window")) {
+            if (!parse_count(arg, value, 1, opts.reuseWindow)) return false;
+        }
+        else if (!strcmp(arg, "--bbv")) opts.bbv = value;
+        else if (!strcmp(arg, "--simpoint")) opts.simpoint = value;
+        else if (!strcmp(arg, "--simpoint-interval")) {
+            if (!parse_count(arg, value, 1, opts.simpointInterval)) return false;
+        }
+        else if (!strcmp(arg, "--simpoint-k")) {
+            if (!parse_count(arg, value, 1, opts.simpointK)) return false;
+        }
+        else if (!strcmp(arg, "--restore")) opts.restore = value;
+        else if (!strcmp(arg, "--skip")) {
+            if (!parse_count(arg, value, 0, opts.skip)) return false;
+        }
+        else if (!strcmp(arg, "--detail")) {
+            if (!parse_count(arg, value, 0, opts.detail)) return false;
+        }
+        else if (!strcmp(arg, "--start-pc")) {
+            if (!parse_count(arg, value, 0, opts.startPc)) return false;
+        }
+        else if (!strcmp(arg, "--gdb")) opts.gdb = value;
+        else {
+            std::cerr << "unknown option " << arg << '\n';
+            return false;
+        }
+    }
+    return true;
+}
+
+#endif
@@ -0,0 +1,204 @@
+#include <algorithm>
+#include <cinttypes>
+#include <cstdint>
+#include <cstdio>
+#include "metrics.h"
+
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+// How the timing models see an instruction
+enum PipeClass : uint8_t {
+    PIPE_ALU,
+    PIPE_MUL,
+    PIPE_DIV,
+    PIPE_LOAD,
+    PIPE_STORE,
+    PIPE_BRANCH,    // Conditional, resolved in EX
+    PIPE_JUMP,      // Direct jump, resolved in ID
+    PIPE_JUMP_REG,  // Register-indirect jump, resolved in EX
+    PIPE_SYSTEM,
+    PIPE_CLASSES
+};
+
+// One retired instruction, as far as timing is concerned. Register 0 is
+// "none": it is never a dependency.
+struct PipeOp {
+    uint8_t kind;       // PipeClass
+    uint8_t rd;
+    uint8_t rs1;
+    uint8_t rs2;        // For stores, the data register (needed in MEM, not EX)
+    bool redirect;      // Control went somewhere other than the next instruction
+    uint64_t pc;
+    uint64_t next;      // PC of the instruction retired after this one
+    uint64_t address;   // Loads and stores
+};
+
+struct PipelineConfig {
+    bool forwarding = true;     // EX/MEM and MEM/WB bypasses into EX
+    int branchPenalty = 2;      // Cycles lost on a taken branch (predict not taken)
+    int jumpPenalty = 1;        // Direct jump, redirected from ID
+    int jumpRegPenalty = 2;     // Indirect jump, redirected from EX
+    int mulLatency = 3;         // Cycles in EX; EX is not pipelined
+    int divLatency = 20;
+};
+
+enum StallReason {
+    STALL_LOAD_USE,     // Consumer right behind a load, even with forwarding
+    STALL_RAW,          // Waiting on a register without a bypass, or on a long EX
+    STALL_EX_BUSY,      // EX still held by a multiply or divide
+    STALL_BRANCH,       // Wrong-path fetches squashed after a taken branch
+    STALL_JUMP,         // ... after a jump
+    STALL_REASONS
+};
+const char *const STALL_NAMES[STALL_REASONS] = {
+    "load-use", "raw", "ex-busy", "branch-flush", "jump-flush"
+};
+static_assert(STALL_REASONS <= METRICS_STALLS, "Metrics has no room for every stall reason");
+
+// Classic five-stage in-order pipeline (IF ID EX MEM WB), driven by the
+// instructions the functional model retires. Each instruction's cycle in
+// ID follows from the previous one plus whatever holds it back: a source
+// register not ready yet, EX still busy, or a redirect squashing the
+// fetches behind a taken branch. The other stages sit at fixed offsets
+// from ID, so nothing is simulated cycle by cycle.
+class InOrderPipeline {
+    PipelineConfig config;
+
+    uint64_t lastId = 0;        // ID cycle of the previous instruction
+    uint64_t lastWb = 0;        // WB cycle of the previous instruction
+    uint64_t exFree = 0;        // First cycle EX can take a new instruction
+    int pendingFlush = 0;       // Squash cycles owed by the previous instruction
+    uint8_t pendingReason = STALL_BRANCH;
+    uint64_t ready[32] = {};    // First cycle a consumer's EX can use each register
+    bool fromLoad[32] = {};     // That register's producer was a load
+
+    uint64_t instructions = 0;
+    uint64_t exExtra = 0;       // EX cycles beyond the first (multiply, divide)
+    uint64_t stalls[STALL_REASONS] = {};
+    uint64_t classes[PIPE_CLASSES] = {};
+    uint64_t redirects[PIPE_CLASSES] = {};
+
+public:
+    explicit InOrderPipeline(const PipelineConfig &cfg = PipelineConfig()) : config(cfg) {}
+
+    void retire(const PipeOp &op) {
+        instructions++;
+        classes[op.kind]++;
+
+        uint64_t earliest = lastId + 1;
+        if (pendingFlush) {
+            earliest += pendingFlush;
+            stalls[pendingReason] += pendingFlush;
+            pendingFlush = 0;
+        }
+
+        // Data: sources are needed in EX (ID + 1), store data in MEM (ID + 2)
+        // when it can be bypassed there, otherwise read in ID like the rest
+        uint64_t data = 0;
+        bool loadUse = false;
+        uint8_t sources[2] = { op.rs1, op.rs2 };
+        for (int s = 0; s < 2; s++) {
+            uint8_t r = sources[s];
+            if (r == 0) continue;
+            int offset = (s == 1 && op.kind == PIPE_STORE && config.forwarding) ? 2 : 1;
+            uint64_t need = ready[r] > (uint64_t)offset ? ready[r] - offset : 0;
+            if (need > data) {
+                data = need;
+                loadUse = fromLoad[r];
+            }
+        }
+        uint64_t structural = exFree > 1 ? exFree - 1 : 0;
+
+        uint64_t id = std::max({earliest, data, structural});
+        if (id > earliest) {
+            if (structural >= data) stalls[STALL_EX_BUSY] += id - earliest;
+            else if (loadUse && config.forwarding) stalls[STALL_LOAD_USE] += id - earliest;
+            else stalls[STALL_RAW] += id - earliest;
+        }
+
+        uint64_t ex = id + 1;
+        int latency = op.kind == PIPE_MUL ? config.mulLatency : op.kind == PIPE_DIV ? config.divLatency : 1;
+        exExtra += latency - 1;
+        exFree = ex + latency;
+        uint64_t exDone = ex + latency - 1;     // Last EX cycle
+        uint64_t memDone = exDone + 1;
+
+        if (op.rd) {
+            if (!config.forwarding) ready[op.rd] = memDone + 2;   // Written in WB, read in ID the same cycle
+            else if (op.kind == PIPE_LOAD) ready[op.rd] = memDone + 1;
+            else ready[op.rd] = exDone + 1;
+            fromLoad[op.rd] = op.kind == PIPE_LOAD;
+        }
+
+        if (op.redirect) {
+            redirects[op.kind]++;
+            if (op.kind == PIPE_JUMP) {
+                pendingFlush = config.jumpPenalty;
+                pendingReason = STALL_JUMP;
+            }
+            else {
+                pendingFlush = op.kind == PIPE_JUMP_REG ? config.jumpRegPenalty : config.branchPenalty;
+                pendingReason = op.kind == PIPE_BRANCH ? STALL_BRANCH : STALL_JUMP;
+            }
+        }
+        lastId = id;
+        lastWb = memDone + 1;
+    }
+
+    uint64_t cycles() const {
+        return instructions ? lastWb + 1 : 0; // Cycle 0 is the first IF
+    }
+
+    // Hands the cycle count and the stall breakdown to the run metrics
+    void count(Metrics &m) const {
+        m.stallReasons = STALL_REASONS;
+        m.stallNames = STALL_NAMES;
+        m.cycles = cycles();
+        for (int r = 0; r < STALL_REASONS; r++) m.stalls[r] = stalls[r];
+    }
+
+    void report(FILE *out) const {
+        static const char *CLASSES[PIPE_CLASSES] = {
+            "alu", "mul", "div", "load", "store", "branch", "jump", "jump-reg", "system"
+        };
+        uint64_t total = cycles();
+        uint64_t stalled = 0;
+        for (int r = 0; r < STALL_REASONS; r++) stalled += stalls[r];
+        uint64_t held = stalls[STALL_LOAD_USE] + stalls[STALL_RAW] + stalls[STALL_EX_BUSY];
+        uint64_t squashed = stalls[STALL_BRANCH] + stalls[STALL_JUMP];
+        double t = total ? (double)total : 1.0;
+
+        fprintf(out, "In-order 5-stage pipeline (%s forwarding)\n", config.forwarding ? "with" : "no");
+        fprintf(out, "  instructions  %12" PRIu64 "\n", instructions);
+        fprintf(out, "  cycles        %12" PRIu64 "\n", total);
+        fprintf(out, "  CPI           %12.3f\n", instructions ? total / (double)instructions : 0.0);
+
+        fprintf(out, "\nStall cycles (%" PRIu64 ", %.1f%% of cycles)\n", stalled, 100.0 * stalled / t);
+        for (int r = 0; r < STALL_REASONS; r++) {
+            fprintf(out, "  %-13s %12" PRIu64 "  %5.1f%%\n", STALL_NAMES[r], stalls[r], 100.0 * stalls[r] / t);
+        }
+
+        // IF and ID hold a stalled instruction and the squashed wrong-path
+        // fetches; EX holds multiply and divide for their whole latency;
+        // every other cycle of a stage is a bubble
+        fprintf(out, "\nStage occupancy        busy   stalled  squashed    bubble\n");
+        const char *stages[5] = { "IF", "ID", "EX", "MEM", "WB" };
+        for (int s = 0; s < 5; s++) {
+            uint64_t busy = instructions + (s == 2 ? exExtra : 0);
+            uint64_t hold = s < 2 ? held : 0;
+            uint64_t squash = s < 2 ? squashed : 0;
+            uint64_t bubble = total - std::min(total, busy + hold + squash);
+            fprintf(out, "  %-5s             %6.1f%%   %6.1f%%   %6.1f%%   %6.1f%%\n", stages[s],
+                    100.0 * busy / t, 100.0 * hold / t, 100.0 * squash / t, 100.0 * bubble / t);
+        }
+
+        fprintf(out, "\nInstruction classes          count   redirected\n");
+        for (int c = 0; c < PIPE_CLASSES; c++) {
+            if (!classes[c]) continue;
+            fprintf(out, "  %-18s %12" PRIu64 " %12" PRIu64 "\n", CLASSES[c], classes[c], redirects[c]);
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,121 @@
+#include <algorithm>
+#include <cinttypes>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "digest.h"
+
+#ifndef PREDECODE_H
+#define PREDECODE_H
+
+const uint32_t PREDECODE_VERSION = 1; // Bump whenever a Predecoded record changes meaning
+
+// Block boundary, validity and breakpoint bits of a predecoded record
+const uint8_t PREDECODE_VALID = 1 << 0;  // The decode fast path may use this record
+const uint8_t PREDECODE_LEADER = 1 << 1; // A basic block starts here
+const uint8_t PREDECODE_BREAK = 1 << 2;  // A debugger breakpoint: the slow path stops here (gdbstub.h)
+const uint8_t PREDECODE_PARKED = 1 << 3; // VALID, held back while the breakpoint is set
+
+// Decoded form of a guest binary, one Record per instruction slot, stored in
+// a cache directory under the hash of the binary's contents. A later run of
+// the same binary maps the file copy-on-write and starts with a warm decoder:
+// the machine clears PREDECODE_VALID on records the guest overwrites, and
+// the file never sees it.
+//
+// File layout: a Header, then `count` Records.
+template<typename Record>
+class PredecodeCache {
+    struct Header {
+        char magic[4];
+        uint32_t version;
+        char isa[8];
+        uint64_t contentHash;
+        uint64_t recordSize;
+        uint64_t count;
+    };
+
+    std::string path;
+    Header header;
+    Record *records = nullptr;
+    void *map = nullptr;
+    size_t mapSize = 0;
+    std::vector<Record> built;
+
+public:
+    ~PredecodeCache() {
+        if (map) munmap(map, mapSize);
+    }
+
+    // Maps the cache file for this binary, returning false if there is none
+    // (or it was written by a different version) and it has to be built
+    bool open(const char *dir, const char *isa, const char *binary, size_t size, size_t count) {
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, "PDEC", 4);
+        header.version = PREDECODE_VERSION;
+        memcpy(header.isa, isa, std::min(strlen(isa), sizeof(header.isa)));
+        header.contentHash = digest_bytes(binary, size, 0);
+        header.recordSize = sizeof(Record);
+        header.count = count;
+
+        char name[64];
+        snprintf(name, sizeof(name), "/%s-%016" PRIx64 ".pdc", isa, header.contentHash);
+        path = std::string(dir) + name;
+
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) return false;
+        struct stat st;
+        size_t expected = sizeof(Header) + count * sizeof(Record);
+        if (fstat(fd, &st) < 0 || (size_t)st.st_size != expected) {
+            close(fd);
+            return false;
+        }
+        map = mmap(nullptr, expected, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (map == MAP_FAILED) {
+            map = nullptr;
+            return false;
+        }
+        mapSize = expected;
+        if (memcmp(map, &header, sizeof(Header))) { // Stale or foreign cache file
+            munmap(map, mapSize);
+            map = nullptr;
+            return false;
+        }
+        records = reinterpret_cast<Record*>(static_cast<char*>(map) + sizeof(Header));
+        return true;
+    }
+
+    // Storage for the caller to decode into after open() fails
+    Record *build() {
+        built.assign(header.count, Record());
+        records = built.data();
+        return built.data();
+    }
+    // Writes the built records; a rename makes the file appear all at once,
+    // so concurrent jobs never map a half-written cache
+    bool save() {
+        std::string tmp = path + ".tmp" + std::to_string(getpid());
+        FILE *f = fopen(tmp.c_str(), "wb");
+        if (!f) return false;
+        bool ok = fwrite(&header, sizeof(Header), 1, f) == 1 &&
+                  fwrite(built.data(), sizeof(Record), built.size(), f) == built.size();
+        ok = (fclose(f) == 0) && ok;
+        if (!ok || rename(tmp.c_str(), path.c_str())) {
+            unlink(tmp.c_str());
+            return false;
+        }
+        return true;
+    }
+
+    Record *data() const {
+        return records;
+    }
+};
+
+#endif
@@ -0,0 +1,209 @@
+#include <algorithm>
+#include <cinttypes>
+#include <cstdint>
+#include <cstdio>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#ifndef PROFILE_H
+#define PROFILE_H
+
+const int PROFILE_CATEGORIES = 256; // Opcode categories (RISC-V) or opcodes (x86)
+const int PROFILE_MAX_DEPTH = 256;  // Deeper calls are charged to the deepest frame
+
+// Guest hot-spot profiler. Every retired instruction bumps a counter in a
+// flat array indexed by PC, so the cost per instruction is an increment or
+// two and never a lookup. Blocks are counted where they are entered: an
+// instruction right after a control transfer, or one that has started a
+// block before. Edges (a hash map) are only counted on taken transfers.
+//
+// Calls and returns move a cursor around a calling-context tree, and each
+// instruction is charged to the current node, which gives folded stacks
+// for flame graphs without walking a stack per instruction.
+class Profiler {
+    struct Context {
+        uint32_t parent;
+        uint32_t depth;
+        uint64_t function;  // Entry PC
+    };
+
+    uint64_t base = 0;
+    uint64_t size = 0;
+    int shift = 0;                  // log2 of the smallest instruction size
+    std::vector<uint64_t> counts;   // Retired per PC
+    std::vector<uint64_t> blocks;   // Block entries per PC
+    std::vector<uint8_t> info;      // Length, and END_BLOCK, per PC
+    uint64_t mix[PROFILE_CATEGORIES] = {};
+    uint64_t outside = 0;           // Retired outside [base, base + size)
+    bool leader = true;             // The next instruction starts a block
+    std::unordered_map<uint64_t, uint64_t> edges; // (from << 32 | to) -> count
+
+    std::vector<Context> contexts;
+    std::vector<uint64_t> contextCounts;
+    std::map<std::pair<uint32_t, uint64_t>, uint32_t> children;
+    uint32_t context = 0;
+    uint32_t overflow = 0;          // Calls past PROFILE_MAX_DEPTH not yet returned
+
+    static const uint8_t END_BLOCK = 0x80;
+
+    struct Block {
+        uint64_t pc;
+        uint64_t entries;
+        uint64_t instructions;      // Retired in the block: entries times its length
+        int length;
+    };
+
+    // Instructions (by PC) of the block starting at pc
+    std::vector<uint64_t> block_pcs(uint64_t pc) const {
+        std::vector<uint64_t> pcs;
+        for (;;) {
+            size_t i = (pc - base) >> shift;
+            pcs.push_back(pc);
+            int length = info[i] & ~END_BLOCK;
+            pc += length;
+            size_t next = (pc - base) >> shift;
+            if ((info[i] & END_BLOCK) || length == 0 || pc >= base + size || !counts[next] || blocks[next]) break;
+        }
+        return pcs;
+    }
+
+public:
+    void init(uint64_t codeBase, uint64_t codeSize, int sizeShift, uint64_t entry) {
+        base = codeBase;
+        size = codeSize;
+        shift = sizeShift;
+        counts.assign(size >> shift, 0);
+        blocks.assign(size >> shift, 0);
+        info.assign(size >> shift, 0);
+        contexts.assign(1, Context{0, 0, entry});
+        contextCounts.assign(1, 0);
+    }
+
+    // Back to the entry point, as when a run starts over
+    void restart() {
+        leader = true;
+        context = 0;
+        overflow = 0;
+    }
+
+    // Called for every retired instruction
+    void retire(uint64_t pc, int length, int category) {
+        mix[category & (PROFILE_CATEGORIES - 1)]++;
+        contextCounts[context]++;
+        uint64_t i = (pc - base) >> shift;
+        if (pc - base >= size) {
+            outside++;
+            leader = false;
+            return;
+        }
+        counts[i]++;
+        if (leader || blocks[i]) blocks[i]++;
+        leader = false;
+        info[i] = (info[i] & END_BLOCK) | length;
+    }
+    // Called after retire() for instructions that end a block
+    void transfer(uint64_t from, uint64_t to, bool taken) {
+        leader = true;
+        if (from - base < size) info[(from - base) >> shift] |= END_BLOCK;
+        if (taken) edges[(from << 32) | (to & 0xffffffff)]++;
+    }
+    void call(uint64_t target) {
+        if (contexts[context].depth + 1 >= PROFILE_MAX_DEPTH) {
+            overflow++;
+            return;
+        }
+        auto found = children.find(std::make_pair(context, target));
+        if (found != children.end()) {
+            context = found->second;
+            return;
+        }
+        uint32_t child = contexts.size();
+        contexts.push_back(Context{context, contexts[context].depth + 1, target});
+        contextCounts.push_back(0);
+        children[std::make_pair(context, target)] = child;
+        context = child;
+    }
+    void ret() {
+        if (overflow) overflow--;
+        else context = contexts[context].parent;
+    }
+
+    // Hot blocks with disassembly, then hot edges, then the instruction mix.
+    // disassemble(pc) gives the text of one instruction, name(category) the
+    // name of a mix category.
+    template<typename Disassemble, typename Name>
+    void report(FILE *out, Disassemble disassemble, Name name, size_t top) const {
+        uint64_t total = outside;
+        std::vector<Block> hot;
+        for (size_t i = 0; i < counts.size(); i++) {
+            total += counts[i];
+            if (!blocks[i]) continue;
+            uint64_t pc = base + (i << shift);
+            int length = block_pcs(pc).size();
+            hot.push_back(Block{pc, blocks[i], blocks[i] * length, length});
+        }
+        std::sort(hot.begin(), hot.end(), [](const Block &a, const Block &b) {
+            return a.instructions > b.instructions;
+        });
+        if (total == 0) total = 1;
+
+        fprintf(out, "Hot blocks (%zu of %zu)\n", std::min(top, hot.size()), hot.size());
+        for (size_t b = 0; b < hot.size() && b < top; b++) {
+            const Block &block = hot[b];
+            fprintf(out, "\n0x%08" PRIx64 ": %5.1f%%  %" PRIu64 " entries x %d instructions\n",
+                    block.pc, 100.0 * block.instructions / total, block.entries, block.length);
+            for (uint64_t pc : block_pcs(block.pc)) {
+                fprintf(out, "  %12" PRIu64 "  0x%08" PRIx64 "  %s\n",
+                        counts[(pc - base) >> shift], pc, disassemble(pc).c_str());
+            }
+        }
+
+        std::vector<std::pair<uint64_t, uint64_t>> hotEdges(edges.begin(), edges.end());
+        std::sort(hotEdges.begin(), hotEdges.end(), [](const std::pair<uint64_t, uint64_t> &a,
+                                                       const std::pair<uint64_t, uint64_t> &b) {
+            return a.second > b.second;
+        });
+        fprintf(out, "\nTaken edges (%zu of %zu)\n", std::min(top, hotEdges.size()), hotEdges.size());
+        for (size_t e = 0; e < hotEdges.size() && e < top; e++) {
+            fprintf(out, "  %12" PRIu64 "  0x%08" PRIx64 " -> 0x%08" PRIx64 "\n",
+                    hotEdges[e].second, hotEdges[e].first >> 32, hotEdges[e].first & 0xffffffff);
+        }
+
+        fprintf(out, "\nInstruction mix (%" PRIu64 " retired)\n", total);
+        std::vector<int> order;
+        for (int c = 0; c < PROFILE_CATEGORIES; c++) {
+            if (mix[c]) order.push_back(c);
+        }
+        std::sort(order.begin(), order.end(), [this](int a, int b) {
+            return mix[a] > mix[b];
+        });
+        for (int c : order) {
+            fprintf(out, "  %-12s %12" PRIu64 "  %5.1f%%\n", name(c).c_str(), mix[c], 100.0 * mix[c] / total);
+        }
+    }
+
+    // One "outer;...;inner count" line per calling context, for
+    // flamegraph.pl and compatible tools
+    bool write_folded(const char *path) const {
+        FILE *out = fopen(path, "w");
+        if (!out) return false;
+        for (size_t c = 0; c < contexts.size(); c++) {
+            if (!contextCounts[c]) continue;
+            std::vector<uint64_t> stack;
+            for (uint32_t at = c; ; at = contexts[at].parent) {
+                stack.push_back(contexts[at].function);
+                if (at == 0) break;
+            }
+            for (size_t s = stack.size(); s-- > 0;) {
+                fprintf(out, "0x%" PRIx64 "%c", stack[s], s ? ';' : ' ');
+            }
+            fprintf(out, "%" PRIu64 "\n", contextCounts[c]);
+        }
+        return fclose(out) == 0;
+    }
+};
+
+#endif
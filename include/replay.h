@@ -0,0 +1,155 @@
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+#ifndef REPLAY_H
+#define REPLAY_H
+
+// Sources of nondeterminism a guest can observe
+enum InputKind : uint8_t {
+    INPUT_CHAR = 1,     // RISC-V getchar system call
+    INPUT_KEY = 2,      // x86 int 0x16 read keystroke
+    INPUT_KEY_PEEK = 3  // x86 int 0x16 check for keystroke
+};
+
+enum InputMode {
+    INPUT_LIVE,
+    INPUT_RECORD,
+    INPUT_REPLAY
+};
+
+// Log of every external input, tagged with the retired-instruction count at
+// which the guest consumed it. Recording appends to the log; replaying feeds
+// the logged values back instead of asking the outside world, so a recorded
+// run can be reproduced exactly.
+//
+// File format: the magic "CPUR", a version byte, then one event per input:
+//   varint  instructions retired since the previous event
+//   byte    InputKind
+//   varint  zigzag-encoded value
+class InputLog {
+    static const uint8_t VERSION = 1;
+
+    InputMode mode = INPUT_LIVE;
+    FILE *file = nullptr;
+    uint64_t lastCount = 0;     // Retired count of the previous event
+    uint64_t events = 0;        // Inputs handed to the guest so far
+
+    // Next event when replaying
+    bool pending = false;
+    uint64_t nextCount = 0;
+    uint8_t nextKind = 0;
+    int64_t nextValue = 0;
+
+    void put_varint(uint64_t v) {
+        while (v >= 0x80) {
+            fputc((v & 0x7f) | 0x80, file);
+            v >>= 7;
+        }
+        fputc(v, file);
+    }
+    bool get_varint(uint64_t &v) {
+        v = 0;
+        for (int shift = 0; shift < 64; shift += 7) {
+            int c = fgetc(file);
+            if (c == EOF) return false;
+            v |= (uint64_t)(c & 0x7f) << shift;
+            if (!(c & 0x80)) return true;
+        }
+        return false;
+    }
+
+    void load_next() {
+        uint64_t delta, zigzag;
+        int kind;
+        pending = get_varint(delta) && (kind = fgetc(file)) != EOF && get_varint(zigzag);
+        if (!pending) return;
+        nextCount = lastCount + delta;
+        nextKind = kind;
+        nextValue = (int64_t)(zigzag >> 1) ^ -(int64_t)(zigzag & 1);
+    }
+
+    [[noreturn]] void diverged(uint8_t kind, uint64_t count) {
+        std::cerr << "[REPLAY] Diverged at instruction " << count << ": guest read input kind "
+                  << (int)kind << ", log has ";
+        if (pending) std::cerr << "kind " << (int)nextKind << " at instruction " << nextCount << '\n';
+        else std::cerr << "no more events\n";
+        exit(1);
+    }
+
+public:
+    ~InputLog() {
+        close();
+    }
+
+    bool record(const char *path) {
+        file = fopen(path, "wb");
+        if (!file) return false;
+        mode = INPUT_RECORD;
+        fwrite("CPUR", 1, 4, file);
+        fputc(VERSION, file);
+        return true;
+    }
+    bool replay(const char *path) {
+        file = fopen(path, "rb");
+        if (!file) return false;
+        char magic[5];
+        if (fread(magic, 1, 5, file) != 5 || memcmp(magic, "CPUR", 4) || magic[4] != VERSION) {
+            return false;
+        }
+        mode = INPUT_REPLAY;
+        load_next();
+        return true;
+    }
+
+    // Finish the log file; the guest reads live input from then on
+    void close() {
+        if (file) fclose(file);
+        file = nullptr;
+        mode = INPUT_LIVE;
+        pending = false;
+    }
+
+    InputMode get_mode() const {
+        return mode;
+    }
+    // Retired count of the next logged event (for inputs that arrive
+    // asynchronously, the run loop compares against this and nothing else)
+    uint64_t next_count() const {
+        return pending ? nextCount : UINT64_MAX;
+    }
+
+    // True once a replay has handed out every logged event
+    bool exhausted() const {
+        return !pending;
+    }
+    uint64_t consumed() const {
+        return events;
+    }
+
+    // Returns the input the guest sees at retired count `count`: the logged
+    // value when replaying, otherwise live() (which is logged when recording)
+    template<typename F>
+    int64_t input(uint8_t kind, uint64_t count, F live) {
+        events++;
+        if (mode == INPUT_REPLAY) {
+            if (!pending || nextCount != count || nextKind != kind) diverged(kind, count);
+            lastCount = nextCount;
+            int64_t value = nextValue;
+            load_next();
+            return value;
+        }
+        int64_t value = live();
+        if (mode == INPUT_RECORD) {
+            put_varint(count - lastCount);
+            fputc(kind, file);
+            put_varint(((uint64_t)value << 1) ^ (uint64_t)(value >> 63));
+            lastCount = count;
+        }
+        return value;
+    }
+};
+
+#endif
@@ -0,0 +1,245 @@
+#include <algorithm>
+#include <cinttypes>
+#include <cstdint>
+#include <cstdio>
+#include <unordered_map>
+#include <vector>
+
+#ifndef REUSE_H
+#define REUSE_H
+
+// LRU stack distances of a stream of blocks (lines or pages): for each
+// access, the number of distinct blocks touched since the previous access to
+// the same block. A Fenwick tree holds a 1 at the time of every block's most
+// recent access, so a distance is a prefix-sum difference and each access
+// costs O(log n) instead of a walk down an LRU stack. Times are renumbered
+// when the tree fills up, which keeps it no larger than a few times the
+// number of distinct blocks.
+class StackDistance {
+    struct Block {
+        uint64_t time;      // Of the latest access, a position in the tree
+        uint64_t window;    // Last working-set window the block was seen in
+    };
+
+    std::unordered_map<uint64_t, Block> blocks;
+    std::vector<uint32_t> tree;         // Fenwick tree over times 1..tree.size()-1
+    uint64_t now = 0;
+    std::vector<uint64_t> histogram;    // Accesses per distance
+    uint64_t cold = 0;                  // First accesses: infinite distance
+    uint64_t accesses = 0;
+    uint64_t lastBlock = UINT64_MAX;
+    uint64_t lastWindow = 0;
+
+    void add(uint64_t time, int delta) {
+        for (; time < tree.size(); time += time & -time) tree[time] += delta;
+    }
+    uint64_t prefix(uint64_t time) const {
+        uint64_t sum = 0;
+        for (; time; time -= time & -time) sum += tree[time];
+        return sum;
+    }
+
+    // Gives the live times the numbers 1..n in the same order
+    void compact() {
+        std::vector<std::pair<uint64_t, Block *>> live;
+        live.reserve(blocks.size());
+        for (auto &b : blocks) live.push_back(std::make_pair(b.second.time, &b.second));
+        std::sort(live.begin(), live.end(), [](const std::pair<uint64_t, Block *> &a,
+                                               const std::pair<uint64_t, Block *> &b) {
+            return a.first < b.first;
+        });
+        tree.assign(std::max<size_t>(1 << 16, 4 * live.size()) + 1, 0);
+        for (size_t i = 0; i < live.size(); i++) {
+            live[i].second->time = i + 1;
+            add(i + 1, 1);
+        }
+        now = live.size();
+    }
+
+public:
+    uint64_t windowBlocks = 0;          // Distinct blocks in the current window
+
+    StackDistance() : tree((1 << 16) + 1, 0), histogram(1, 0) {}
+
+    void access(uint64_t block, uint64_t window) {
+        accesses++;
+        if (block == lastBlock && window == lastWindow) {
+            histogram[0]++;     // Already the most recent: nothing else moves
+            return;
+        }
+        lastBlock = block;
+        lastWindow = window;
+        if (now + 1 >= tree.size()) compact();
+        now++;
+        auto found = blocks.find(block);
+        if (found == blocks.end()) {
+            cold++;
+            blocks[block] = Block{now, window};
+            windowBlocks++;
+        }
+        else {
+            Block &b = found->second;
+            uint64_t distance = prefix(now - 1) - prefix(b.time);
+            if (distance >= histogram.size()) histogram.resize(std::max<size_t>(distance + 1, histogram.size() * 2), 0);
+            histogram[distance]++;
+            add(b.time, -1);
+            b.time = now;
+            if (b.window != window) {
+                b.window = window;
+                windowBlocks++;
+            }
+        }
+        add(now, 1);
+    }
+
+    uint64_t total() const {
+        return accesses;
+    }
+    uint64_t distinct() const {
+        return blocks.size();
+    }
+    uint64_t compulsory() const {
+        return cold;
+    }
+
+    // Misses of a fully associative LRU cache of every size at once: entry
+    // n is the number of misses with n blocks, for n up to distinct()
+    std::vector<uint64_t> misses() const {
+        std::vector<uint64_t> m(blocks.size() + 1, 0);
+        uint64_t far = cold;            // Accesses with a distance of at least n
+        for (size_t d = 0; d < histogram.size(); d++) far += histogram[d];
+        for (size_t n = 0; n < m.size(); n++) {
+            m[n] = far;
+            if (n < histogram.size()) far -= histogram[n];
+        }
+        return m;
+    }
+
+    // Accesses whose distance falls in [2^k - 1, 2^(k+1) - 1), k = 0, 1, ...
+    std::vector<uint64_t> log2_histogram() const {
+        std::vector<uint64_t> h;
+        for (size_t d = 0; d < histogram.size(); d++) {
+            if (!histogram[d]) continue;
+            size_t k = 63 - __builtin_clzll(d + 1);
+            if (k >= h.size()) h.resize(k + 1, 0);
+            h[k] += histogram[d];
+        }
+        return h;
+    }
+};
+
+// Reuse distances of guest loads and stores at line and page granularity,
+// and the working set (distinct lines and pages touched) in each window of
+// `window` instructions
+class ReuseAnalyzer {
+    int lineShift;
+    int pageShift;
+    uint64_t window;
+    uint64_t current = 0;       // Window of the latest access
+    StackDistance lines;
+    StackDistance pages;
+
+    struct WorkingSet {
+        uint64_t window;
+        uint64_t lines;
+        uint64_t pages;
+    };
+    std::vector<WorkingSet> workingSets;
+
+    void close_window() {
+        if (lines.windowBlocks) workingSets.push_back(WorkingSet{current, lines.windowBlocks, pages.windowBlocks});
+        lines.windowBlocks = pages.windowBlocks = 0;
+    }
+
+public:
+    explicit ReuseAnalyzer(uint64_t windowInstructions = 100000, int lineBytes = 64, int pageBytes = 4096)
+        : lineShift(__builtin_ctz(lineBytes)), pageShift(__builtin_ctz(pageBytes)),
+          window(windowInstructions ? windowInstructions : 1) {}
+
+    // retired is the instruction count, which places the access in a window
+    void access(uint64_t address, int bytes, uint64_t retired) {
+        uint64_t w = retired / window;
+        if (w != current) {
+            close_window();
+            current = w;
+        }
+        uint64_t last = (address + bytes - 1) >> lineShift;
+        for (uint64_t line = address >> lineShift; line <= last; line++) lines.access(line, w);
+        last = (address + bytes - 1) >> pageShift;
+        for (uint64_t page = address >> pageShift; page <= last; page++) pages.access(page, w);
+    }
+
+    // Full miss-ratio curves, one "granularity,blocks,bytes,miss_ratio" row
+    // wherever the ratio changes
+    bool write_curve(const char *path) const {
+        FILE *out = fopen(path, "w");
+        if (!out) return false;
+        fprintf(out, "granularity,blocks,bytes,miss_ratio\n");
+        const StackDistance *levels[2] = { &lines, &pages };
+        const char *names[2] = { "line", "page" };
+        int shifts[2] = { lineShift, pageShift };
+        for (int g = 0; g < 2; g++) {
+            std::vector<uint64_t> m = levels[g]->misses();
+            double total = levels[g]->total() ? (double)levels[g]->total() : 1.0;
+            for (size_t n = 1; n < m.size(); n++) {
+                if (n > 1 && m[n] == m[n - 1]) continue;
+                fprintf(out, "%s,%zu,%" PRIu64 ",%.6f\n", names[g], n, (uint64_t)n << shifts[g], m[n] / total);
+            }
+        }
+        return fclose(out) == 0;
+    }
+
+    void report(FILE *out) {
+        close_window();
+        const StackDistance *levels[2] = { &lines, &pages };
+        const char *names[2] = { "Line", "Page" };
+        int shifts[2] = { lineShift, pageShift };
+        for (int g = 0; g < 2; g++) {
+            const StackDistance &s = *levels[g];
+            double total = s.total() ? (double)s.total() : 1.0;
+            fprintf(out, "%s reuse (%d bytes): %" PRIu64 " accesses, %" PRIu64 " distinct\n",
+                    names[g], 1 << shifts[g], s.total(), s.distinct());
+            fprintf(out, "  %-20s %12s %7s\n", "distance", "accesses", "share");
+            std::vector<uint64_t> h = s.log2_histogram();
+            for (size_t k = 0; k < h.size(); k++) {
+                if (!h[k]) continue;
+                char range[32];
+                snprintf(range, sizeof(range), "%" PRIu64 "-%" PRIu64, (uint64_t)(1ULL << k) - 1, (uint64_t)(2ULL << k) - 2);
+                fprintf(out, "  %-20s %12" PRIu64 " %6.2f%%\n", range, h[k], 100.0 * h[k] / total);
+            }
+            fprintf(out, "  %-20s %12" PRIu64 " %6.2f%%\n", "cold", s.compulsory(), 100.0 * s.compulsory() / total);
+
+            // A cache of n blocks misses every access with a distance of n or more
+            std::vector<uint64_t> m = s.misses();
+            fprintf(out, "\n  Fully associative LRU miss ratio\n");
+            for (size_t n = 1; ; n *= 2) {
+                size_t at = std::min(n, m.size() - 1);
+                fprintf(out, "  %10zu blocks %12" PRIu64 " bytes %8.4f%%\n", n, (uint64_t)n << shifts[g],
+                        100.0 * m[at] / total);
+                if (n >= m.size() - 1) break;
+            }
+            fputc('\n', out);
+        }
+
+        fprintf(out, "Working set per %" PRIu64 " instructions (%zu windows with accesses)\n",
+                window, workingSets.size());
+        if (workingSets.empty()) return;
+        uint64_t maxLines = 0, maxPages = 0, sumLines = 0, sumPages = 0;
+        for (const WorkingSet &w : workingSets) {
+            maxLines = std::max(maxLines, w.lines);
+            maxPages = std::max(maxPages, w.pages);
+            sumLines += w.lines;
+            sumPages += w.pages;
+        }
+        fprintf(out, "  lines  mean %10.1f  max %10" PRIu64 " (%" PRIu64 " bytes)\n",
+                (double)sumLines / workingSets.size(), maxLines, maxLines << lineShift);
+        fprintf(out, "  pages  mean %10.1f  max %10" PRIu64 " (%" PRIu64 " bytes)\n",
+                (double)sumPages / workingSets.size(), maxPages, maxPages << pageShift);
+        fprintf(out, "\n  %12s %10s %10s\n", "instruction", "lines", "pages");
+        for (const WorkingSet &w : workingSets) {
+            fprintf(out, "  %12" PRIu64 " %10" PRIu64 " %10" PRIu64 "\n", w.window * window, w.lines, w.pages);
+        }
+    }
+};
+
+#endif
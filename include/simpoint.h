@@ -0,0 +1,312 @@
+#include <algorithm>
+#include <cinttypes>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#ifndef SIMPOINT_H
+#define SIMPOINT_H
+
+// Instructions executed in each basic block during one interval
+struct BbvInterval {
+    uint64_t start;         // Instructions retired before it began
+    uint64_t instructions;
+    std::vector<std::pair<uint32_t, uint64_t>> blocks; // Block index, instructions; by index
+};
+
+// Basic-block vectors over fixed intervals of retired instructions. A block
+// is named by the PC of its first instruction and ends at a control
+// transfer (or where an interval ends), so the run loop only has to say
+// which instructions end one.
+class BbvCollector {
+    uint64_t interval;
+    uint64_t inInterval = 0;    // Instructions so far in the open interval
+    uint64_t opened = 0;        // Instructions retired before the open interval
+    uint64_t run = 0;           // Instructions so far in the open block
+    uint64_t leader = 0;        // PC of the open block
+    std::unordered_map<uint64_t, uint32_t> ids; // Leader PC -> block index
+    std::vector<uint64_t> counts;               // Per block, for the open interval
+    std::vector<uint32_t> touched;              // Blocks with nonzero counts
+    std::vector<BbvInterval> closed;
+
+    void end_block() {
+        if (!run) return;
+        uint32_t id = ids.emplace(leader, (uint32_t)ids.size()).first->second;
+        if (id >= counts.size()) counts.resize(id + 1, 0);
+        if (!counts[id]) touched.push_back(id);
+        counts[id] += run;
+        run = 0;
+    }
+
+public:
+    explicit BbvCollector(uint64_t intervalInstructions = 10000000)
+        : interval(intervalInstructions ? intervalInstructions : 1) {}
+
+    uint64_t interval_length() const {
+        return interval;
+    }
+
+    // Called once per retired instruction, with the count retired before
+    // it. Instructions skipped in between (fast-forward) close the open
+    // interval, so every interval is a contiguous stretch of the run.
+    void retire(uint64_t pc, bool endsBlock, uint64_t retired) {
+        if (inInterval && retired != opened + inInterval) close_interval();
+        if (!inInterval) opened = retired;
+        if (!run) leader = pc;
+        run++;
+        if (endsBlock) end_block();
+        if (++inInterval == interval) close_interval();
+    }
+
+    // Ends the open interval early (at the end of the run); a no-op if it
+    // is empty
+    void close_interval() {
+        end_block();
+        if (!inInterval) return;
+        std::sort(touched.begin(), touched.end());
+        BbvInterval iv;
+        iv.start = opened;
+        iv.instructions = inInterval;
+        iv.blocks.reserve(touched.size());
+        for (uint32_t id : touched) {
+            iv.blocks.push_back(std::make_pair(id, counts[id]));
+            counts[id] = 0;
+        }
+        closed.push_back(std::move(iv));
+        touched.clear();
+        inInterval = 0;
+    }
+
+    const std::vector<BbvInterval> &intervals() const {
+        return closed;
+    }
+
+    // SimPoint's .bb format: one "T:block:count :block:count ..." line per
+    // interval, blocks numbered from 1
+    bool write_bb(const char *path) const {
+        FILE *out = fopen(path, "w");
+        if (!out) return false;
+        for (const BbvInterval &iv : closed) {
+            fputc('T', out);
+            for (const std::pair<uint32_t, uint64_t> &b : iv.blocks) {
+                fprintf(out, ":%u:%" PRIu64 " ", b.first + 1, b.second);
+            }
+            fputc('\n', out);
+        }
+        return fclose(out) == 0;
+    }
+};
+
+// An interval chosen to stand for one cluster of intervals
+struct SimPoint {
+    uint64_t interval;  // Index into the collected intervals
+    uint32_t cluster;
+    double weight;      // Share of all instructions that the cluster covers
+};
+
+// Picks simulation points the way SimPoint does: every interval's vector is
+// normalized to sum to 1 and randomly projected down to `dims` dimensions,
+// k-means runs for every k up to maxK, and the smallest k whose Bayesian
+// information criterion reaches 90% of the best one's range wins. Each
+// cluster is then represented by the interval nearest its centroid.
+class SimPointPicker {
+    int dims;
+    int seeds;                  // k-means restarts per k; the least distortion wins
+    uint64_t rng;
+    std::vector<double> points; // n x dims, row-major
+    size_t n = 0;
+
+    uint64_t next() {
+        rng += 0x9e3779b97f4a7c15ULL;
+        uint64_t z = rng;
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+        return z ^ (z >> 31);
+    }
+    double uniform() {
+        return (next() >> 11) * (1.0 / 9007199254740992.0);
+    }
+    // Entry (block, d) of the projection matrix, uniform in [-1, 1], made
+    // up on demand so the matrix is never stored
+    static double projection(uint32_t block, int d) {
+        uint64_t z = ((uint64_t)block << 8 | (uint64_t)d) * 0x9e3779b97f4a7c15ULL;
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+        z ^= z >> 31;
+        return (z >> 11) * (2.0 / 9007199254740992.0) - 1.0;
+    }
+
+    const double *point(size_t i) const {
+        return &points[i * dims];
+    }
+    double distance(const double *a, const double *b) const {
+        double sum = 0;
+        for (int d = 0; d < dims; d++) sum += (a[d] - b[d]) * (a[d] - b[d]);
+        return sum;
+    }
+
+    struct Clustering {
+        std::vector<double> centroids;  // k x dims
+        std::vector<uint32_t> assignment;
+        double distortion;              // Sum of squared distances to the centroids
+    };
+
+    // Lloyd's algorithm from a k-means++ start
+    Clustering kmeans(int k) {
+        Clustering c;
+        c.centroids.assign((size_t)k * dims, 0);
+        c.assignment.assign(n, 0);
+        std::vector<double> nearest(n, INFINITY);
+        size_t first = next() % n;
+        std::copy(point(first), point(first) + dims, c.centroids.begin());
+        for (int j = 1; j < k; j++) {
+            double total = 0;
+            for (size_t i = 0; i < n; i++) {
+                nearest[i] = std::min(nearest[i], distance(point(i), &c.centroids[(size_t)(j - 1) * dims]));
+                total += nearest[i];
+            }
+            size_t pick = next() % n;
+            if (total > 0) {
+                double r = uniform() * total;
+                for (pick = 0; pick + 1 < n && (r -= nearest[pick]) > 0; pick++) {}
+            }
+            std::copy(point(pick), point(pick) + dims, c.centroids.begin() + (size_t)j * dims);
+        }
+
+        std::vector<uint64_t> sizes(k);
+        for (int iteration = 0; iteration < 100; iteration++) {
+            bool moved = iteration == 0;
+            c.distortion = 0;
+            for (size_t i = 0; i < n; i++) {
+                uint32_t best = 0;
+                double bestDistance = INFINITY;
+                for (int j = 0; j < k; j++) {
+                    double dist = distance(point(i), &c.centroids[(size_t)j * dims]);
+                    if (dist < bestDistance) {
+                        bestDistance = dist;
+                        best = j;
+                    }
+                }
+                if (c.assignment[i] != best) moved = true;
+                c.assignment[i] = best;
+                c.distortion += bestDistance;
+            }
+            if (!moved) break;
+            // Empty clusters keep their old centroid
+            std::fill(sizes.begin(), sizes.end(), 0);
+            std::vector<double> sums((size_t)k * dims, 0);
+            for (size_t i = 0; i < n; i++) {
+                sizes[c.assignment[i]]++;
+                for (int d = 0; d < dims; d++) sums[(size_t)c.assignment[i] * dims + d] += point(i)[d];
+            }
+            for (int j = 0; j < k; j++) {
+                if (!sizes[j]) continue;
+                for (int d = 0; d < dims; d++) c.centroids[(size_t)j * dims + d] = sums[(size_t)j * dims + d] / sizes[j];
+            }
+        }
+        return c;
+    }
+
+    // Log-likelihood of the clustering as spherical Gaussians with one
+    // shared variance, less the usual penalty for its parameters
+    double bic(const Clustering &c, int k) const {
+        std::vector<uint64_t> sizes(k, 0);
+        for (uint32_t a : c.assignment) sizes[a]++;
+        double r = (double)n;
+        double variance = std::max(c.distortion / ((double)dims * std::max(r - k, 1.0)), 1e-12);
+        double likelihood = -r * log(r) - r * dims / 2.0 * log(2 * M_PI * variance) - dims * std::max(r - k, 1.0) / 2.0;
+        for (uint64_t s : sizes) {
+            if (s) likelihood += s * log((double)s);
+        }
+        double parameters = (double)k * (dims + 1);
+        return likelihood - parameters / 2.0 * log(r);
+    }
+
+public:
+    int chosenK = 0;
+
+    explicit SimPointPicker(int projectedDims = 15, int restarts = 5, uint64_t seed = 1)
+        : dims(projectedDims), seeds(restarts), rng(seed) {}
+
+    std::vector<SimPoint> pick(const std::vector<BbvInterval> &intervals, int maxK) {
+        n = intervals.size();
+        std::vector<SimPoint> chosen;
+        if (!n) return chosen;
+        points.assign(n * dims, 0);
+        uint64_t totalInstructions = 0;
+        for (size_t i = 0; i < n; i++) {
+            const BbvInterval &iv = intervals[i];
+            totalInstructions += iv.instructions;
+            for (const std::pair<uint32_t, uint64_t> &b : iv.blocks) {
+                double share = (double)b.second / iv.instructions;
+                for (int d = 0; d < dims; d++) points[i * dims + d] += share * projection(b.first, d);
+            }
+        }
+
+        int ks = (int)std::min<size_t>(std::max(maxK, 1), n);
+        std::vector<Clustering> best(ks + 1);
+        std::vector<double> scores(ks + 1);
+        for (int k = 1; k <= ks; k++) {
+            for (int s = 0; s < seeds; s++) {
+                Clustering c = kmeans(k);
+                if (s == 0 || c.distortion < best[k].distortion) best[k] = std::move(c);
+            }
+            scores[k] = bic(best[k], k);
+        }
+        double low = *std::min_element(scores.begin() + 1, scores.end());
+        double high = *std::max_element(scores.begin() + 1, scores.end());
+        chosenK = ks;
+        for (int k = 1; k <= ks; k++) {
+            if (scores[k] >= low + 0.9 * (high - low)) {
+                chosenK = k;
+                break;
+            }
+        }
+
+        const Clustering &c = best[chosenK];
+        for (int j = 0; j < chosenK; j++) {
+            SimPoint p = { 0, (uint32_t)j, 0 };
+            double nearest = INFINITY;
+            uint64_t instructions = 0;
+            for (size_t i = 0; i < n; i++) {
+                if (c.assignment[i] != (uint32_t)j) continue;
+                instructions += intervals[i].instructions;
+                double dist = distance(point(i), &c.centroids[(size_t)j * dims]);
+                if (dist < nearest) {
+                    nearest = dist;
+                    p.interval = i;
+                }
+            }
+            if (!instructions) continue;
+            p.weight = (double)instructions / totalInstructions;
+            chosen.push_back(p);
+        }
+        std::sort(chosen.begin(), chosen.end(), [](const SimPoint &a, const SimPoint &b) {
+            return a.interval < b.interval;
+        });
+        return chosen;
+    }
+};
+
+// SimPoint's output files: "<interval> <cluster>" and "<weight> <cluster>"
+// lines, one per simulation point
+inline bool write_simpoints(const char *simpointsPath, const char *weightsPath, const std::vector<SimPoint> &points) {
+    FILE *sp = fopen(simpointsPath, "w");
+    if (!sp) return false;
+    FILE *w = fopen(weightsPath, "w");
+    if (!w) {
+        fclose(sp);
+        return false;
+    }
+    for (const SimPoint &p : points) {
+        fprintf(sp, "%" PRIu64 " %u\n", p.interval, p.cluster);
+        fprintf(w, "%.6f %u\n", p.weight, p.cluster);
+    }
+    bool ok = fclose(sp) == 0;
+    return (fclose(w) == 0) && ok;
+}
+
+#endif
@@ -0,0 +1,51 @@
+#include <cstdint>
+#include <vector>
+
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+const int PAGE_SHIFT = 12;
+const int PAGE_SIZE = 1 << PAGE_SHIFT; // 4 KiB
+
+// Records which pages of guest memory were written since the last clear().
+// Marking is a bit test on the write path; the list of marked pages lets a
+// restore touch only those pages instead of scanning the whole bitmap.
+class DirtyPages {
+    std::vector<uint64_t> bits;  // One bit per page
+    std::vector<uint32_t> list;  // Marked pages, in the order they were first written
+
+public:
+    void resize(uint64_t memorySize) {
+        uint64_t pages = (memorySize + PAGE_SIZE - 1) >> PAGE_SHIFT;
+        bits.assign((pages + 63) / 64, 0);
+        list.clear();
+        list.reserve(pages);
+    }
+
+    void mark(uint64_t address) {
+        uint64_t page = address >> PAGE_SHIFT;
+        uint64_t mask = 1ULL << (page & 63);
+        uint64_t &word = bits[page >> 6];
+        if (!(word & mask)) {
+            word |= mask;
+            list.push_back(page);
+        }
+    }
+    void mark_range(uint64_t address, uint64_t size) {
+        if (size == 0) return;
+        uint64_t last = (address + size - 1) >> PAGE_SHIFT;
+        for (uint64_t page = address >> PAGE_SHIFT; page <= last; page++) {
+            mark(page << PAGE_SHIFT);
+        }
+    }
+
+    const std::vector<uint32_t> &pages() const {
+        return list;
+    }
+    void clear() {
+        for (uint32_t page : list) bits[page >> 6] = 0;
+        list.clear();
+    }
+};
+
+#endif
@@ -0,0 +1,217 @@
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <fcntl.h>
+#include <unistd.h>
+#include "trace.h"
+
+#ifndef TEXTRACE_H
+#define TEXTRACE_H
+
+// Formatting straight into a caller's buffer, for the disassemblers and the
+// text trace: each function writes at out and returns the end of what it
+// wrote. Callers leave room; nothing here checks.
+
+struct HexPairs {
+    char digits[512];
+};
+constexpr HexPairs build_hex_pairs() {
+    HexPairs h{};
+    const char *hex = "0123456789abcdef";
+    for (int i = 0; i < 256; i++) {
+        h.digits[2 * i] = hex[i >> 4];
+        h.digits[2 * i + 1] = hex[i & 15];
+    }
+    return h;
+}
+constexpr HexPairs HEX_PAIRS = build_hex_pairs();
+
+struct DecimalPairs {
+    char digits[200];
+};
+constexpr DecimalPairs build_decimal_pairs() {
+    DecimalPairs d{};
+    for (int i = 0; i < 100; i++) {
+        d.digits[2 * i] = '0' + i / 10;
+        d.digits[2 * i + 1] = '0' + i % 10;
+    }
+    return d;
+}
+constexpr DecimalPairs DECIMAL_PAIRS = build_decimal_pairs();
+
+inline char *text_str(char *out, const char *s, size_t n) {
+    memcpy(out, s, n);
+    return out + n;
+}
+template<size_t N>
+inline char *text_str(char *out, const char (&s)[N]) {
+    return text_str(out, s, N - 1);
+}
+
+// Exactly digits hex digits (an even number) of v
+inline char *text_hex(char *out, uint64_t v, int digits) {
+    for (int i = digits - 2; i >= 0; i -= 2) {
+        memcpy(out + i, &HEX_PAIRS.digits[2 * (v & 0xff)], 2);
+        v >>= 8;
+    }
+    return out + digits;
+}
+// v in hex without leading zeros
+inline char *text_hex(char *out, uint64_t v) {
+    int digits = (64 - __builtin_clzll(v | 1) + 3) / 4;
+    char *end = out + digits;
+    for (char *p = end; p > out; v >>= 4) *--p = HEX_PAIRS.digits[2 * (v & 15) + 1];
+    return end;
+}
+inline char *text_dec(char *out, int64_t v) {
+    uint64_t u = v;
+    if (v < 0) {
+        *out++ = '-';
+        u = 0 - u;
+    }
+    char digits[20];
+    char *p = digits + sizeof(digits);
+    while (u >= 100) {
+        p -= 2;
+        memcpy(p, &DECIMAL_PAIRS.digits[2 * (u % 100)], 2);
+        u /= 100;
+    }
+    if (u >= 10) {
+        p -= 2;
+        memcpy(p, &DECIMAL_PAIRS.digits[2 * u], 2);
+    }
+    else *--p = '0' + u;
+    size_t n = digits + sizeof(digits) - p;
+    memcpy(out, p, n);
+    return out + n;
+}
+
+// An instruction name in a disassembler's table (built at compile time), and
+// how its operands are laid out in that ISA
+struct Mnemonic {
+    char name[8];
+    uint8_t length;
+    uint8_t format;
+};
+constexpr Mnemonic make_mnemonic(const char *name, uint8_t format) {
+    Mnemonic m{};
+    while (name[m.length]) {
+        m.name[m.length] = name[m.length];
+        m.length++;
+    }
+    m.format = format;
+    return m;
+}
+// Copies all eight bytes and keeps the name
+inline char *text_mnemonic(char *out, const Mnemonic &m) {
+    memcpy(out, m.name, sizeof(m.name));
+    return out + m.length;
+}
+
+// Human-readable trace, one retired instruction per line: the PC, the
+// instruction bytes, the disassembly, and the register and memory effects
+// in tracedump's notation. Lines are built in a preallocated buffer that
+// goes to the file with one write(2) per megabyte.
+class TextTrace {
+    static const size_t BUFFER_SIZE = 1 << 20;
+    static const size_t LINE_ROOM = 256;    // Longest line, with room to spare
+    static const int COLUMN = 30;           // Where the effects start, after the disassembly
+
+    int fd = -1;
+    std::unique_ptr<char[]> buffer;
+    char *at = nullptr;
+    const char *const *registerNames = nullptr;
+    bool x86 = false;
+    bool failed = false;
+
+    void flush() {
+        const char *p = buffer.get();
+        while (p < at && !failed) {
+            ssize_t n = ::write(fd, p, at - p);
+            if (n <= 0) failed = true;
+            else p += n;
+        }
+        at = buffer.get();
+    }
+
+public:
+    ~TextTrace() {
+        close();
+    }
+
+    // names gives each register number in a TraceRecord a name
+    bool open(const char *path, const char *isa, const char *const *names) {
+        fd = ::open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) return false;
+        buffer.reset(new char[BUFFER_SIZE]);
+        at = buffer.get();
+        registerNames = names;
+        x86 = !strcmp(isa, "x86");
+        return true;
+    }
+    bool is_open() const {
+        return fd >= 0;
+    }
+
+    // disassemble(char *out) writes the instruction's text at out and
+    // returns its end
+    template<typename Disassemble>
+    void write(const TraceRecord &rec, Disassemble disassemble) {
+        char *p = at;
+        if (x86) {
+            p = text_hex(p, rec.pc, 4);
+            *p++ = ' ';
+            *p++ = ' ';
+            for (int i = 0; i < 4; i++) {
+                if (i < rec.length) p = text_hex(p, (rec.instruction >> (8 * i)) & 0xff, 2);
+                else p = text_str(p, "  ");
+            }
+        }
+        else {
+            p = text_hex(p, rec.pc, 8);
+            *p++ = ' ';
+            *p++ = ' ';
+            p = text_hex(p, rec.instruction, 8);
+        }
+        *p++ = ' ';
+        *p++ = ' ';
+        char *text = p;
+        p = disassemble(p);
+        if (p - text < COLUMN) {
+            memset(p, ' ', COLUMN - (p - text));
+            p = text + COLUMN;
+        }
+
+        if (rec.flags & TRACE_RD) {
+            const char *name = registerNames[rec.rd];
+            p = text_str(p, "  ");
+            p = text_str(p, name, strlen(name));
+            p = text_str(p, "=0x");
+            p = text_hex(p, rec.rdValue, x86 ? 4 : 16);
+        }
+        if (rec.flags & (TRACE_LOAD | TRACE_STORE)) {
+            p = text_str(p, "  [0x");
+            p = text_hex(p, rec.memAddress);
+            p = (rec.flags & TRACE_LOAD) ? text_str(p, "]->0x") : text_str(p, "]<-0x");
+            p = text_hex(p, rec.memValue);
+            p = text_str(p, " (");
+            *p++ = '0' + rec.memSize % 10;
+            *p++ = ')';
+        }
+        while (p[-1] == ' ') p--;
+        *p++ = '\n';
+        at = p;
+        if ((size_t)(at - buffer.get()) > BUFFER_SIZE - LINE_ROOM) flush();
+    }
+
+    // False if any write failed
+    bool close() {
+        if (fd < 0) return true;
+        flush();
+        bool ok = !failed && ::close(fd) == 0;
+        fd = -1;
+        return ok;
+    }
+};
+
+#endif
@@ -0,0 +1,283 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#ifndef TRACE_H
+#define TRACE_H
+
+// What a TraceRecord carries besides the PC and instruction
+const uint8_t TRACE_RD = 1 << 0;    // A register was written
+const uint8_t TRACE_LOAD = 1 << 1;  // Memory was read
+const uint8_t TRACE_STORE = 1 << 2; // Memory was written
+
+// One retired instruction
+struct TraceRecord {
+    uint64_t pc;
+    uint32_t instruction;   // Raw bytes, little-endian
+    uint8_t length;         // Bytes of instruction
+    uint8_t flags;          // TRACE_RD, TRACE_LOAD, TRACE_STORE
+    uint8_t rd;
+    uint8_t memSize;
+    int64_t rdValue;
+    uint64_t memAddress;
+    int64_t memValue;
+};
+
+// Lock-free ring between one producer and one consumer thread. Each side
+// keeps a private copy of the other's index and only reloads the shared one
+// when the ring looks full (or empty), so the two cache lines holding the
+// indices are not passed back and forth on every record.
+template<typename T, size_t Capacity>
+class SpscRing {
+    static_assert((Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two");
+
+    alignas(64) std::atomic<size_t> head{0}; // Next slot the producer fills
+    size_t cachedTail = 0;
+    alignas(64) std::atomic<size_t> tail{0}; // Next slot the consumer empties
+    size_t cachedHead = 0;
+    alignas(64) T slots[Capacity];
+
+public:
+    // Producer side; false if the ring is full
+    bool push(const T &item) {
+        size_t h = head.load(std::memory_order_relaxed);
+        if (h - cachedTail == Capacity) {
+            cachedTail = tail.load(std::memory_order_acquire);
+            if (h - cachedTail == Capacity) return false;
+        }
+        slots[h & (Capacity - 1)] = item;
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer side; copies out up to max items and returns how many
+    size_t pop(T *out, size_t max) {
+        size_t t = tail.load(std::memory_order_relaxed);
+        if (cachedHead == t) cachedHead = head.load(std::memory_order_acquire);
+        size_t n = cachedHead - t;
+        if (n > max) n = max;
+        for (size_t i = 0; i < n; i++) out[i] = slots[(t + i) & (Capacity - 1)];
+        tail.store(t + n, std::memory_order_release);
+        return n;
+    }
+};
+
+// Trace file format: the magic "CPUT", a version byte, an 8-byte ISA name,
+// then one entry per record:
+//   byte    TRACE_* flags, TRACE_JUMP, TRACE_KNOWN, and (length << 5)
+//   varint  zigzag PC - (previous PC + previous length)   if TRACE_JUMP
+//   varint  instruction                                   unless TRACE_KNOWN
+//   byte    rd, varint zigzag (value - previous value of rd)      if TRACE_RD
+//   byte    size, varint zigzag (address - previous address),
+//           varint zigzag value                     if TRACE_LOAD or TRACE_STORE
+// Straight-line code at a PC seen before costs about one byte plus its
+// register and memory deltas.
+class TraceCodec {
+protected:
+    static const uint8_t VERSION = 1;
+    static const uint8_t TRACE_JUMP = 1 << 3;  // PC is not the fall-through of the previous record
+    static const uint8_t TRACE_KNOWN = 1 << 4; // Same instruction as last time at this PC
+    static const int KNOWN_BITS = 12;
+
+    uint64_t nextPc = 0;
+    uint64_t lastAddress = 0;
+    int64_t regs[32] = {};
+    uint32_t known[1 << KNOWN_BITS] = {}; // Last instruction seen per PC slot
+    uint64_t knownPc[1 << KNOWN_BITS] = {};
+
+    static size_t slot(uint64_t pc) {
+        return (pc ^ (pc >> KNOWN_BITS)) & ((1 << KNOWN_BITS) - 1);
+    }
+    static uint64_t zigzag(int64_t v) {
+        return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);
+    }
+    static int64_t unzigzag(uint64_t v) {
+        return (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+    }
+};
+
+const size_t TRACE_RING_SIZE = 1 << 16;
+
+// Streams TraceRecords to a file. The simulation thread only copies each
+// record into a ring; a background thread does the encoding and the I/O.
+class TraceWriter : TraceCodec {
+    typedef SpscRing<TraceRecord, TRACE_RING_SIZE> Ring;
+
+    std::unique_ptr<Ring> ring;
+    std::thread thread;
+    std::atomic<bool> done{false};
+    FILE *file = nullptr;
+    std::vector<uint8_t> out;
+
+    void put_varint(uint64_t v) {
+        while (v >= 0x80) {
+            out.push_back((v & 0x7f) | 0x80);
+            v >>= 7;
+        }
+        out.push_back(v);
+    }
+
+    void encode(const TraceRecord &rec) {
+        uint8_t flags = (rec.flags & (TRACE_RD | TRACE_LOAD | TRACE_STORE)) | (rec.length << 5);
+        size_t s = slot(rec.pc);
+        if (rec.pc != nextPc) flags |= TRACE_JUMP;
+        if (knownPc[s] == rec.pc && known[s] == rec.instruction) flags |= TRACE_KNOWN;
+        out.push_back(flags);
+        if (flags & TRACE_JUMP) put_varint(zigzag(rec.pc - nextPc));
+        if (!(flags & TRACE_KNOWN)) {
+            put_varint(rec.instruction);
+            knownPc[s] = rec.pc;
+            known[s] = rec.instruction;
+        }
+        if (flags & TRACE_RD) {
+            out.push_back(rec.rd);
+            put_varint(zigzag(rec.rdValue - regs[rec.rd & 31]));
+            regs[rec.rd & 31] = rec.rdValue;
+        }
+        if (flags & (TRACE_LOAD | TRACE_STORE)) {
+            out.push_back(rec.memSize);
+            put_varint(zigzag(rec.memAddress - lastAddress));
+            put_varint(zigzag(rec.memValue));
+            lastAddress = rec.memAddress;
+        }
+        nextPc = rec.pc + rec.length;
+    }
+
+    void drain() {
+        std::vector<TraceRecord> batch(4096);
+        for (;;) {
+            // Read before popping: once done is seen, every record is in the ring
+            bool finished = done.load(std::memory_order_acquire);
+            size_t n = ring->pop(batch.data(), batch.size());
+            if (n == 0) {
+                if (finished) break;
+                std::this_thread::sleep_for(std::chrono::microseconds(100));
+                continue;
+            }
+            for (size_t i = 0; i < n; i++) encode(batch[i]);
+            if (out.size() >= (1 << 16)) {
+                fwrite(out.data(), 1, out.size(), file);
+                out.clear();
+            }
+        }
+        fwrite(out.data(), 1, out.size(), file);
+        out.clear();
+    }
+
+public:
+    ~TraceWriter() {
+        close();
+    }
+
+    bool open(const char *path, const char *isa) {
+        file = fopen(path, "wb");
+        if (!file) return false;
+        char name[8] = {};
+        memcpy(name, isa, std::min(strlen(isa), sizeof(name)));
+        fwrite("CPUT", 1, 4, file);
+        fputc(VERSION, file);
+        fwrite(name, 1, sizeof(name), file);
+        ring.reset(new Ring());
+        thread = std::thread(&TraceWriter::drain, this);
+        return true;
+    }
+    bool is_open() const {
+        return file != nullptr;
+    }
+
+    // Called once per retired instruction; waits only if the writer falls
+    // a whole ring behind
+    void write(const TraceRecord &rec) {
+        while (!ring->push(rec)) std::this_thread::yield();
+    }
+
+    void close() {
+        if (!file) return;
+        done.store(true, std::memory_order_release);
+        thread.join();
+        fclose(file);
+        file = nullptr;
+    }
+};
+
+// Reads back a file written by TraceWriter
+class TraceReader : TraceCodec {
+    FILE *file = nullptr;
+    char isaName[9] = {};
+
+    bool get_varint(uint64_t &v) {
+        v = 0;
+        for (int shift = 0; shift < 64; shift += 7) {
+            int c = fgetc(file);
+            if (c == EOF) return false;
+            v |= (uint64_t)(c & 0x7f) << shift;
+            if (!(c & 0x80)) return true;
+        }
+        return false;
+    }
+
+public:
+    ~TraceReader() {
+        if (file) fclose(file);
+    }
+
+    bool open(const char *path) {
+        file = fopen(path, "rb");
+        if (!file) return false;
+        char magic[5];
+        return fread(magic, 1, 5, file) == 5 && !memcmp(magic, "CPUT", 4) && magic[4] == VERSION
+            && fread(isaName, 1, 8, file) == 8;
+    }
+    const char *isa() const {
+        return isaName;
+    }
+
+    // False at the end of the trace (or where a truncated one stops)
+    bool next(TraceRecord &rec) {
+        int flags = fgetc(file);
+        if (flags == EOF) return false;
+        memset(&rec, 0, sizeof(rec));
+        rec.flags = flags & (TRACE_RD | TRACE_LOAD | TRACE_STORE);
+        rec.length = flags >> 5;
+        uint64_t v;
+        rec.pc = nextPc;
+        if (flags & TRACE_JUMP) {
+            if (!get_varint(v)) return false;
+            rec.pc += unzigzag(v);
+        }
+        size_t s = slot(rec.pc);
+        if (flags & TRACE_KNOWN) rec.instruction = known[s];
+        else {
+            if (!get_varint(v)) return false;
+            rec.instruction = v;
+            knownPc[s] = rec.pc;
+            known[s] = rec.instruction;
+        }
+        if (flags & TRACE_RD) {
+            int rd = fgetc(file);
+            if (rd == EOF || !get_varint(v)) return false;
+            rec.rd = rd;
+            rec.rdValue = regs[rd & 31] + unzigzag(v);
+            regs[rd & 31] = rec.rdValue;
+        }
+        if (flags & (TRACE_LOAD | TRACE_STORE)) {
+            int size = fgetc(file);
+            if (size == EOF || !get_varint(v)) return false;
+            rec.memSize = size;
+            rec.memAddress = lastAddress + unzigzag(v);
+            lastAddress = rec.memAddress;
+            if (!get_varint(v)) return false;
+            rec.memValue = unzigzag(v);
+        }
+        nextPc = rec.pc + rec.length;
+        return true;
+    }
+};
+
+#endif
@@ -0,0 +1,76 @@
+#include <cstdint>
+
+#ifndef WINDOW_H
+#define WINDOW_H
+
+// Decides, instruction by instruction, whether the run loop is inside the
+// detail window (every enabled trace, model and counter is fed) or
+// fast-forwarding (instructions just run). The window opens once `skip`
+// instructions have retired and, if set, the guest reaches startPc or
+// retires a marker instruction; it closes after `length` instructions or,
+// with markers, at the next marker. Afterwards the loop fast-forwards again
+// (and the window can reopen at the next trigger) or stops.
+class DetailWindow {
+    uint64_t skip = 0;
+    uint64_t length = 0;        // 0: until a marker or the end of the run
+    int64_t startPc = -1;       // -1: no PC trigger
+    bool markers = false;
+    bool exitAfter = false;
+
+    bool open = false;
+    bool finished = false;      // Closed with exitAfter set
+    bool closed = false;        // Closed at least once this run
+    uint64_t openedAt = 0;      // Retired count when the window opened
+
+public:
+    DetailWindow() {}
+    DetailWindow(uint64_t skipInstructions, uint64_t detailInstructions, int64_t pc, bool useMarkers, bool exit)
+        : skip(skipInstructions), length(detailInstructions), startPc(pc), markers(useMarkers), exitAfter(exit) {}
+
+    // Back to fast-forwarding from the start, for another run
+    void restart() {
+        open = false;
+        finished = false;
+        closed = false;
+    }
+
+    // Called before the instruction at pc runs; true if it is in the window
+    bool before(int64_t pc, uint64_t retired, uint64_t runStart) {
+        if (open || finished) return open;
+        if (retired - runStart < skip || markers) return false;
+        if (closed && startPc < 0) return false; // Only a PC can reopen it
+        if (startPc >= 0 && pc != startPc) return false;
+        open = true;
+        openedAt = retired;
+        return true;
+    }
+
+    // Called after each instruction with whether it was a marker; markers
+    // toggle the window
+    void after(bool marker, uint64_t retired, uint64_t runStart) {
+        if (finished) return;
+        if (markers && marker && retired - runStart > skip) {
+            if (open) close();
+            else {
+                open = true;
+                openedAt = retired;
+            }
+            return;
+        }
+        if (open && length && retired - openedAt >= length) close();
+    }
+
+    // True once the window has closed and the run should stop
+    bool done() const {
+        return finished;
+    }
+
+private:
+    void close() {
+        open = false;
+        closed = true;
+        finished = exitAfter;
+    }
+};
+
+#endif
@@ -0,0 +1,1347 @@
+#include <algorithm>
+#include <cinttypes>
+#include <cstdint>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include "branch.h"
+#include "cache.h"
+#include "checkpoint.h"
+#include "coverage.h"
+#include "digest.h"
+#include "gdbstub.h"
+#include "metrics.h"
+#include "pipeline.h"
+#include "predecode.h"
+#include "profile.h"
+#include "reuse.h"
+#include "replay.h"
+#include "simpoint.h"
+#include "snapshot.h"
+#include "textrace.h"
+#include "trace.h"
+
+#ifndef RISCV_MACHINE_H
+#define RISCV_MACHINE_H
+
+class MicroBench;
+
+// The RV64 machine, in its own namespace so that tools can link it next to
+// the x86 one
+namespace riscv {
+
+using namespace std;
+
+const int MEM_SIZE = 1 << 18; // CONST GLOBALS
+const int NUM_REGS = 32;
+const uint32_t MARKER_INSTRUCTION = 0x00100013; // addi x0, x0, 1: a hint, runs as a nop
+
+inline int64_t sign_extend(int64_t value, int8_t index);
+inline string disassemble(uint32_t inst, int64_t pc);
+
+enum OpcodeCategories {
+   LOAD, STORE, BRANCH, JALR,
+   JAL, OP_IMM, OP, AUIPC, LUI,
+   OP_IMM_32, OP_32, SYSTEM,
+   UNIMPL
+};
+const char *const CATEGORY_NAMES[] = {
+   "LOAD", "STORE", "BRANCH", "JALR",
+   "JAL", "OP_IMM", "OP", "AUIPC", "LUI",
+   "OP_IMM_32", "OP_32", "SYSTEM",
+   "UNIMPL"
+};
+
+const OpcodeCategories OPCODE_MAP[4][8] = {
+   // First row (inst[6:5] = 0b00)
+   { LOAD, UNIMPL, UNIMPL, UNIMPL, OP_IMM, AUIPC, OP_IMM_32, UNIMPL }, 
+   // Second row (inst[6:5] = 0b01)
+   { STORE, UNIMPL, UNIMPL, UNIMPL, OP, LUI, OP_32, UNIMPL },
+   // Third row (inst[6:5] = 0b10)
+   { UNIMPL, UNIMPL, UNIMPL, UNIMPL, UNIMPL, UNIMPL, UNIMPL, UNIMPL },
+   // Fourth row (inst[6:5] = 0b11)
+   { BRANCH, JALR, UNIMPL, JAL, SYSTEM, UNIMPL, UNIMPL, UNIMPL }
+};
+
+enum AluCommands {
+   ALU_ADD,
+   ALU_SUB,
+   ALU_MUL,
+   ALU_DIV,
+   ALU_REM,
+   ALU_DIVU,
+   ALU_REMU,
+   ALU_MULH,
+   ALU_MULHSU,
+   ALU_MULHU,
+   ALU_SLL,
+   ALU_SRL,
+   ALU_SRA,
+   ALU_AND,
+   ALU_OR,
+   ALU_XOR,
+   ALU_SLT,
+   ALU_SLTU,
+   ALU_NOT
+};
+
+// One instruction of a predecoded program image (see predecode.h)
+struct Predecoded {
+   uint8_t op;     // OpcodeCategories
+   uint8_t rd;
+   uint8_t rs1;
+   uint8_t rs2;
+   uint8_t funct3;
+   uint8_t funct7;
+   uint8_t flags;  // PREDECODE_VALID, PREDECODE_LEADER
+   uint8_t unused;
+   int64_t imm;    // Immediate, or the offset of a BRANCH/STORE
+};
+
+class Machine {
+    friend class ::MicroBench;
+
+    // Structs
+    struct FetchOut {
+        uint32_t instruction;
+
+        // The code below allows us to cout a FetchOut structure.
+        // We can use this to debug our code.
+        // FetchOut fo = { 0xdeadbeef };
+        // cout << fo << '\n';
+        friend std::ostream &operator<<(std::ostream &out, const FetchOut &fo) {
+            std::ostringstream sout;
+            sout << "0x" << std::hex << std::setfill('0') << std::right << std::setw(8) << fo.instruction;
+            return out << sout.str();
+        }
+    };
+    struct DecodeOut {
+        OpcodeCategories op;
+        uint8_t rd;
+        uint8_t rs1;
+        uint8_t rs2;
+        uint8_t funct3;
+        uint8_t funct7;
+        int64_t offset;    // Offsets for BRANCH and STORE
+        int64_t left_val;  // typically the value of rs1
+        int64_t right_val; // typically the value of rs2 or immediate
+
+        friend ostream &operator<<(ostream &out, const DecodeOut &dec) {
+            ostringstream sout;
+            sout << "Operation: ";
+            switch (dec.op) {
+                case LUI:
+                    sout << "LUI";
+                    break;
+                case AUIPC:
+                    sout << "AUIPC";
+                    break;
+                case LOAD:
+                    sout << "LOAD";
+                    break;
+                case STORE:
+                    sout << "STORE";
+                    break;
+                case OP_IMM:
+                    sout << "OPIMM";
+                    break;
+                case OP_IMM_32:
+                    sout << "OPIMM32";
+                    break;
+                case OP:
+                    sout << "OP";
+                    break;
+                case OP_32:
+                    sout << "OP32";
+                    break;
+                case BRANCH:
+                    sout << "BRANCH";
+                    break;
+                case JALR:
+                    sout << "JALR";
+                    break;
+                case JAL:
+                    sout << "JAL";
+                    break;
+                case SYSTEM:
+                    sout << "SYSTEM";
+                    break;
+                case UNIMPL:
+                    sout << "NOT-IMPLEMENTED";
+                    break;
+            }
+            sout << '\n';
+            sout << "RD       : " << (uint32_t)dec.rd << '\n';
+            sout << "funct3   : " << (uint32_t)dec.funct3 << '\n';
+            sout << "funct7   : " << (uint32_t)dec.funct7 << '\n';
+            sout << "offset   : " << dec.offset << '\n';
+            sout << "left     : " << dec.left_val << '\n';
+            sout << "right    : " << dec.right_val;
+            return out << sout.str();
+        }
+    };
+    struct ExecuteOut {
+        int64_t result;
+        uint8_t n, z, c, v;
+        friend ostream &operator<<(ostream &out, const ExecuteOut &eo) {
+            ostringstream sout;
+            sout << "Result: " << eo.result << " [NZCV]: " 
+                << (uint32_t)eo.n 
+                << (uint32_t)eo.z 
+                << (uint32_t)eo.c
+                << (uint32_t)eo.v;
+            return out << sout.str();
+        }
+    };
+    struct MemoryOut {
+        int64_t value;
+
+        friend ostream &operator<<(ostream &out, const MemoryOut &mo) {
+            ostringstream sout;
+            sout << "0x" << hex << right << setfill('0') << setw(16) << mo.value;
+            return out << sout.str();
+        }
+    };    
+    
+    char *mMemory;   // The memory.
+    int mMemorySize; // The size of the memory (should be MEM_SIZE)
+    int64_t mPC;     // The program counter
+    int64_t mRegs[NUM_REGS]; // The register file
+    bool mHalted;    // Set by the exit system call
+    uint64_t mRetired; // Instructions retired so far
+    InputLog *mInput;  // Records or replays getchar, if set
+    bool mQuiet;       // Drop putchar output (while re-running for checkpoints)
+    EdgeCoverage *mCoverage; // Fed by branches and jumps, if set
+    StateDigest *mDigest;    // Kept current by memory_write, if set
+    DirtyPages mDirty; // Pages written since the last snapshot
+    Predecoded *mPredecode;       // Decoded program image, if set
+    int64_t mCodeSize;            // Bytes covered by mPredecode
+    bool mBreak;       // decode() reached a breakpoint (see debug_run)
+
+    // Objects
+    FetchOut mFO;   
+    DecodeOut mDO;
+    ExecuteOut mEO;
+    MemoryOut mMO;
+
+    // Read from the internal memory
+    // Usage:
+    // int myintval = memory_read<int>(0); // Read the first 4 bytes
+    // char mycharval = memory_read<char>(8); // Read byte index 8
+    template<typename T>
+    T memory_read(int64_t address) const {
+        return *reinterpret_cast<T*>(mMemory + address);
+    }
+    // Write to the internal memory
+    // Usage:
+    // memory_write<int>(0, 0xdeadbeef); // Set bytes 0, 1, 2, 3 to 0xdeadbeef
+    // memory_write<char>(8, 0xff);      // Set byte index 8 to 0xff
+    template<typename T>
+    void memory_write(int64_t address, T value) {
+        *reinterpret_cast<T*>(mMemory + address) = value;
+        written(address, sizeof(T));
+    }
+    // Self-modifying code: the records of the words a write touches go back
+    // to the slow path. Breakpoints stay set.
+    void code_written(int64_t address, int64_t size) {
+        int64_t end = std::min(address + size, mCodeSize);
+        for (int64_t i = address >> 2; i * 4 < end; i++) {
+            mPredecode[i].flags &= ~(PREDECODE_VALID | PREDECODE_PARKED);
+        }
+    }
+
+    // Decode
+    void decode_b() {
+        mDO.rd        = (mFO.instruction >> 7) & 0x1f;
+        mDO.funct3    = (mFO.instruction >> 12) & 7;
+        mDO.rs1       = (mFO.instruction >> 15) & 0x1f;
+        mDO.rs2       = (mFO.instruction >> 20) & 0x1f;
+        mDO.left_val  = get_xreg((mFO.instruction >> 15)); // get_xreg truncates for us
+        mDO.right_val = get_xreg((mFO.instruction >> 20));
+        mDO.offset    = sign_extend((((mFO.instruction >> 31) & 1) << 12) |
+                                    (((mFO.instruction >> 25) & 0x3f) << 5) |
+                                    (((mFO.instruction >> 8) & 0xf) << 1) | 
+                                    (((mFO.instruction >> 7) & 1) << 11), 12);
+    }
+    void decode_r() {
+        mDO.rd        = (mFO.instruction >> 7) & 0x1f;
+        mDO.funct3    = (mFO.instruction >> 12) & 7;
+        mDO.rs1       = (mFO.instruction >> 15) & 0x1f;
+        mDO.rs2       = (mFO.instruction >> 20) & 0x1f;
+        mDO.left_val  = get_xreg(mFO.instruction >> 15); // get_xreg truncates for us
+        mDO.right_val = get_xreg(mFO.instruction >> 20);
+        mDO.funct7    = (mFO.instruction >> 25) & 0x7f;
+    }
+    void decode_i() {
+        mDO.rd        = (mFO.instruction >> 7) & 0x1f;
+        mDO.funct3    = (mFO.instruction >> 12) & 7;
+        mDO.funct7    = (mFO.instruction >> 25) & 0x7f; // Tells SRLI from SRAI
+        mDO.rs1       = (mFO.instruction >> 15) & 0x1f;
+        mDO.left_val  = get_xreg(mFO.instruction >> 15); // RS1
+        mDO.right_val = sign_extend((mFO.instruction >> 20), 11); // Immediate
+    }
+    void decode_j() {
+        mDO.rd        = (mFO.instruction >> 7) & 0x1f;
+        mDO.rs1       = 0;
+        mDO.rs2       = 0;
+        // imm[20|10:1|11|19:12]
+        mDO.right_val = sign_extend((((mFO.instruction >> 31) & 1) << 20 | // imm[20]
+                                    (((mFO.instruction >> 21) & 0x3ff) << 1) | // imm[10:1]
+                                    (((mFO.instruction >> 20) & 1) << 11) | // imm[11]
+                                    (((mFO.instruction >> 12) & 0xff) << 12)), 20); // imm[19:12]
+    }
+    void decode_u() {
+        mDO.rd        = (mFO.instruction >> 7) & 0x1f;
+        mDO.rs1       = 0;
+        mDO.rs2       = 0;
+        mDO.left_val  = 0; // LUI adds the immediate to zero
+        mDO.right_val = sign_extend((((mFO.instruction >> 12) & 0xfffff) << 12), 31); 
+    }
+    void decode_s() {
+        mDO.rd        = 0; // Stores write no register
+        mDO.funct3    = (mFO.instruction >> 12) & 7;
+        mDO.rs1       = (mFO.instruction >> 15) & 0x1f;
+        mDO.rs2       = (mFO.instruction >> 20) & 0x1f;
+        mDO.left_val  = get_xreg(mFO.instruction >> 15); // RS1
+        mDO.right_val = get_xreg(mFO.instruction >> 20); // RS2
+        mDO.offset    = sign_extend(((mFO.instruction >> 7) & 0x1f) | // Offset
+                                   (((mFO.instruction >> 25) & 0x7f) << 5), 11);
+    }
+
+    // Decode from the predecoded image; only register values are read here
+    void decode_predecoded(const Predecoded &pd) {
+        mDO.op        = (OpcodeCategories)pd.op;
+        mDO.rd        = pd.rd;
+        mDO.rs1       = pd.rs1;
+        mDO.rs2       = pd.rs2;
+        mDO.funct3    = pd.funct3;
+        mDO.funct7    = pd.funct7;
+        mDO.left_val  = get_xreg(pd.rs1);
+        switch (mDO.op) {
+            case STORE:
+            case BRANCH:
+                mDO.offset = pd.imm;
+                mDO.right_val = get_xreg(pd.rs2);
+                break;
+            case OP:
+            case OP_32:
+                mDO.right_val = get_xreg(pd.rs2);
+                break;
+            default:
+                mDO.right_val = pd.imm;
+                break;
+        }
+    }
+
+    // ALU Operations
+    ExecuteOut alu(AluCommands cmd, int64_t left, int64_t right) {
+        ExecuteOut ret;
+        switch (cmd) {
+            case ALU_ADD:
+                ret.result = left + right;
+            break;
+            case ALU_SUB:
+                ret.result = left - right;
+            break;
+            case ALU_MUL:
+                ret.result = left * right;
+            break;
+            // Division by zero and overflow give what the M extension says,
+            // not a host trap
+            case ALU_DIV:
+                if (!right) ret.result = -1;
+                else if (left == INT64_MIN && right == -1) ret.result = left;
+                else ret.result = left / right;
+            break;
+            case ALU_REM:
+                if (!right) ret.result = left;
+                else if (left == INT64_MIN && right == -1) ret.result = 0;
+                else ret.result = left % right;
+            break;
+            case ALU_DIVU:
+                ret.result = right ? static_cast<uint64_t>(left) / static_cast<uint64_t>(right) : UINT64_MAX;
+            break;
+            case ALU_REMU:
+                ret.result = right ? static_cast<uint64_t>(left) % static_cast<uint64_t>(right) : left;
+            break;
+            case ALU_MULH:
+                ret.result = (static_cast<__int128>(left) * right) >> 64;
+            break;
+            case ALU_MULHSU:
+                ret.result = (static_cast<__int128>(left) * static_cast<uint64_t>(right)) >> 64;
+            break;
+            case ALU_MULHU:
+                ret.result = (static_cast<unsigned __int128>(static_cast<uint64_t>(left)) * static_cast<uint64_t>(right)) >> 64;
+            break;
+            // Shifts use the low six bits of the amount
+            case ALU_SRL:
+                ret.result = static_cast<uint64_t>(left) >> (right & 63);
+            break;
+            case ALU_SLL:
+                ret.result = static_cast<uint64_t>(left) << (right & 63);
+                break;
+            case ALU_SRA:
+                ret.result = static_cast<int64_t>(left) >> (right & 63);
+                break;
+            case ALU_AND:
+                ret.result = left & right;
+                break;
+            case ALU_OR:
+                ret.result = left | right;
+                break;
+            case ALU_XOR:
+                ret.result = left ^ right;
+                break;
+            case ALU_SLT:
+                ret.result = left < right;
+                break;
+            case ALU_SLTU:
+                ret.result = static_cast<uint64_t>(left) < static_cast<uint64_t>(right);
+                break;
+            case ALU_NOT:
+                ret.result = ~left;
+                break;
+        }
+        // Now that we have the result, determine the flags.
+        uint8_t sign_left = (left >> 63) & 1;
+        uint8_t sign_right = (right >> 63) & 1;
+        uint8_t sign_result = (ret.result >> 63) & 1;
+        ret.z = !ret.result;
+        ret.n = sign_result;
+        ret.v = (~sign_left & ~sign_right & sign_result) |
+                    (sign_left & sign_right & ~sign_result);
+        ret.c = (ret.result > left) || (ret.result > right);
+        return ret;
+    }
+
+public:
+    // The architectural state needed to rewind a Machine
+    struct Snapshot {
+        int64_t pc;
+        int64_t regs[NUM_REGS];
+        bool halted;
+        uint64_t retired;
+        std::vector<char> memory;
+    };
+
+    Machine(char *mem, int size) {
+        mMemory = mem;
+        mMemorySize = size;
+        mPC = 0;
+        mHalted = false;
+        mRetired = 0;
+        mInput = nullptr;
+        mQuiet = false;
+        mCoverage = nullptr;
+        mDigest = nullptr;
+        mPredecode = nullptr;
+        mCodeSize = 0;
+        mBreak = false;
+        mDirty.resize(size);
+        memset(mRegs, 0, sizeof(mRegs));
+        set_xreg(2, mMemorySize);
+    }
+
+    bool halted() const {
+        return mHalted;
+    }
+    uint64_t retired() const {
+        return mRetired;
+    }
+    void set_input_log(InputLog *log) {
+        mInput = log;
+    }
+    void set_quiet(bool quiet) {
+        mQuiet = quiet;
+    }
+    void set_coverage(EdgeCoverage *cov) {
+        mCoverage = cov;
+    }
+    // Run decode() over every word of the first codeSize bytes of memory,
+    // keeping the parts that do not depend on register values, and mark
+    // where basic blocks start. Decoding goes the slow way meanwhile; the
+    // table set by set_predecode is back in place afterwards.
+    void predecode(Predecoded *out, int64_t codeSize) {
+        int64_t count = codeSize / 4;
+        Predecoded *table = mPredecode;
+        int64_t tableSize = mCodeSize;
+        set_predecode(nullptr, 0);
+        for (int64_t i = 0; i < count; i++) {
+            Predecoded &pd = out[i];
+            memset(&pd, 0, sizeof(pd));
+            mFO.instruction = memory_read<uint32_t>(i * 4);
+            if ((mFO.instruction & 3) != 3 ||
+                OPCODE_MAP[(mFO.instruction >> 5) & 3][(mFO.instruction >> 2) & 7] == UNIMPL) {
+                continue; // Data, or nothing this core can run
+            }
+            mDO = DecodeOut();
+            decode();
+            pd.op     = mDO.op;
+            pd.rd     = mDO.rd;
+            pd.rs1    = mDO.rs1;
+            pd.rs2    = mDO.rs2;
+            pd.funct3 = mDO.funct3;
+            pd.funct7 = mDO.funct7;
+            pd.flags  = PREDECODE_VALID;
+            if (mDO.op == BRANCH || mDO.op == STORE) pd.imm = mDO.offset;
+            else if (mDO.op != OP && mDO.op != OP_32) pd.imm = mDO.right_val;
+        }
+        set_predecode(table, tableSize);
+        if (count > 0) out[0].flags |= PREDECODE_LEADER;
+        for (int64_t i = 0; i < count; i++) {
+            if (!(out[i].flags & PREDECODE_VALID)) continue;
+            switch (out[i].op) {
+                case BRANCH:
+                case JAL: {
+                    int64_t target = i * 4 + out[i].imm;
+                    if (target >= 0 && target < count * 4 && !(target & 3)) {
+                        out[target / 4].flags |= PREDECODE_LEADER;
+                    }
+                }
+                    [[fallthrough]]; // The next instruction starts a block too
+                case JALR:
+                case SYSTEM:
+                    if (i + 1 < count) out[i + 1].flags |= PREDECODE_LEADER;
+                    break;
+            }
+        }
+    }
+    // Decode the first codeSize bytes from table until the next call
+    // (nullptr for none). The machine writes to it: stores into the program
+    // clear PREDECODE_VALID on the records they overlap. The caller keeps
+    // it alive meanwhile.
+    void set_predecode(Predecoded *table, int64_t codeSize) {
+        mPredecode = table;
+        mCodeSize = codeSize;
+    }
+    // Every write to memory reports here, the debugger's included
+    void written(int64_t address, int64_t size) {
+        mDirty.mark_range(address, size);
+        if (mDigest) mDigest->touch(address, size);
+        if (address < mCodeSize) code_written(address, size);
+    }
+
+    void set_digest(StateDigest *dig) {
+        mDigest = dig;
+        mDigest->attach(mMemory, mMemorySize);
+    }
+    // Hash of the registers, PC and memory (needs set_digest)
+    uint64_t digest() {
+        return mDigest->state(mRegs, sizeof(mRegs), mPC);
+    }
+
+    // Capture the registers, PC and memory, and start tracking dirty pages
+    void snapshot(Snapshot &snap) {
+        snap.pc = mPC;
+        memcpy(snap.regs, mRegs, sizeof(mRegs));
+        snap.halted = mHalted;
+        snap.retired = mRetired;
+        snap.memory.assign(mMemory, mMemory + mMemorySize);
+        mDirty.clear();
+    }
+    // Rewind to the most recent snapshot. Only the pages written since then
+    // are copied back, so the cost follows the guest's footprint, not MEM_SIZE.
+    void restore(const Snapshot &snap) {
+        for (uint32_t page : mDirty.pages()) {
+            uint64_t offset = (uint64_t)page << PAGE_SHIFT;
+            memcpy(mMemory + offset, snap.memory.data() + offset, PAGE_SIZE);
+            if (mDigest) mDigest->touch(offset, PAGE_SIZE);
+        }
+        mDirty.clear();
+        mPC = snap.pc;
+        memcpy(mRegs, snap.regs, sizeof(mRegs));
+        mHalted = snap.halted;
+        mRetired = snap.retired;
+    }
+
+    // Save the registers, PC and the pages that differ from image, the
+    // memory as the program was loaded
+    void checkpoint(Checkpoint &ck, const char *image) const {
+        ck.pc = mPC;
+        ck.retired = mRetired;
+        ck.regs.assign(mRegs, mRegs + NUM_REGS);
+        ck.diff(mMemory, image, mMemorySize);
+    }
+    // Resume from a checkpoint taken of the program now in memory; false if
+    // it does not fit this machine
+    bool load_checkpoint(const Checkpoint &ck) {
+        if (ck.regs.size() != NUM_REGS || !ck.apply(mMemory, mMemorySize)) return false;
+        for (uint32_t page : ck.pages) {
+            mDirty.mark_range((uint64_t)page << PAGE_SHIFT, PAGE_SIZE);
+            if (mDigest) mDigest->touch((uint64_t)page << PAGE_SHIFT, PAGE_SIZE);
+            code_written((uint64_t)page << PAGE_SHIFT, PAGE_SIZE);
+        }
+        mPC = ck.pc;
+        memcpy(mRegs, ck.regs.data(), sizeof(mRegs));
+        mRetired = ck.retired;
+        mHalted = false;
+        return true;
+    }
+
+    int64_t get_pc() const {
+        return mPC;
+    }
+    OpcodeCategories category() const {
+        return mDO.op;
+    }
+    // True if the instruction that just retired was the marker
+    bool marker() const {
+        return mFO.instruction == MARKER_INSTRUCTION;
+    }
+    void set_pc(int64_t to) {
+        mPC = to;
+    }
+
+    int64_t get_xreg(int reg) const {
+        reg &= 0x1f; // Make sure the register number is 0 - 31
+        return mRegs[reg];
+    }
+    void set_xreg(int reg, int64_t value) {
+        reg &= 0x1f;
+        mRegs[reg] = value;
+    }
+
+    void fetch() {
+        mFO.instruction = memory_read<uint32_t>(mPC);
+    }
+    void decode() {
+        if ((uint64_t)mPC < (uint64_t)mCodeSize && !(mPC & 3)) {
+            const Predecoded &pd = mPredecode[mPC >> 2];
+            if (pd.flags & PREDECODE_VALID) {
+                decode_predecoded(pd);
+                return;
+            }
+            if (pd.flags & PREDECODE_BREAK) mBreak = true;
+        }
+        uint8_t opcode_map_row = (mFO.instruction >> 5) & 3;
+        uint8_t opcode_map_col = (mFO.instruction >> 2) & 7;
+        uint8_t inst_size      = mFO.instruction & 3;
+        if (inst_size != 3) {
+            cerr << "[DECODE] Invalid instruction (not a 32-bit instruction).\n";
+            return;
+        }
+        mDO.op = OPCODE_MAP[opcode_map_row][opcode_map_col];
+        // Decode the rest of mDO based on the instruction type
+        switch (mDO.op) {
+            case LOAD:
+            case JALR:
+            case OP_IMM:
+            case OP_IMM_32:
+            case SYSTEM:
+                decode_i();
+                break;
+            case STORE:
+                decode_s();
+                break;
+            case BRANCH:
+                decode_b();
+                break;
+            case JAL:
+                decode_j();
+                break;
+            case AUIPC:
+            case LUI:
+                decode_u();
+                break;
+            case OP:
+            case OP_32:
+                decode_r();
+                break;
+            default:
+                cerr << "Invalid op type: " << mDO.op << '\n';
+                break;
+        }
+    }
+    void execute() {
+        AluCommands cmd;
+        // Most instructions will follow left/right
+        // but some won't, so we need these:
+        int64_t op_left = mDO.left_val;
+        int64_t op_right = mDO.right_val; 
+
+        if (mDO.op == BRANCH) { // 11000
+            // A branch needs to subtract the operands
+            cmd = ALU_SUB;
+        }
+        else if (mDO.op == LOAD || mDO.op == STORE) { // 00000 | 01000
+            // For loads and stores, we need to add the
+            // offset with the base register.
+            cmd = ALU_ADD; // LB/LH/LW/LD or SB/SH/SW/SD
+            if (mDO.op == STORE) op_right = mDO.offset; // right_val is the value to store
+        }
+        else if (mDO.op == OP) { // 01100
+            // We can't tell which ALU command to use until
+            // we read the funct3 and funct7
+            switch (mDO.funct3) {
+                case 0b000: // ADD or SUB
+                    if (mDO.funct7 == 0) cmd = ALU_ADD; // ADD
+                    else if (mDO.funct7 == 32) cmd = ALU_SUB; // SUB
+                    else if (mDO.funct7 == 1) cmd = ALU_MUL; // MUL
+                break;
+                // Finish the rest of the OP functions here.
+                case 0b001:
+                    if (mDO.funct7 == 0) cmd = ALU_SLL; // SLL
+                    else if (mDO.funct7 == 1) cmd = ALU_MULH; // MULH
+                    break;
+                case 0b010:
+                    if (mDO.funct7 == 0) cmd = ALU_SLT; // SLT
+                    else if (mDO.funct7 == 1) cmd = ALU_MULHSU; // MULHSU
+                    break;
+                case 0b011:
+                    if (mDO.funct7 == 0) cmd = ALU_SLTU; // SLTU
+                    else if (mDO.funct7 == 1) cmd = ALU_MULHU; // MULHU
+                    break;
+                case 0b100:
+                    if (mDO.funct7 == 0) cmd = ALU_XOR; // XOR
+                    else if (mDO.funct7 == 1) cmd = ALU_DIV; // DIV
+                    break;
+                case 0b101:
+                    if (mDO.funct7 == 0) cmd = ALU_SRL; // SRL
+                    else if (mDO.funct7 == 32) cmd = ALU_SRA; // SRA
+                    else if (mDO.funct7 == 1) cmd = ALU_DIVU; // DIVU
+                    break;
+                case 0b110:
+                    if (mDO.funct7 == 0) cmd = ALU_OR; // OR
+                    else if (mDO.funct7 == 1) cmd = ALU_REM; // REM
+                    break;
+                case 0b111:
+                    if (mDO.funct7 == 0) cmd = ALU_AND; // AND
+                    else if (mDO.funct7 == 1) cmd = ALU_REMU; // REMU
+                    break;
+            }
+        }
+        else if (mDO.op == OP_32) { // 01110
+            op_left = sign_extend(op_left, 31);
+            op_right = sign_extend(op_right, 31);
+            // You still need to determine the ALU command. The unsigned
+            // ones zero-extend instead, and shifts use five bits.
+            switch (mDO.funct3) {
+                case 0b000:
+                    if (mDO.funct7 == 0) cmd = ALU_ADD; // ADDW
+                    else if (mDO.funct7 == 32) cmd = ALU_SUB; // SUBW
+                    else if (mDO.funct7 == 1) cmd = ALU_MUL; // MULW
+                    break;
+                case 0b101:
+                    if (mDO.funct7 == 0) cmd = ALU_SRL; // SRLW
+                    else if (mDO.funct7 == 32) cmd = ALU_SRA; // SRAW
+                    else if (mDO.funct7 == 1) cmd = ALU_DIVU; // DIVUW
+                    if (mDO.funct7 != 32) op_left = static_cast<uint32_t>(op_left);
+                    if (mDO.funct7 == 1) op_right = static_cast<uint32_t>(op_right);
+                    else op_right &= 31;
+                    break;
+                case 0b001:
+                    cmd = ALU_SLL; // SLLW
+                    op_right &= 31;
+                    break;
+                case 0b100:
+                    if (mDO.funct7 == 1) cmd = ALU_DIV; // DIVW
+                    break;
+                case 0b110:
+                    if (mDO.funct7 == 1) cmd = ALU_REM; // REMW
+                    break;
+                case 0b111:
+                    if (mDO.funct7 == 1) cmd = ALU_REMU; // REMUW
+                    op_left = static_cast<uint32_t>(op_left);
+                    op_right = static_cast<uint32_t>(op_right);
+                    break;
+            }
+        }
+        else if (mDO.op == OP_IMM) { // 00100
+            // Look and see which ALU op needs to be executed.
+            switch (mDO.funct3){
+                case 0b000:
+                    cmd = ALU_ADD; // ADDI
+                    break;
+                case 0b010:
+                    cmd = ALU_SLT; // SLTI
+                    break;
+                case 0b011:
+                    cmd = ALU_SLTU; // SLTIU
+                    break;
+                case 0b100: // XORI
+                    cmd = ALU_XOR;
+                    break;
+                case 0b110:
+                    cmd = ALU_OR; // ORI
+                    break;
+                case 0b111:
+                    cmd = ALU_AND; // ANDI
+                    break;
+                case 0b001:
+                    cmd = ALU_SLL; // SLLI
+                    break;
+                case 0b101: // The low bit of funct7 is the top bit of a 6-bit shamt
+                    if ((mDO.funct7 >> 1) == 0) cmd = ALU_SRL; // SRLI
+                    else if ((mDO.funct7 >> 1) == 16) cmd = ALU_SRA; // SRAI
+                    break;
+            }
+        }
+        else if (mDO.op == OP_IMM_32) { // 00110
+            op_left = sign_extend(op_left, 31);
+            op_right = sign_extend(op_right, 31);
+            // This is just like OP_IMM except we truncated
+            // the left and right ops.
+            switch (mDO.funct3){
+                case 0b000:
+                    cmd = ALU_ADD; // ADDIW
+                    break;
+                case 0b001:
+                    cmd = ALU_SLL; // SLLIW
+                    op_right &= 31;
+                    break;
+                case 0b101:
+                    if (mDO.funct7 == 0) cmd = ALU_SRL; // SRLIW
+                    else if (mDO.funct7 == 32) cmd = ALU_SRA; // SRAIW
+                    if (mDO.funct7 == 0) op_left = static_cast<uint32_t>(op_left);
+                    op_right &= 31;
+                    break;
+            }
+        }
+        else if (mDO.op == JALR) { // 11001
+            // JALR has an offset and a register value that
+            // need to be added together.
+            cmd = ALU_ADD; // JALR
+        }
+        else if (mDO.op == LUI) { // 01101
+            cmd = ALU_ADD;
+            
+        } 
+        else if (mDO.op == AUIPC) { // 00101
+            cmd = ALU_ADD; 
+            op_left = get_pc();
+        }
+        else if (mDO.op == JAL) { // 11011
+            cmd = ALU_ADD; // JAL
+            op_left = get_pc();
+            // op_right = OFFSET
+        }
+        else if (mDO.op == SYSTEM){ // 11100
+            cmd = ALU_ADD; // ECALL
+        }
+        // No-op does not assign a command
+        mEO = alu(cmd, op_left, op_right);
+        if (mDO.op == OP_32 || mDO.op == OP_IMM_32) mEO.result = sign_extend(mEO.result, 31); // *W results
+    }    
+    void memory() {
+        if (mDO.op == STORE) {
+            switch (mDO.funct3) {
+                case 0b000: // SB
+                    memory_write<uint8_t>(mEO.result, mDO.right_val);
+                    break;
+                // Finish here
+                case 0b001: // SH
+                    memory_write<uint16_t>(mEO.result, mDO.right_val);
+                    break;
+                case 0b010: // SW
+                    memory_write<uint32_t>(mEO.result, mDO.right_val);
+                    break;
+                case 0b011: // SD
+                    memory_write<uint64_t>(mEO.result, mDO.right_val);
+                    break;
+                default:
+                    cerr << "[MEMORY: STORE]: Invalid funct3: " << mDO.funct3 << '\n';
+                break;
+            }
+        }
+        else if (mDO.op == LOAD) {
+            switch (mDO.funct3) {
+                case 0b000: // LB
+                    mMO.value = memory_read<int8_t>(mEO.result);
+                    break;
+                // Finish here
+                case 0b001: // LH
+                    mMO.value = memory_read<int16_t>(mEO.result);
+                    break;
+                case 0b010: // LW
+                    mMO.value = memory_read<int32_t>(mEO.result);
+                    break;
+                case 0b100: // LBU
+                    mMO.value = memory_read<uint8_t>(mEO.result);
+                    break;
+                case 0b101: // LHU
+                    mMO.value = memory_read<uint16_t>(mEO.result);
+                    break;
+                case 0b110: // LWU
+                    mMO.value = memory_read<uint32_t>(mEO.result);
+                    break;
+                case 0b011: // LD
+                    mMO.value = memory_read<int64_t>(mEO.result);
+                    break;
+                default:
+                    cerr << "[MEMORY: LOAD]: Invalid funct3: " << mDO.funct3 << '\n';
+                break;
+            }
+        }
+        else {
+            // If this is not a LOAD or STORE, then this stage just copies
+            // the ALU result.
+            mMO.value = mEO.result;
+        }
+    }
+    void writeback(){
+        int64_t system_number = get_xreg(17); // get system number from a7
+        switch(mDO.op){
+            case SYSTEM: // ECALL Instruction (SYSTEM Opcode) - System call
+                switch (system_number){
+                    case 0: 
+                        mHalted = true;
+                        break;
+                    case 1: {
+                        int64_t c = mInput ? mInput->input(INPUT_CHAR, mRetired, [] { return (int64_t)getchar(); })
+                                           : getchar();
+                        set_xreg( 10, (c & 0xff) ); // Get char from a0
+                        break;
+                    }
+                    case 2:
+                        if (!mQuiet) putchar( (char) get_xreg(10) ); // Prints char to the screen
+                        break;
+                }
+                set_pc(get_pc() + 4); 
+                break;
+            case BRANCH: {
+                int64_t from = get_pc();
+                switch(mDO.funct3){
+                    case 0b000: // BEQ 
+                        if (mEO.z) set_pc(get_pc() + mDO.offset); // Takes the PC and adds the offset if condition is true
+                        else set_pc(get_pc() + 4);  
+                        break;
+                    case 0b001: // BNE
+                        if (!(mEO.z)) set_pc(get_pc() + mDO.offset); // Takes the PC and adds the offset if condition is true
+                        else set_pc(get_pc() + 4);  
+                        break;
+                    case 0b100: // BLT
+                        if (mDO.left_val < mDO.right_val) set_pc(get_pc() + mDO.offset);
+                        else set_pc(get_pc() + 4);  
+                        break;
+                    case 0b101: // BGE
+                        if (mDO.left_val >= mDO.right_val) set_pc(get_pc() + mDO.offset);
+                        else set_pc(get_pc() + 4);  
+                        break;
+                    case 0b110: // BLTU
+                        if ((uint64_t)mDO.left_val < (uint64_t)mDO.right_val) set_pc(get_pc() + mDO.offset);
+                        else set_pc(get_pc() + 4);
+                        break;
+                    case 0b111: // BGEU
+                        if ((uint64_t)mDO.left_val >= (uint64_t)mDO.right_val) set_pc(get_pc() + mDO.offset);
+                        else set_pc(get_pc() + 4);
+                        break;
+                }
+                if (mCoverage) mCoverage->edge(from, get_pc());
+                break;
+            }
+            case JAL:
+                set_xreg(mDO.rd, get_pc()+4); // x[rd] = pc+4
+                if (mCoverage) mCoverage->edge(get_pc(), mMO.value);
+                set_pc(mMO.value); // pc += sext(offset)
+                break;
+            case JALR:
+                set_xreg(mDO.rd, get_pc()+4); // x[rd]=pc+4
+                if (mCoverage) mCoverage->edge(get_pc(), mMO.value);
+                set_pc( mMO.value ); // pc=(x[rs1]+sext(offset))&∼1
+                break;
+            default:
+                set_xreg(mDO.rd, mMO.value);
+                set_pc(get_pc() + 4);
+                break;
+        }
+        set_xreg(0, 0);     
+        mRetired++;
+    }
+    // One whole instruction, with no debug output
+    void step() {
+        fetch();
+        decode();
+        execute();
+        memory();
+        writeback();
+    }
+    // Runs at most limit instructions for a debugger (gdbstub.h) while the
+    // pc stays below end. A breakpoint stops the run before its instruction
+    // unless it is the first one and the debugger is resuming from it; a
+    // watchpoint fault sets stop, which ends the run after the instruction.
+    GdbStop debug_run(volatile bool &stop, uint64_t limit, int64_t end, bool resuming) {
+        for (uint64_t n = 0; n < limit; n++) {
+            if (mHalted || mPC >= end) return GDB_STOP_EXIT;
+            int64_t pc = mPC;
+            mBreak = false;
+            fetch();
+            decode();
+            if (mBreak && (n || !resuming)) {
+                mPC = pc;
+                return GDB_STOP_BREAK;
+            }
+            execute();
+            memory();
+            writeback();
+            if (stop) return GDB_STOP_WATCH;
+        }
+        return (mHalted || mPC >= end) ? GDB_STOP_EXIT : GDB_STOP_LIMIT;
+    }
+
+    // Describe the instruction that just retired from pc
+    void trace(TraceRecord &rec, int64_t pc) const {
+        rec.pc = pc;
+        rec.instruction = mFO.instruction;
+        rec.length = 4;
+        rec.flags = 0;
+        if (mDO.op == LOAD) {
+            rec.flags = TRACE_LOAD;
+            rec.memSize = 1 << (mDO.funct3 & 3);
+            rec.memAddress = mEO.result;
+            rec.memValue = mMO.value;
+        }
+        else if (mDO.op == STORE) {
+            rec.flags = TRACE_STORE;
+            rec.memSize = 1 << (mDO.funct3 & 3);
+            rec.memAddress = mEO.result;
+            rec.memValue = rec.memSize == 8 ? mDO.right_val : mDO.right_val & ((1LL << (8 * rec.memSize)) - 1);
+        }
+        if (mDO.op != STORE && mDO.op != BRANCH && mDO.op != SYSTEM && mDO.rd != 0) {
+            rec.flags |= TRACE_RD;
+            rec.rd = mDO.rd;
+            rec.rdValue = get_xreg(mDO.rd);
+        }
+    }
+
+    // Count the instruction that just retired from pc
+    void profile(Profiler &prof, int64_t pc) const {
+        prof.retire(pc, 4, mDO.op);
+        switch (mDO.op) {
+            case BRANCH:
+            case JAL:
+            case JALR:
+            case SYSTEM:
+                prof.transfer(pc, mPC, mPC != pc + 4);
+                if ((mDO.op == JAL || mDO.op == JALR) && mDO.rd == 1) prof.call(mPC); // ra: a call
+                else if (mDO.op == JALR && mDO.rd == 0 && mDO.rs1 == 1) prof.ret();   // jr ra: a return
+                break;
+            default:
+                break;
+        }
+    }
+
+    // Add the instruction that just retired from pc to the run counters
+    void count(Metrics &metrics, int64_t pc) const {
+        metrics.retired++;
+        metrics.categories[mDO.op]++;
+        switch (mDO.op) {
+            case LOAD:
+                metrics.load(1 << (mDO.funct3 & 3));
+                break;
+            case STORE:
+                metrics.store(1 << (mDO.funct3 & 3));
+                break;
+            case BRANCH:
+                metrics.branch(mPC != pc + 4);
+                break;
+            case JAL:
+            case JALR:
+                metrics.jumps++;
+                break;
+            case SYSTEM:
+                metrics.syscalls++;
+                break;
+            default:
+                break;
+        }
+    }
+
+    // Feed the caches the fetch and any load or store of the instruction
+    // that just retired from pc
+    void cache(CacheHierarchy &caches, int64_t pc) const {
+        caches.fetch(pc, 4);
+        if (mDO.op == LOAD) caches.read(pc, mEO.result, 1 << (mDO.funct3 & 3));
+        else if (mDO.op == STORE) caches.write(pc, mEO.result, 1 << (mDO.funct3 & 3));
+    }
+
+    // Count the instruction that just retired from pc in its basic block
+    void block(BbvCollector &bbv, int64_t pc) const {
+        bbv.retire(pc, mDO.op == BRANCH || mDO.op == JAL || mDO.op == JALR || mDO.op == SYSTEM, mRetired - 1);
+    }
+
+    // Feed the reuse analyzer the load or store that memory() just did
+    void reuse(ReuseAnalyzer &analyzer) const {
+        if (mDO.op == LOAD || mDO.op == STORE) analyzer.access(mEO.result, 1 << (mDO.funct3 & 3), mRetired);
+    }
+
+    // Describe the control transfer that just retired from pc; false if
+    // the instruction was not one
+    bool branch(BranchEvent &e, int64_t pc) const {
+        switch (mDO.op) {
+            case BRANCH:
+                e.kind = BRANCH_COND;
+                break;
+            case JAL:
+                e.kind = (mDO.rd == 1 || mDO.rd == 5) ? BRANCH_CALL : BRANCH_JUMP;
+                break;
+            case JALR:
+                if (mDO.rd == 1 || mDO.rd == 5) e.kind = BRANCH_CALL;
+                else if (mDO.rd == 0 && (mDO.rs1 == 1 || mDO.rs1 == 5)) e.kind = BRANCH_RETURN;
+                else e.kind = BRANCH_INDIRECT;
+                break;
+            default:
+                return false;
+        }
+        e.pc = pc;
+        e.fallthrough = pc + 4;
+        e.target = mPC;
+        e.taken = e.kind != BRANCH_COND || mPC != pc + 4;
+        return true;
+    }
+
+    // Describe the instruction that just retired from pc to a timing model
+    void timing(PipeOp &op, int64_t pc) const {
+        op.rd = mDO.rd;
+        op.rs1 = mDO.rs1;
+        op.rs2 = 0;
+        op.redirect = mPC != pc + 4;
+        op.pc = pc;
+        op.next = mPC;
+        op.address = mEO.result;
+        switch (mDO.op) {
+            case LOAD:
+                op.kind = PIPE_LOAD;
+                break;
+            case STORE:
+                op.kind = PIPE_STORE;
+                op.rs2 = mDO.rs2;
+                break;
+            case BRANCH:
+                op.kind = PIPE_BRANCH;
+                op.rd = 0;
+                op.rs2 = mDO.rs2;
+                break;
+            case JAL:
+                op.kind = PIPE_JUMP;
+                op.rs1 = 0;
+                break;
+            case JALR:
+                op.kind = PIPE_JUMP_REG;
+                break;
+            case OP:
+            case OP_32:
+                op.kind = mDO.funct7 != 1 ? PIPE_ALU : (mDO.funct3 & 4) ? PIPE_DIV : PIPE_MUL;
+                op.rs2 = mDO.rs2;
+                break;
+            case SYSTEM: // ecall reads a7 and a0, and getchar writes a0
+                op.kind = PIPE_SYSTEM;
+                op.rs1 = 17;
+                op.rs2 = 10;
+                op.rd = get_xreg(17) == 1 ? 10 : 0;
+                break;
+            case LUI:
+            case AUIPC:
+                op.kind = PIPE_ALU;
+                op.rs1 = 0;
+                break;
+            default:
+                op.kind = PIPE_ALU;
+                break;
+        }
+    }
+
+    FetchOut &debug_fetch_out() { 
+        return mFO; 
+    }
+    DecodeOut &debug_decode_out() { 
+        return mDO; 
+    }
+    ExecuteOut &debug_execute_out(){
+        return mEO;
+    }
+    MemoryOut &debug_memory_out(){
+        return mMO; 
+    }
+};
+
+inline int64_t sign_extend(int64_t value, int8_t index) {
+    if ((value >> index) & 1) {
+        // Sign bit is 1
+        return value | (-1UL << index);
+    }
+    else {
+        // Sign bit is 0
+        return value & ~(-1UL << index);
+    }
+}
+
+// Operand layouts in the disassembler's mnemonic table
+enum OperandFormat : uint8_t {
+    FMT_INVALID, FMT_LOAD, FMT_STORE, FMT_BRANCH, FMT_JAL, FMT_JALR,
+    FMT_IMM, FMT_SHIFT, FMT_SHIFT_32, FMT_REG, FMT_UPPER, FMT_SYSTEM
+};
+
+// Mnemonics by category, funct3 and funct7 variant (see mnemonic_variant),
+// built at compile time
+struct MnemonicTable {
+    Mnemonic entries[(UNIMPL + 1) * 8 * 4];
+};
+constexpr int mnemonic_slot(int op, int funct3, int variant) {
+    return (op * 8 + funct3) * 4 + variant;
+}
+constexpr MnemonicTable build_mnemonics() {
+    const char *loads[8] = { "lb", "lh", "lw", "ld", "lbu", "lhu", "lwu", nullptr };
+    const char *stores[8] = { "sb", "sh", "sw", "sd", nullptr, nullptr, nullptr, nullptr };
+    const char *branches[8] = { "beq", "bne", nullptr, nullptr, "blt", "bge", "bltu", "bgeu" };
+    const char *opImms[8] = { "addi", "slli", "slti", "sltiu", "xori", "srli", "ori", "andi" };
+    const char *ops[8] = { "add", "sll", "slt", "sltu", "xor", "srl", "or", "and" };
+    const char *muls[8] = { "mul", "mulh", "mulhsu", "mulhu", "div", "divu", "rem", "remu" };
+    const char *muls32[8] = { "mulw", nullptr, nullptr, nullptr, "divw", "divuw", "remw", "remuw" };
+
+    MnemonicTable t{};
+    for (int f3 = 0; f3 < 8; f3++) {
+        if (loads[f3]) t.entries[mnemonic_slot(LOAD, f3, 0)] = make_mnemonic(loads[f3], FMT_LOAD);
+        if (stores[f3]) t.entries[mnemonic_slot(STORE, f3, 0)] = make_mnemonic(stores[f3], FMT_STORE);
+        if (branches[f3]) t.entries[mnemonic_slot(BRANCH, f3, 0)] = make_mnemonic(branches[f3], FMT_BRANCH);
+        t.entries[mnemonic_slot(JAL, f3, 0)] = make_mnemonic("jal", FMT_JAL);
+        t.entries[mnemonic_slot(JALR, f3, 0)] = make_mnemonic("jalr", FMT_JALR);
+        t.entries[mnemonic_slot(LUI, f3, 0)] = make_mnemonic("lui", FMT_UPPER);
+        t.entries[mnemonic_slot(AUIPC, f3, 0)] = make_mnemonic("auipc", FMT_UPPER);
+        t.entries[mnemonic_slot(OP_IMM, f3, 0)] = make_mnemonic(opImms[f3], f3 == 1 || f3 == 5 ? FMT_SHIFT : FMT_IMM);
+        t.entries[mnemonic_slot(OP, f3, 0)] = make_mnemonic(ops[f3], FMT_REG);
+        t.entries[mnemonic_slot(OP, f3, 2)] = make_mnemonic(muls[f3], FMT_REG);
+        if (muls32[f3]) t.entries[mnemonic_slot(OP_32, f3, 2)] = make_mnemonic(muls32[f3], FMT_REG);
+    }
+    t.entries[mnemonic_slot(OP_IMM, 5, 1)] = make_mnemonic("srai", FMT_SHIFT);
+    t.entries[mnemonic_slot(OP_IMM_32, 0, 0)] = make_mnemonic("addiw", FMT_IMM);
+    t.entries[mnemonic_slot(OP_IMM_32, 1, 0)] = make_mnemonic("slliw", FMT_SHIFT_32);
+    t.entries[mnemonic_slot(OP_IMM_32, 5, 0)] = make_mnemonic("srliw", FMT_SHIFT_32);
+    t.entries[mnemonic_slot(OP_IMM_32, 5, 1)] = make_mnemonic("sraiw", FMT_SHIFT_32);
+    t.entries[mnemonic_slot(OP, 0, 1)] = make_mnemonic("sub", FMT_REG);
+    t.entries[mnemonic_slot(OP, 5, 1)] = make_mnemonic("sra", FMT_REG);
+    for (int variant : { 0, 1, 3 }) { // OP_32 takes any funct7 but 1 as the base encodings
+        t.entries[mnemonic_slot(OP_32, 0, variant)] = make_mnemonic(variant == 1 ? "subw" : "addw", FMT_REG);
+        t.entries[mnemonic_slot(OP_32, 1, variant)] = make_mnemonic("sllw", FMT_REG);
+        t.entries[mnemonic_slot(OP_32, 5, variant)] = make_mnemonic(variant == 1 ? "sraw" : "srlw", FMT_REG);
+    }
+    t.entries[mnemonic_slot(SYSTEM, 0, 0)] = make_mnemonic("ecall", FMT_SYSTEM);
+    t.entries[mnemonic_slot(SYSTEM, 0, 1)] = make_mnemonic("ebreak", FMT_SYSTEM);
+    return t;
+}
+constexpr MnemonicTable MNEMONICS = build_mnemonics();
+
+// Which funct7 (or, for SYSTEM, which word) picks the mnemonic: 0 for the
+// base encoding, 1 for the 0x20 one (sub, sra), 2 for M (funct7 = 1), 3 for
+// anything else
+inline int mnemonic_variant(int op, uint32_t inst) {
+    int funct3 = (inst >> 12) & 7;
+    int funct7 = (inst >> 25) & 0x7f;
+    switch (op) {
+        case OP:
+        case OP_32:
+            return funct7 == 0 ? 0 : funct7 == 0x20 ? 1 : funct7 == 1 ? 2 : 3;
+        case OP_IMM:
+            return funct3 == 5 && funct7 >> 1 == 0x10;
+        case OP_IMM_32:
+            return funct3 == 5 && funct7 == 0x20;
+        case SYSTEM:
+            return inst == 0x00000073 ? 0 : inst == 0x00100073 ? 1 : 3;
+        default:
+            return 0;
+    }
+}
+
+inline char *text_xreg(char *out, int reg) {
+    *out++ = 'x';
+    if (reg >= 10) *out++ = '0' + reg / 10;
+    *out++ = '0' + reg % 10;
+    return out;
+}
+
+// Assembly text of one instruction at pc, written at out (64 bytes is
+// plenty); returns the end of the text
+inline char *disassemble(char *out, uint32_t inst, int64_t pc) {
+    int rd = (inst >> 7) & 0x1f;
+    int funct3 = (inst >> 12) & 7;
+    int rs1 = (inst >> 15) & 0x1f;
+    int rs2 = (inst >> 20) & 0x1f;
+    int64_t imm_i = sign_extend(inst >> 20, 11);
+    OpcodeCategories op = (inst & 3) == 3 ? OPCODE_MAP[(inst >> 5) & 3][(inst >> 2) & 7] : UNIMPL;
+    const Mnemonic &m = MNEMONICS.entries[mnemonic_slot(op, funct3, mnemonic_variant(op, inst))];
+
+    char *p = text_mnemonic(out, m);
+    switch (m.format) {
+        case FMT_LOAD:
+        case FMT_JALR:
+            *p++ = ' ';
+            p = text_xreg(p, rd);
+            p = text_str(p, ", ");
+            p = text_dec(p, imm_i);
+            p = text_str(p, "(");
+            p = text_xreg(p, rs1);
+            *p++ = ')';
+            break;
+        case FMT_STORE:
+            *p++ = ' ';
+            p = text_xreg(p, rs2);
+            p = text_str(p, ", ");
+            p = text_dec(p, sign_extend(((inst >> 7) & 0x1f) | (((inst >> 25) & 0x7f) << 5), 11));
+            p = text_str(p, "(");
+            p = text_xreg(p, rs1);
+            *p++ = ')';
+            break;
+        case FMT_BRANCH:
+            *p++ = ' ';
+            p = text_xreg(p, rs1);
+            p = text_str(p, ", ");
+            p = text_xreg(p, rs2);
+            p = text_str(p, ", 0x");
+            p = text_hex(p, pc + sign_extend((((inst >> 31) & 1) << 12) | (((inst >> 25) & 0x3f) << 5) |
+                                                        (((inst >> 8) & 0xf) << 1) | (((inst >> 7) & 1) << 11), 12));
+            break;
+        case FMT_JAL:
+            *p++ = ' ';
+            p = text_xreg(p, rd);
+            p = text_str(p, ", 0x");
+            p = text_hex(p, pc + sign_extend((((inst >> 31) & 1) << 20) | (((inst >> 21) & 0x3ff) << 1) |
+                                                        (((inst >> 20) & 1) << 11) | (((inst >> 12) & 0xff) << 12), 20));
+            break;
+        case FMT_IMM:
+        case FMT_SHIFT:
+        case FMT_SHIFT_32:
+            *p++ = ' ';
+            p = text_xreg(p, rd);
+            p = text_str(p, ", ");
+            p = text_xreg(p, rs1);
+            p = text_str(p, ", ");
+            p = text_dec(p, m.format == FMT_IMM ? imm_i : imm_i & (m.format == FMT_SHIFT ? 0x3f : 0x1f));
+            break;
+        case FMT_REG:
+            *p++ = ' ';
+            p = text_xreg(p, rd);
+            p = text_str(p, ", ");
+            p = text_xreg(p, rs1);
+            p = text_str(p, ", ");
+            p = text_xreg(p, rs2);
+            break;
+        case FMT_UPPER:
+            *p++ = ' ';
+            p = text_xreg(p, rd);
+            p = text_str(p, ", 0x");
+            p = text_hex(p, (inst >> 12) & 0xfffff);
+            break;
+        case FMT_SYSTEM:
+            break;
+        default:
+            p = text_str(out, ".word 0x");
+            p = text_hex(p, inst, 8);
+            break;
+    }
+    return p;
+}
+inline string disassemble(uint32_t inst, int64_t pc) {
+    char text[64];
+    return string(text, disassemble(text, inst, pc));
+}
+
+// Register names for the text trace
+const char *const XREG_NAMES[NUM_REGS] = {
+    "x0", "x1", "x2", "x3", "x4", "x5", "x6", "x7", "x8", "x9", "x10", "x11", "x12", "x13", "x14", "x15",
+    "x16", "x17", "x18", "x19", "x20", "x21", "x22", "x23", "x24", "x25", "x26", "x27", "x28", "x29", "x30", "x31"
+};
+
+} // namespace riscv
+
+#endif
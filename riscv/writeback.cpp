@@ -1,660 +1,466 @@
+#include <cinttypes>
 #include <cstdint>
 #include <fstream>
 #include <iostream>
-#include <iomanip>
+#include <cstring>
+#include "gdbstub.h"
+#include "hostperf.h"
+#include "ooo.h"
+#include "options.h"
+#include "window.h"
+#include "machine.h"
 
 using namespace std;
+using namespace riscv;
 
-const int MEM_SIZE = 1 << 18; // CONST GLOBALS
-const int NUM_REGS = 32;
+// The machine as GDB's riscv:rv64 architecture sees it: x0-x31, then the pc.
+// Breakpoints live in the predecoded program the machine runs from: the
+// --predecode table if there is one, else a table the debugger builds. When
+// the debugger goes, the machine runs from the --predecode table (or none)
+// again, with every breakpoint removed.
+class GdbMachine : public GdbTarget {
+    Machine &mach;
+    char *mem;
+    int64_t size;   // Program bytes; the run ends when the pc leaves them
+    Predecoded *table;
+    BreakpointTable<Predecoded> breaks;
 
-int64_t sign_extend(int64_t value, int8_t index);
-
-enum OpcodeCategories {
-   LOAD, STORE, BRANCH, JALR,
-   JAL, OP_IMM, OP, AUIPC, LUI,
-   OP_IMM_32, OP_32, SYSTEM,
-   UNIMPL
+public:
+    GdbMachine(Machine &m, char *memory, int64_t programSize, Predecoded *predecoded)
+        : mach(m), mem(memory), size(programSize), table(predecoded) {
+        if (table) breaks.adopt(table, size / 4);
+        else {
+            mach.predecode(breaks.build(size / 4), size);
+            mach.set_predecode(breaks.data(), size);
+        }
+    }
+    ~GdbMachine() {
+        breaks.clear();
+        mach.set_predecode(table, table ? size : 0);
+    }
+    int registers() const override {
+        return 33;
+    }
+    int register_bytes() const override {
+        return 8;
+    }
+    int pc_register() const override {
+        return 32;
+    }
+    uint64_t get_register(int n) override {
+        return n < 32 ? mach.get_xreg(n) : mach.get_pc();
+    }
+    void set_register(int n, uint64_t value) override {
+        if (n == 32) mach.set_pc(value);
+        else if (n > 0) mach.set_xreg(n, value);
+    }
+    char *memory() override {
+        return mem;
+    }
+    uint64_t memory_size() const override {
+        return MEM_SIZE;
+    }
+    void memory_written(uint64_t address, uint64_t length) override {
+        mach.written(address, length);
+    }
+    bool breakpoint(uint64_t address, bool insert) override {
+        return !(address & 3) && breaks.set(address / 4, insert);
+    }
+    GdbStop run(volatile bool &stop, uint64_t limit, bool resuming) override {
+        return mach.debug_run(stop, limit, size, resuming);
+    }
 };
 
-const OpcodeCategories OPCODE_MAP[4][8] = {
-   // First row (inst[6:5] = 0b00)
-   { LOAD, UNIMPL, UNIMPL, UNIMPL, OP_IMM, AUIPC, OP_IMM_32, UNIMPL }, 
-   // Second row (inst[6:5] = 0b01)
-   { STORE, UNIMPL, UNIMPL, UNIMPL, OP, LUI, OP_32, UNIMPL },
-   // Third row (inst[6:5] = 0b10)
-   { UNIMPL, UNIMPL, UNIMPL, UNIMPL, UNIMPL, UNIMPL, UNIMPL, UNIMPL },
-   // Fourth row (inst[6:5] = 0b11)
-   { BRANCH, JALR, UNIMPL, JAL, SYSTEM, UNIMPL, UNIMPL, UNIMPL }
-};
+// One instruction with the output of each stage printed, for --debug
+static void debug_stages(Machine &mach) {
+    mach.fetch();
+    cout << mach.debug_fetch_out() << '\n';
+    mach.decode();
+    cout << mach.debug_decode_out() << '\n';
+    mach.execute();
+    cout << mach.debug_execute_out() << '\n';
+    mach.memory();
+    cout << mach.debug_memory_out() << '\n';
+    mach.writeback();
+}
 
-enum AluCommands {
-   ALU_ADD,
-   ALU_SUB,
-   ALU_MUL,
-   ALU_DIV,
-   ALU_REM,
-   ALU_SLL,
-   ALU_SRL,
-   ALU_SRA,
-   ALU_AND,
-   ALU_OR,
-   ALU_XOR,
-   ALU_NOT
-};
+int main(int argc, char *argv[]) {
 
-class Machine {
+    // .... Code that error checks and reads the file ....
+    Options opts;
+    if (!parse_options(argc, argv, opts)) return -1;
+    if(!opts.binary){
+        std::cerr << "include file\n";
+        return -1; 
+    }
 
-    // Structs
-    struct FetchOut {
-        uint32_t instruction;
+    std::ifstream ifs (opts.binary, std::ios::binary);
+    if (!(ifs.is_open())){
+        std::cerr << "invalid file type\n";
+        return -1;
+    }
 
-        // The code below allows us to cout a FetchOut structure.
-        // We can use this to debug our code.
-        // FetchOut fo = { 0xdeadbeef };
-        // cout << fo << '\n';
-        friend std::ostream &operator<<(std::ostream &out, const FetchOut &fo) {
-            std::ostringstream sout;
-            sout << "0x" << std::hex << std::setfill('0') << std::right << std::setw(8) << fo.instruction;
-            return out << sout.str();
-        }
-    };
-    struct DecodeOut {
-        OpcodeCategories op;
-        uint8_t rd;
-        uint8_t funct3;
-        uint8_t funct7;
-        int64_t offset;    // Offsets for BRANCH and STORE
-        int64_t left_val;  // typically the value of rs1
-        int64_t right_val; // typically the value of rs2 or immediate
+    // Seek to end of file, get length, then return back to top
+    ifs.seekg (0, ifs.end);
+    int size = ifs.tellg();
+    if (size % 4 != 0){
+        std::cerr << "invalid file size\n";
+        return -1;
+    }
+    ifs.clear();
+    ifs.seekg (0, ifs.beg);
+    
+    // Allocate char* size of file, zeroed and page aligned so that a
+    // debugger's watchpoints can protect pages of it
+    char* mem = static_cast<char*>(mmap(nullptr, MEM_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+    if (mem == MAP_FAILED) {
+        std::cerr << "cannot allocate guest memory\n";
+        return -1;
+    }
+    ifs.read(mem, size);
 
-        friend ostream &operator<<(ostream &out, const DecodeOut &dec) {
-            ostringstream sout;
-            sout << "Operation: ";
-            switch (dec.op) {
-                case LUI:
-                    sout << "LUI";
-                    break;
-                case AUIPC:
-                    sout << "AUIPC";
-                    break;
-                case LOAD:
-                    sout << "LOAD";
-                    break;
-                case STORE:
-                    sout << "STORE";
-                    break;
-                case OP_IMM:
-                    sout << "OPIMM";
-                    break;
-                case OP_IMM_32:
-                    sout << "OPIMM32";
-                    break;
-                case OP:
-                    sout << "OP";
-                    break;
-                case OP_32:
-                    sout << "OP32";
-                    break;
-                case BRANCH:
-                    sout << "BRANCH";
-                    break;
-                case JALR:
-                    sout << "JALR";
-                    break;
-                case JAL:
-                    sout << "JAL";
-                    break;
-                case SYSTEM:
-                    sout << "SYSTEM";
-                    break;
-                case UNIMPL:
-                    sout << "NOT-IMPLEMENTED";
-                    break;
-            }
-            sout << '\n';
-            sout << "RD       : " << (uint32_t)dec.rd << '\n';
-            sout << "funct3   : " << (uint32_t)dec.funct3 << '\n';
-            sout << "funct7   : " << (uint32_t)dec.funct7 << '\n';
-            sout << "offset   : " << dec.offset << '\n';
-            sout << "left     : " << dec.left_val << '\n';
-            sout << "right    : " << dec.right_val;
-            return out << sout.str();
-        }
-    };
-    struct ExecuteOut {
-        int64_t result;
-        uint8_t n, z, c, v;
-        friend ostream &operator<<(ostream &out, const ExecuteOut &eo) {
-            ostringstream sout;
-            sout << "Result: " << eo.result << " [NZCV]: " 
-                << (uint32_t)eo.n 
-                << (uint32_t)eo.z 
-                << (uint32_t)eo.c
-                << (uint32_t)eo.v;
-            return out << sout.str();
+    InputLog input;
+    if (opts.record && !input.record(opts.record)) {
+        std::cerr << "cannot record to " << opts.record << '\n';
+        return -1;
+    }
+    if (opts.replay && !input.replay(opts.replay)) {
+        std::cerr << "invalid replay log\n";
+        return -1;
+    }
+
+    Machine mach(mem, MEM_SIZE);
+    mach.set_input_log(&input);
+
+    // The program as loaded, which checkpoints are taken against
+    std::vector<char> image;
+    if (opts.simpoint) image.assign(mem, mem + MEM_SIZE);
+    if (opts.restore) {
+        Checkpoint ck;
+        if (!ck.read(opts.restore, "rv64") || !mach.load_checkpoint(ck)) {
+            std::cerr << "invalid checkpoint " << opts.restore << '\n';
+            return -1;
         }
-    };
-    struct MemoryOut {
-        int64_t value;
+    }
 
-        friend ostream &operator<<(ostream &out, const MemoryOut &mo) {
-            ostringstream sout;
-            sout << "0x" << hex << right << setfill('0') << setw(16) << mo.value;
-            return out << sout.str();
+    // Decode the program once per binary and keep it for later runs
+    PredecodeCache<Predecoded> predecode;
+    if (opts.predecode) {
+        if (!predecode.open(opts.predecode, "rv64", mem, size, size / 4)) {
+            mach.predecode(predecode.build(), size);
+            if (!predecode.save()) {
+                std::cerr << "cannot write predecode cache to " << opts.predecode << '\n';
+            }
         }
-    };    
-    
-    char *mMemory;   // The memory.
-    int mMemorySize; // The size of the memory (should be MEM_SIZE)
-    int64_t mPC;     // The program counter
-    int64_t mRegs[NUM_REGS]; // The register file
+        mach.set_predecode(predecode.data(), size);
+    }
 
-    // Objects
-    FetchOut mFO;   
-    DecodeOut mDO;
-    ExecuteOut mEO;
-    MemoryOut mMO;
+    EdgeCoverage coverage;
+    coverage.set_mode(opts.coverageBlocks ? COVERAGE_BLOCKS : COVERAGE_EDGES);
+    if (coverage.attach_afl() || opts.coverage) mach.set_coverage(&coverage);
 
-    // Read from the internal memory
-    // Usage:
-    // int myintval = memory_read<int>(0); // Read the first 4 bytes
-    // char mycharval = memory_read<char>(8); // Read byte index 8
-    template<typename T>
-    T memory_read(int64_t address) const {
-        return *reinterpret_cast<T*>(mMemory + address);
-    }
-    // Write to the internal memory
-    // Usage:
-    // memory_write<int>(0, 0xdeadbeef); // Set bytes 0, 1, 2, 3 to 0xdeadbeef
-    // memory_write<char>(8, 0xff);      // Set byte index 8 to 0xff
-    template<typename T>
-    void memory_write(int64_t address, T value) {
-        *reinterpret_cast<T*>(mMemory + address) = value;
+    // Digests are written as "<retired instructions> <hash>" lines
+    StateDigest digest;
+    FILE *digestOut = nullptr;
+    if (opts.digest) {
+        digestOut = fopen(opts.digest, "w");
+        if (!digestOut) {
+            std::cerr << "cannot write digests to " << opts.digest << '\n';
+            return -1;
+        }
+        mach.set_digest(&digest);
     }
+    auto write_digest = [&]() {
+        fprintf(digestOut, "%" PRIu64 " %016" PRIx64 "\n", mach.retired(), mach.digest());
+    };
 
-    // Decode
-    void decode_b() {
-        mDO.rd        = (mFO.instruction >> 7) & 0x1f;
-        mDO.funct3    = (mFO.instruction >> 12) & 7;
-        mDO.left_val  = get_xreg((mFO.instruction >> 15)); // get_xreg truncates for us
-        mDO.right_val = get_xreg((mFO.instruction >> 20));
-        mDO.offset    = sign_extend((((mFO.instruction >> 31) & 1) << 12) |
-                                    (((mFO.instruction >> 25) & 0x3f) << 5) |
-                                    (((mFO.instruction >> 8) & 0xf) << 1) | 
-                                    (((mFO.instruction >> 7) & 1) << 11), 12);
-    }
-    void decode_r() {
-        mDO.rd        = (mFO.instruction >> 7) & 0x1f;
-        mDO.funct3    = (mFO.instruction >> 12) & 7;
-        mDO.left_val  = get_xreg(mFO.instruction >> 15); // get_xreg truncates for us
-        mDO.right_val = get_xreg(mFO.instruction >> 20);
-        mDO.funct7    = (mFO.instruction >> 25) & 0x7f;
-    }
-    void decode_i() {
-        mDO.rd        = (mFO.instruction >> 7) & 0x1f;
-        mDO.funct3    = (mFO.instruction >> 12) & 7;
-        mDO.left_val  = get_xreg(mFO.instruction >> 15); // RS1
-        mDO.right_val = sign_extend((mFO.instruction >> 20), 11); // Immediate
-    }
-    void decode_j() {
-        mDO.rd        = (mFO.instruction >> 7) & 0x1f;
-        // imm[20|10:1|11|19:12]
-        mDO.right_val = sign_extend((((mFO.instruction >> 31) & 1) << 20 | // imm[20]
-                                    (((mFO.instruction >> 21) & 0x3ff) << 1) | // imm[10:1]
-                                    (((mFO.instruction >> 20) & 1) << 11) | // imm[11]
-                                    (((mFO.instruction >> 12) & 0xff) << 12)), 20); // imm[19:12]
-    }
-    void decode_u() {
-        mDO.rd        = (mFO.instruction >> 7) & 0x1f;
-        mDO.right_val = sign_extend((((mFO.instruction >> 12) & 0xfffff) << 12), 31); 
-    }
-    void decode_s() {
-        mDO.funct3    = (mFO.instruction >> 12) & 7;
-        mDO.left_val  = get_xreg(mFO.instruction >> 15); // RS1
-        mDO.right_val = get_xreg(mFO.instruction >> 20); // RS2
-        mDO.offset    = sign_extend(((mFO.instruction >> 7) & 0x1f) | // Offset
-                                   (((mFO.instruction >> 25) & 0x7f) << 5), 11);
+    TraceWriter trace;
+    if (opts.trace && !trace.open(opts.trace, "rv64")) {
+        std::cerr << "cannot write trace to " << opts.trace << '\n';
+        return -1;
     }
+    TraceRecord record;
+    TextTrace textTrace;
+    if (opts.textTrace && !textTrace.open(opts.textTrace, "rv64", XREG_NAMES)) {
+        std::cerr << "cannot write text trace to " << opts.textTrace << '\n';
+        return -1;
+    }
+
+    Profiler profiler;
+    if (opts.profile || opts.folded) profiler.init(0, size, 2, 0);
 
-    // ALU Operations
-    ExecuteOut alu(AluCommands cmd, int64_t left, int64_t right) {
-        ExecuteOut ret;
-        switch (cmd) {
-            case ALU_ADD:
-                ret.result = left + right;
-            break;
-            case ALU_SUB:
-                ret.result = left - right;
-            break;
-            case ALU_MUL:
-                ret.result = left * right;
-            break;
-            case ALU_DIV:
-                ret.result = left / right;
-            break;
-            case ALU_REM:
-                ret.result = left % right;
-            break;
-            case ALU_SRL:
-                ret.result = static_cast<uint64_t>(left) >> right;
-            break;
-            // Finish the commands here.
-            case ALU_SLL:
-                ret.result = static_cast<uint64_t>(left) << right;
-                break;
-            case ALU_SRA:
-                ret.result = static_cast<int64_t>(left) >> right;
-                break;
-            case ALU_AND:
-                ret.result = left & right;
-                break;
-            case ALU_OR:
-                ret.result = left | right;
-                break;
-            case ALU_XOR:
-                ret.result = left ^ right;
-                break;
-            case ALU_NOT:
-                ret.result = ~left;
-                break;
+    // Host counters, sampled around single guest instructions
+    HostPerf hostPerf;
+    if (opts.hostperf) {
+        std::string why;
+        if (!hostPerf.open(opts.hostperfEvery, why)) {
+            std::cerr << "host counters unavailable (" << why << "), running without them\n";
         }
-        // Now that we have the result, determine the flags.
-        uint8_t sign_left = (left >> 63) & 1;
-        uint8_t sign_right = (right >> 63) & 1;
-        uint8_t sign_result = (ret.result >> 63) & 1;
-        ret.z = !ret.result;
-        ret.n = sign_result;
-        ret.v = (~sign_left & ~sign_right & sign_result) |
-                    (sign_left & sign_right & ~sign_result);
-        ret.c = (ret.result > left) || (ret.result > right);
-        return ret;
     }
 
-public:
-    Machine(char *mem, int size) {
-        mMemory = mem;
-        mMemorySize = size;
-        mPC = 0;
-        set_xreg(2, mMemorySize);
+    // Timing model, fed by every retired instruction
+    PipelineConfig pipelineConfig;
+    pipelineConfig.forwarding = !opts.noForwarding;
+    InOrderPipeline pipeline(pipelineConfig);
+    OooConfig oooConfig;
+    if (opts.oooConfig && !oooConfig.parse(opts.oooConfig)) {
+        std::cerr << "bad out-of-order configuration " << opts.oooConfig << '\n';
+        return -1;
     }
+    OutOfOrderCore ooo(oooConfig);
+    PipeOp pipeOp;
 
-    int64_t get_pc() const {
-        return mPC;
-    }
-    void set_pc(int64_t to) {
-        mPC = to;
+    // Caches, fed by every fetch, load and store
+    HierarchyConfig cacheConfig;
+    if (opts.cacheConfig && !cacheConfig.parse(opts.cacheConfig)) {
+        std::cerr << "bad cache configuration " << opts.cacheConfig << '\n';
+        return -1;
     }
+    CacheHierarchy caches(cacheConfig);
 
-    int64_t get_xreg(int reg) const {
-        reg &= 0x1f; // Make sure the register number is 0 - 31
-        return mRegs[reg];
+    // Branch predictors, run side by side on every control transfer
+    BranchBench branches;
+    BranchEvent branchEvent;
+    BranchTraceWriter branchTrace;
+    bool predicting = opts.branch || opts.branchTrace;
+    if (opts.branch && !branches.add(opts.branchPredictors ? opts.branchPredictors : DEFAULT_PREDICTORS)) return -1;
+    if (opts.branchTrace && !branchTrace.open(opts.branchTrace, "rv64")) {
+        std::cerr << "cannot write branch trace to " << opts.branchTrace << '\n';
+        return -1;
     }
-    void set_xreg(int reg, int64_t value) {
-        reg &= 0x1f;
-        mRegs[reg] = value;
+
+    // Reuse distances and working sets of the data accesses
+    ReuseAnalyzer reuse(opts.reuseWindow);
+
+    // Basic-block vectors of the first run, for SimPoint
+    BbvCollector bbv(opts.simpointInterval);
+    bool collecting = opts.bbv || opts.simpoint;
+
+    // Metrics: a JSON summary at exit, and JSON lines every metricsEvery instructions
+    Metrics metrics;
+    bool counting = opts.metrics || opts.metricsLog;
+    FILE *metricsLog = nullptr;
+    if (opts.metricsLog && !(metricsLog = fopen(opts.metricsLog, "w"))) {
+        std::cerr << "cannot write metrics to " << opts.metricsLog << '\n';
+        return -1;
     }
 
-    void fetch() {
-        mFO.instruction = memory_read<uint32_t>(mPC);
-    }
-    void decode() {
-        uint8_t opcode_map_row = (mFO.instruction >> 5) & 3;
-        uint8_t opcode_map_col = (mFO.instruction >> 2) & 7;
-        uint8_t inst_size      = mFO.instruction & 3;
-        if (inst_size != 3) {
-            cerr << "[DECODE] Invalid instruction (not a 32-bit instruction).\n";
-            return;
-        }
-        mDO.op = OPCODE_MAP[opcode_map_row][opcode_map_col];
-        // Decode the rest of mDO based on the instruction type
-        switch (mDO.op) {
-            case LOAD:
-            case JALR:
-            case OP_IMM:
-            case OP_IMM_32:
-            case SYSTEM:
-                decode_i();
-                break;
-            case STORE:
-                decode_s();
-                break;
-            case BRANCH:
-                decode_b();
-                break;
-            case JAL:
-                decode_j();
-                break;
-            case AUIPC:
-            case LUI:
-                decode_u();
-                break;
-            case OP:
-            case OP_32:
-                decode_r();
-                break;
-            default:
-                cerr << "Invalid op type: " << mDO.op << '\n';
-                break;
+    // Everything above is fed only inside the detail window
+    DetailWindow window(opts.skip, opts.detail, opts.startPc, opts.marker, opts.exitAfter);
+
+    Machine::Snapshot start;
+    if (opts.runs > 1 || opts.simpoint) mach.snapshot(start);
+
+    // A debugger drives the guest until it detaches; the loop below runs
+    // whatever is left. If it kills the guest instead, nothing is left but
+    // the reports.
+    bool killed = false;
+    if (opts.gdb) {
+        GdbServer gdb;
+        if (!gdb.listen(opts.gdb)) {
+            std::cerr << "cannot listen for gdb on " << opts.gdb << '\n';
+            return -1;
         }
+        std::cerr << "waiting for gdb on " << opts.gdb << '\n';
+        GdbMachine target(mach, mem, size, opts.predecode ? predecode.data() : nullptr);
+        killed = !gdb.serve(target);
     }
-    void execute() {
-        AluCommands cmd;
-        // Most instructions will follow left/right
-        // but some won't, so we need these:
-        int64_t op_left = mDO.left_val;
-        int64_t op_right = mDO.right_val; 
 
-        if (mDO.op == BRANCH) { // 11000
-            // A branch needs to subtract the operands
-            cmd = ALU_SUB;
+    uint64_t detailed = 0; // Instructions retired inside the detail window, over every run
+    for (long run = 0; run < opts.runs && !killed; run++) {
+        if (run > 0) {
+            mach.restore(start);
+            profiler.restart();
+            window.restart();
         }
-        else if (mDO.op == LOAD || mDO.op == STORE) { // 00000 | 01000
-            // For loads and stores, we need to add the
-            // offset with the base register.
-            cmd = ALU_ADD; // LB/LH/LW/LD or SB/SH/SW/SD
-        }
-        else if (mDO.op == OP) { // 01100
-            // We can't tell which ALU command to use until
-            // we read the funct3 and funct7
-            switch (mDO.funct3) {
-                case 0b000: // ADD or SUB
-                    if (mDO.funct7 == 0) cmd = ALU_ADD; // ADD
-                    else if (mDO.funct7 == 32) cmd = ALU_SUB; // SUB
-                    else if (mDO.funct7 == 1) cmd = ALU_MUL; // MUL
-                break;
-                // Finish the rest of the OP functions here.
-                case 0b001:
-                    cmd = ALU_SLL; // SLL
-                    break;
-                case 0b100:
-                    if (mDO.funct7 == 0) cmd = ALU_XOR; // XOR
-                    else if (mDO.funct7 == 1) cmd = ALU_DIV; // DIV
-                    break;
-                case 0b101:
-                    if (mDO.funct7 == 0) cmd = ALU_SRL; // SRL
-                    else if (mDO.funct7 == 32) cmd = ALU_SRA; // SRA
-                    break;
-                case 0b110:
-                    if (mDO.funct3 == 0) cmd = ALU_OR; // OR
-                    else if (mDO.funct7 == 1) cmd = ALU_REM; // REM
-                    break;
-                case 0b111:
-                    cmd = ALU_AND; // AND
-                    break;
+        uint64_t nextDigest = (digestOut && opts.digestEvery > 0) ? mach.retired() + opts.digestEvery : UINT64_MAX;
+        uint64_t nextMetrics = (metricsLog && opts.metricsEvery > 0) ? metrics.retired + opts.metricsEvery : UINT64_MAX;
+        uint64_t runStart = mach.retired();
+        hostPerf.start_loop(mach.retired());
+        while (!mach.halted() && mach.get_pc() < size) {
+            int64_t pc = mach.get_pc();
+            if (!window.before(pc, mach.retired(), runStart)) {
+                metrics.stop();
+                mach.step(); // Fast-forward
+                window.after(mach.marker(), mach.retired(), runStart);
+                if (mach.retired() == nextDigest) {
+                    write_digest();
+                    nextDigest += opts.digestEvery;
+                }
+                continue;
             }
-        }
-        else if (mDO.op == OP_32) { // 01110
-            op_left = sign_extend(op_left, 31);
-            op_right = sign_extend(op_right, 31);
-            // You still need to determine the ALU command
-            switch (mDO.funct3) {
-                case 0b000:
-                    if (mDO.funct7 == 0) cmd = ALU_ADD; // ADDW
-                    else if (mDO.funct7 == 32) cmd = ALU_SUB; // SUBW
-                    else if (mDO.funct7 == 1) cmd = ALU_MUL; // MULW
-                    break;
-                case 0b101: // DIVUW
-                    if (mDO.funct7 == 0) cmd = ALU_SRL; // SRLW
-                    else if (mDO.funct7 == 32) cmd = ALU_SRA; // SRAW
-                    else if (mDO.funct7 == 1) cmd = ALU_DIV; // DIVUW
-                    break;
-                case 0b001:
-                    cmd = ALU_SLL;
-                    break;
-                case 0b100:
-                    if (mDO.funct7 == 1) cmd = ALU_DIV; // DIVW
-                    break;
-                case 0b110:
-                    if (mDO.funct7 == 1) cmd = ALU_REM; // REMW
-                    break;
-                case 0b111:
-                    if (mDO.funct7 == 1) cmd = ALU_REM; // REMUW
-                    break;
+            metrics.start();
+            bool sampled = hostPerf.sample();
+            if (sampled) hostPerf.begin();
+            if (opts.debug) debug_stages(mach);
+            else {
+                mach.fetch();
+                mach.decode();
+                mach.execute();
+                mach.memory();
+                mach.writeback();
             }
-        }
-        else if (mDO.op == OP_IMM) { // 00100
-            // Look and see which ALU op needs to be executed.
-            switch (mDO.funct3){
-                case 0b000:
-                    cmd = ALU_ADD; // ADDI
-                    break;
-                case 0b100: // XORI
-                    cmd = ALU_XOR;
-                    break;
-                case 0b110:
-                    cmd = ALU_OR; // ORI
-                    break;
-                case 0b111:
-                    cmd = ALU_AND; // ANDI
-                    break;
-                case 0b001:
-                    cmd = ALU_SLL; // SLLI
-                    break;
-                case 0b101:
-                    if (mDO.funct7 == 0) cmd = ALU_SRL; // SRLI
-                    else if (mDO.funct7 == 32) cmd = ALU_SRA; // SRAI
-                    break;
+            detailed++;
+            if (sampled) hostPerf.end(mach.category());
+            if (trace.is_open() || textTrace.is_open()) {
+                mach.trace(record, pc);
+                if (trace.is_open()) trace.write(record);
+                if (textTrace.is_open()) textTrace.write(record, [&](char *out) { return disassemble(out, record.instruction, pc); });
             }
-        }
-        else if (mDO.op == OP_IMM_32) { // 00110
-            op_left = sign_extend(op_left, 31);
-            op_right = sign_extend(op_right, 31);
-            // This is just like OP_IMM except we truncated
-            // the left and right ops.
-            switch (mDO.funct3){
-                case 0b000:
-                    cmd = ALU_ADD; // ADDIW
-                    break;
-                case 0b001:
-                    cmd = ALU_SLL; // SLLIW
-                    break;
-                case 0b101:
-                    if (mDO.funct7 == 0) cmd = ALU_SRL; // SRLIW
-                    else if (mDO.funct7 == 32) cmd = ALU_SRA; // SRAIW
-                    break;
+            if (opts.profile || opts.folded) mach.profile(profiler, pc);
+            if (opts.pipeline || opts.ooo) {
+                mach.timing(pipeOp, pc);
+                if (opts.pipeline) pipeline.retire(pipeOp);
+                if (opts.ooo) ooo.retire(pipeOp);
             }
+            if (opts.cache) mach.cache(caches, pc);
+            if (opts.reuse || opts.reuseCurve) mach.reuse(reuse);
+            if (collecting && run == 0) mach.block(bbv, pc);
+            if (predicting && mach.branch(branchEvent, pc)) {
+                if (opts.branch) branches.resolve(branchEvent);
+                if (branchTrace.is_open()) branchTrace.write(branchEvent, detailed);
+            }
+            if (counting) {
+                mach.count(metrics, pc);
+                if (metrics.retired == nextMetrics) {
+                    metrics.write_snapshot(metricsLog);
+                    nextMetrics += opts.metricsEvery;
+                }
+            }
+            window.after(mach.marker(), mach.retired(), runStart);
+            if (mach.retired() == nextDigest) {
+                write_digest();
+                nextDigest += opts.digestEvery;
+            }
+            if (window.done()) break;
         }
-        else if (mDO.op == JALR) { // 11001
-            // JALR has an offset and a register value that
-            // need to be added together.
-            cmd = ALU_ADD; // JALR
-        }
-        else if (mDO.op == LUI) { // 01101
-            cmd = ALU_ADD;
-            
-        } 
-        else if (mDO.op == AUIPC) { // 00101
-            cmd = ALU_ADD; 
-            op_left = get_pc();
-        }
-        else if (mDO.op == JAL) { // 11011
-            cmd = ALU_ADD; // JAL
-            op_left = get_pc();
-            // op_right = OFFSET
-        }
-        else if (mDO.op == SYSTEM){ // 11100
-            cmd = ALU_ADD; // ECALL
+        hostPerf.stop_loop(mach.retired());
+        if (run == 0) bbv.close_interval();
+        if (digestOut) write_digest();
+        if (window.done()) break;
+    }
+    metrics.stop();
+    if (digestOut) fclose(digestOut);
+    trace.close();
+    if (!textTrace.close()) std::cerr << "cannot write text trace to " << opts.textTrace << '\n';
+    if (opts.pipeline) {
+        FILE *out = fopen(opts.pipeline, "w");
+        if (out) {
+            pipeline.report(out);
+            fclose(out);
         }
-        // No-op does not assign a command
-        mEO = alu(cmd, op_left, op_right);
-    }    
-    void memory() {
-        if (mDO.op == STORE) {
-            switch (mDO.funct3) {
-                case 0b000: // SB
-                    memory_write<uint8_t>(mEO.result, mDO.right_val);
-                    break;
-                // Finish here
-                case 0b001: // SH
-                    memory_write<uint32_t>(mEO.result, mDO.right_val);
-                    break;
-                case 0b010: // SW
-                    memory_write<uint8_t>(mEO.result, mDO.right_val);
-                    break;
-                case 0b011: // SD
-                    memory_write<uint64_t>(mEO.result, mDO.right_val);
-                    break;
-                default:
-                    cerr << "[MEMORY: STORE]: Invalid funct3: " << mDO.funct3 << '\n';
-                break;
-            }
+        else std::cerr << "cannot write pipeline report to " << opts.pipeline << '\n';
+    }
+    if (opts.ooo) {
+        FILE *out = fopen(opts.ooo, "w");
+        if (out) {
+            ooo.report(out, 20);
+            fclose(out);
         }
-        else if (mDO.op == LOAD) {
-            switch (mDO.funct3) {
-                case 0b000: // LB
-                    mMO.value = memory_read<int8_t>(mEO.result);
-                    break;
-                // Finish here
-                case 0b001: // LH
-                    mMO.value = memory_read<int16_t>(mEO.result);
-                    break;
-                case 0b010: // LW
-                    mMO.value = memory_read<int32_t>(mEO.result);
-                    break;
-                case 0b100: // LBU
-                    mMO.value = memory_read<uint8_t>(mEO.result);
-                    break;
-                case 0b101: // LHU
-                    mMO.value = memory_read<uint16_t>(mEO.result);
-                    break;
-                case 0b110: // LWU
-                    mMO.value = memory_read<uint32_t>(mEO.result);
-                    break;
-                case 0b011: // LD
-                    mMO.value = memory_read<int64_t>(mEO.result);
-                    break;
-                default:
-                    cerr << "[MEMORY: LOAD]: Invalid funct3: " << mDO.funct3 << '\n';
-                break;
-            }
+        else std::cerr << "cannot write out-of-order report to " << opts.ooo << '\n';
+    }
+    if (!branchTrace.close(detailed)) std::cerr << "cannot write branch trace to " << opts.branchTrace << '\n';
+    if (opts.branch) {
+        FILE *out = fopen(opts.branch, "w");
+        if (out) {
+            branches.report(out, detailed, 20);
+            fclose(out);
         }
-        else {
-            // If this is not a LOAD or STORE, then this stage just copies
-            // the ALU result.
-            mMO.value = mEO.result;
+        else std::cerr << "cannot write branch report to " << opts.branch << '\n';
+    }
+    if (opts.reuse) {
+        FILE *out = fopen(opts.reuse, "w");
+        if (out) {
+            reuse.report(out);
+            fclose(out);
         }
+        else std::cerr << "cannot write reuse report to " << opts.reuse << '\n';
     }
-    void writeback(){
-        int64_t system_number = get_xreg(17); // get system number from a7
-        switch(mDO.op){
-            case SYSTEM: // ECALL Instruction (SYSTEM Opcode) - System call
-                switch (system_number){
-                    case 0: 
-                        exit(0);
-                        break;
-                    case 1:
-                        set_xreg( 10, (getchar() & 0xff) ); // Get char from a0
-                        break;
-                    case 2:
-                        putchar( (char) get_xreg(10) ); // Prints char to the screen
-                        break;
-                }
-                set_pc(get_pc() + 4); 
-                break;
-            case BRANCH: 
-                switch(mDO.funct3){
-                    case 0b000: // BEQ 
-                        if (mEO.z) set_pc(get_pc() + mDO.offset); // Takes the PC and adds the offset if condition is true
-                        else set_pc(get_pc() + 4);  
-                        break;
-                    case 0b001: // BNE
-                        if (!(mEO.z)) set_pc(get_pc() + mDO.offset); // Takes the PC and adds the offset if condition is true
-                        else set_pc(get_pc() + 4);  
-                        break;
-                    case 0b100: // BLT
-                        if (mEO.n) set_pc(get_pc() + mDO.offset);
-                        else set_pc(get_pc() + 4);  
-                        break;
-                    case 0b101: // BGE
-                        if (mEO.c) set_pc(get_pc() + mDO.offset);
-                        else set_pc(get_pc() + 4);  
-                        break;
-                }
-                break;
-            case JAL:
-                set_xreg(mDO.rd, get_pc()+4); // x[rd] = pc+4
-                set_pc(mMO.value); // pc += sext(offset)
-                break;
-            case JALR:
-                set_xreg(mDO.rd, get_pc()+4); // x[rd]=pc+4
-                set_pc( mMO.value ); // pc=(x[rs1]+sext(offset))&∼1
-                break;
-            default:
-                set_xreg(mDO.rd, mMO.value);
-                set_pc(get_pc() + 4);
-                break;
+    if (opts.reuseCurve && !reuse.write_curve(opts.reuseCurve)) {
+        std::cerr << "cannot write miss-ratio curve to " << opts.reuseCurve << '\n';
+    }
+    if (opts.bbv && !bbv.write_bb(opts.bbv)) {
+        std::cerr << "cannot write basic-block vectors to " << opts.bbv << '\n';
+    }
+    if (opts.cache) {
+        FILE *out = fopen(opts.cache, "w");
+        if (out) {
+            caches.report(out, 20);
+            fclose(out);
         }
-        set_xreg(0, 0);     
+        else std::cerr << "cannot write cache report to " << opts.cache << '\n';
     }
-
-    FetchOut &debug_fetch_out() { 
-        return mFO; 
+    if (opts.hostperf && hostPerf.active()) {
+        FILE *out = fopen(opts.hostperf, "w");
+        if (out) {
+            hostPerf.report(out, [](int category) { return string(CATEGORY_NAMES[category]); });
+            fclose(out);
+        }
+        else std::cerr << "cannot write host counters to " << opts.hostperf << '\n';
     }
-    DecodeOut &debug_decode_out() { 
-        return mDO; 
+    if (metricsLog) fclose(metricsLog);
+    if (opts.metrics) {
+        FILE *out = fopen(opts.metrics, "w");
+        if (out) {
+            if (opts.pipeline) pipeline.count(metrics);
+            metrics.write_json(out, "rv64", [](int category) { return string(CATEGORY_NAMES[category]); });
+            fclose(out);
+        }
+        else std::cerr << "cannot write metrics to " << opts.metrics << '\n';
     }
-    ExecuteOut &debug_execute_out(){
-        return mEO;
+    if (opts.profile) {
+        FILE *out = fopen(opts.profile, "w");
+        if (out) {
+            profiler.report(out,
+                [&](uint64_t pc) { return disassemble(*reinterpret_cast<uint32_t*>(mem + pc), pc); },
+                [](int category) { return string(CATEGORY_NAMES[category]); }, 20);
+            fclose(out);
+        }
+        else std::cerr << "cannot write profile to " << opts.profile << '\n';
     }
-    MemoryOut &debug_memory_out(){
-        return mMO; 
+    if (opts.folded && !profiler.write_folded(opts.folded)) {
+        std::cerr << "cannot write folded stacks to " << opts.folded << '\n';
     }
-};
-
-int main(int argc, char *argv[]) {
-
-    // .... Code that error checks and reads the file ....
-    if(argc < 2){
-        std::cerr << "include file\n";
-        return -1; 
+    if (opts.coverage && !coverage.write(opts.coverage)) {
+        std::cerr << "cannot write coverage to " << opts.coverage << '\n';
     }
-
-    char* bin_file = argv[1];
-    std::ifstream ifs (bin_file, std::ios::binary);
-    if (!(ifs.is_open())){
-        std::cerr << "invalid file type\n";
-        return -1;
+    if (input.get_mode() == INPUT_REPLAY && !input.exhausted()) {
+        std::cerr << "[REPLAY] Run ended with unconsumed events in the log\n";
     }
 
-    // Seek to end of file, get length, then return back to top
-    ifs.seekg (0, ifs.end);
-    int size = ifs.tellg();
-    if (size % 4 != 0){
-        std::cerr << "invalid file size\n";
-        return -1;
+    // Simulation points, then a second, silent pass from the start that
+    // saves a checkpoint where each chosen interval begins
+    if (opts.simpoint) {
+        SimPointPicker picker;
+        std::vector<SimPoint> points = picker.pick(bbv.intervals(), opts.simpointK);
+        string prefix = opts.simpoint;
+        if (!write_simpoints((prefix + ".simpoints").c_str(), (prefix + ".weights").c_str(), points)) {
+            std::cerr << "cannot write simulation points to " << prefix << ".simpoints\n";
+        }
+        const char *log = opts.replay ? opts.replay : opts.record;
+        InputLog again;
+        input.close();
+        if (log ? !again.replay(log) : input.consumed() > 0) {
+            std::cerr << "cannot checkpoint a guest that reads input without --record or --replay\n";
+        }
+        else {
+            mach.restore(start);
+            mach.set_input_log(&again);
+            mach.set_quiet(true);
+            Checkpoint ck;
+            for (const SimPoint &p : points) {
+                uint64_t at = bbv.intervals()[p.interval].start;
+                while (mach.retired() < at && !mach.halted() && mach.get_pc() < size) mach.step();
+                mach.checkpoint(ck, image.data());
+                string path = prefix + "." + to_string(p.interval) + ".ckpt";
+                if (!ck.write(path.c_str(), "rv64")) {
+                    std::cerr << "cannot write checkpoint to " << path << '\n';
+                    break;
+                }
+            }
+        }
     }
-    ifs.clear();
-    ifs.seekg (0, ifs.beg);
-    
-    // Allocate char* size of file
-    char* mem = new char[MEM_SIZE];
-    ifs.read(mem, size);
-
-    Machine mach(mem, MEM_SIZE);
-    while (mach.get_pc() < size) {
-        mach.fetch();
-        cout << mach.debug_fetch_out() << '\n';
-        mach.decode();
-        //cout << mach.debug_decode_out() << '\n';
-        mach.execute();
-        //cout << mach.debug_execute_out() << '\n';
-        mach.memory();
-        //cout << mach.debug_memory_out() << '\n';
-        mach.writeback();
-    }
-    delete[] mem;
+    munmap(mem, MEM_SIZE);
     ifs.close();
     return 0;
 }
-
-int64_t sign_extend(int64_t value, int8_t index) {
-    if ((value >> index) & 1) {
-        // Sign bit is 1
-        return value | (-1UL << index);
-    }
-    else {
-        // Sign bit is 0
-        return value & ~(-1UL << index);
-    }
-}
@@ -0,0 +1,190 @@
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "machine.h"
+
+// MAPPED FILE
+MappedFile::MappedFile() {
+    data = nullptr;
+    size = 0;
+}
+MappedFile::~MappedFile() {
+    if (data) munmap(const_cast<uint8_t*>(data), size);
+}
+bool MappedFile::open(const char *path) {
+    int fd = ::open(path, O_RDONLY);
+    if (fd < 0) return false;
+
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        close(fd);
+        return false;
+    }
+    size = st.st_size;
+    if (size > 0) {
+        void *map = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map == MAP_FAILED) {
+            close(fd);
+            size = 0;
+            return false;
+        }
+        data = static_cast<const uint8_t*>(map);
+    }
+    close(fd); // The mapping stays valid after the descriptor is closed
+    return true;
+}
+
+// BIOS
+Bios::Bios() {
+    keyPos = 0;
+    outLen = 0;
+    input = nullptr;
+}
+Bios::~Bios() {
+    flush();
+}
+bool Bios::open_disk(const char *path) {
+    return disk.open(path);
+}
+bool Bios::open_keyboard(const char *path) {
+    return keyboard.open(path);
+}
+// Replays the keyboard file from the start, for rerunning a program
+void Bios::rewind() {
+    keyPos = 0;
+}
+void Bios::set_input_log(InputLog *log) {
+    input = log;
+}
+
+// Copies the first sector of the disk to BOOT_ADDRESS and jumps to it,
+// returning the number of bytes loaded
+int Bios::boot(Machine &mach, char *memory) {
+    if (!disk.data) return -1;
+    int size = disk.size < (size_t)SECTOR_SIZE ? disk.size : SECTOR_SIZE;
+    memcpy(memory + BOOT_ADDRESS, disk.data, size);
+    mach.set_xreg(2, 0x0000); // DL - Boot drive
+    mach.set_pc(BOOT_ADDRESS);
+    return size;
+}
+
+void Bios::interrupt(Machine &mach, uint8_t vector) {
+    switch (vector) {
+        case 0x10:
+            video(mach);
+            break;
+        case 0x13:
+            disk_service(mach);
+            break;
+        case 0x16:
+            keyboard_service(mach);
+            break;
+    }
+}
+
+// OUTPUT
+void Bios::putc(char c) {
+    if (outLen == BIOS_OUT_SIZE) flush();
+    out[outLen++] = c;
+}
+void Bios::flush() {
+    if (outLen) fwrite(out, 1, outLen, stdout);
+    fflush(stdout);
+    outLen = 0;
+}
+
+// SERVICES
+
+// int 0x10
+void Bios::video(Machine &mach) {
+    int16_t ax = mach.get_xreg(0);
+    if (((ax >> 8) & 0xff) == 0x0e) { // Teletype output: AL = character
+        putc(ax & 0xff);
+    }
+}
+
+// int 0x13
+void Bios::disk_service(Machine &mach) {
+    uint16_t ax = mach.get_xreg(0);
+    uint16_t cx = mach.get_xreg(1);
+    uint16_t dx = mach.get_xreg(2);
+    uint16_t bx = mach.get_xreg(3);
+    uint8_t status = 0x00;
+
+    switch (ax >> 8) {
+        case 0x00: // Reset disk system
+            break;
+        case 0x02: { // Read sectors: AL = count, CH/CL = cylinder/sector, DH = head, BX = buffer
+            int count = ax & 0xff;
+            int sector = cx & 0x3f;
+            int cylinder = ((cx & 0xc0) << 2) | (cx >> 8);
+            int head = dx >> 8;
+            size_t lba = (cylinder * NUM_HEADS + head) * SECTORS_PER_TRACK + (sector - 1);
+            size_t offset = lba * SECTOR_SIZE;
+            size_t bytes = (size_t)count * SECTOR_SIZE;
+
+            if (!disk.data) {
+                status = 0x80; // Drive not ready
+            }
+            else if (sector == 0 || offset + bytes > disk.size || bx + bytes > MEM_SIZE) {
+                status = 0x04; // Sector not found
+            }
+            else {
+                memcpy(mach.memory + bx, disk.data + offset, bytes);
+                mach.written(bx, bytes);
+                mach.set_xreg(0, count); // AH = 0, AL = sectors read
+            }
+            break;
+        }
+        default:
+            status = 0x01; // Invalid command
+            break;
+    }
+
+    if (status) {
+        mach.set_xreg(0, (status << 8) | (ax & 0xff));
+        mach.set_carry_flag();
+    }
+    else {
+        mach.set_xreg(0, mach.get_xreg(0) & 0x00ff);
+        mach.unset_carry_flag();
+    }
+}
+
+// int 0x16
+// Keystrokes are -1 once the keyboard file runs out
+void Bios::keyboard_service(Machine &mach) {
+    uint16_t ax = mach.get_xreg(0);
+    bool waiting = keyboard.data && keyPos < keyboard.size;
+    int64_t key;
+
+    switch (ax >> 8) {
+        case 0x00: // Read keystroke: AL = ASCII, AH = scan code (not modeled)
+        case 0x10: {
+            auto live = [&]() -> int64_t { return waiting ? keyboard.data[keyPos++] : -1; };
+            key = input ? input->input(INPUT_KEY, mach.get_retired(), live) : live();
+            if (key < 0) {
+                // A real BIOS would block forever, so nothing else can happen
+                flush();
+                mach.halted = true;
+                break;
+            }
+            mach.set_xreg(0, key);
+            break;
+        }
+        case 0x01: // Check for keystroke: ZF = 0 if one is waiting
+        case 0x11: {
+            auto live = [&]() -> int64_t { return waiting ? keyboard.data[keyPos] : -1; };
+            key = input ? input->input(INPUT_KEY_PEEK, mach.get_retired(), live) : live();
+            if (key >= 0) {
+                mach.set_xreg(0, key);
+                mach.unset_zero_flag();
+            }
+            else mach.set_zero_flag();
+            break;
+        }
+    }
+}
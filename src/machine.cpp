@@ -1,317 +1,881 @@
-#include "machine.h"
-
-// MEMORY
-template<typename T>
-T Machine::memory_read(int16_t address) const {
-    return *reinterpret_cast<T*>(memory + address);
-}
-template<typename T>
-void Machine::memory_write(int16_t address, T value) {
-    *reinterpret_cast<T*>(memory + address) = value;
-}  
-int8_t Machine::next_byte() {
-    set_pc(get_pc() + 1);
-    return *reinterpret_cast<uint8_t*>(memory + get_pc());
-}
-void Machine::byte_to_word(int16_t *immediate){
-    *immediate = (*immediate) | (next_byte() << 8);
-}
-
-// CPU
-Machine::Machine(char *buffer, int size) {
-    memory = buffer;
-    memorySize = size;
-    programCounter = 0;
-}
-int16_t Machine::get_pc() const {
-    return programCounter;
-}
-void Machine::set_pc(int16_t new_PC) {
-    programCounter = new_PC;
-}
-int16_t Machine::get_xreg(int which) const {
-    which &= 0x1f; // Make sure the register number is 0 - 31
-    return registers[which];
-}
-void Machine::set_xreg(int which, int16_t value) {
-    which &= 0x1f;
-    registers[which] = value;
-}
-int16_t Machine::reg_to_register(uint16_t* reg){
-    switch (*reg){
-        case 0:     // al
-        case 4:     // ah
-        case 8:     // ax
-            return 0;
-        case 1:     // cl
-        case 5:     // ch
-        case 9:     // cx
-            return 1;
-        case 2:     // dl
-        case 6:     // dh
-        case 10:    // dx
-            return 2;
-        case 3:     // bl
-        case 7:     // bh
-        case 11:    // bx
-            return 3;
-    }
-    return 0;
-}
-
-// EFLAGS
-void Machine::set_carry_flag(){
-    registers[EFLAGS_REG] |= (1 << 0);
-}
-void Machine::set_zero_flag(){
-    registers[EFLAGS_REG] |= (1 << 6);
-}
-void Machine::set_sign_flag(){
-    registers[EFLAGS_REG] |= (1 << 7);
-}
-void Machine::unset_carry_flag(){
-    registers[EFLAGS_REG] &= ~(1 << 0);
-}
-void Machine::unset_zero_flag(){
-    registers[EFLAGS_REG] &= ~(1 << 6);
-}
-void Machine::unset_sign_flag(){
-    registers[EFLAGS_REG] &= ~(1 << 7);
-}
-bool Machine::check_carry_flag(){
-    return (registers[EFLAGS_REG] >> 0);
-}
-bool Machine::check_zero_flag(){
-    return (registers[EFLAGS_REG] >> 6);
-}
-bool Machine::check_sign_flag(){
-    return (registers[EFLAGS_REG] >> 7);
-}
-
-// INSTRUCTION CYCLE
-
-// FETCH
-void Machine::fetch() {
-    fetchObj.opcode = memory_read<uint8_t>(programCounter);
-}
-Machine::Fetch &Machine::debug_fetch_out() { 
-    return fetchObj; 
-}
-
-// DECODE
-void Machine::decode() {
-    if (fetchObj.opcode == 0x04) {                  // add al, imm8
-        decodeObj.instruction = "add";
-        decodeObj.rightOperand = decodeObj.immediate = next_byte();
-        decodeObj.reg = 0; // AL
-        decodeObj.regi = 0; // AX - registers[0]
-        decodeObj.leftOperand = (get_xreg(0) & 0xff); 
-    }
-    else if (fetchObj.opcode == 0x81) {             // add rw, imm16
-        decodeObj.instruction = "add";
-        decodeObj.reg = next_byte() - 0xc0 + 8;
-        decodeObj.regi = reg_to_register(&decodeObj.reg);
-        decodeObj.immediate = next_byte();
-        byte_to_word(&decodeObj.immediate);
-        decodeObj.leftOperand = get_xreg(decodeObj.regi);
-        decodeObj.rightOperand = decodeObj.immediate;
-    }
-    else if (fetchObj.opcode == 0x3c) {             // cmp al, imm16
-        decodeObj.instruction = "cmp";
-        decodeObj.reg = 0;
-        decodeObj.regi = reg_to_register(&decodeObj.reg);
-        decodeObj.immediate = next_byte();
-        decodeObj.leftOperand = (get_xreg(decodeObj.regi) & 0x00ff);   
-        decodeObj.rightOperand = decodeObj.immediate;
-    }
-    else if (fetchObj.opcode == 0xfe) {             // inc r8
-        decodeObj.instruction = "inc";
-        decodeObj.immediate = next_byte();
-        decodeObj.reg = decodeObj.immediate - 0xc0;
-        decodeObj.regi = reg_to_register(&decodeObj.reg);
-        switch (decodeObj.reg){
-            case 0x00: // Lower-Byte Registers
-            case 0x01:
-            case 0x02:
-            case 0x03:
-                decodeObj.leftOperand = get_xreg(decodeObj.regi) & 0xff; 
-                break;
-            case 0x04: // Upper-Byte Registers
-            case 0x05:
-            case 0x06:
-            case 0x07:
-                decodeObj.leftOperand = (get_xreg(decodeObj.regi) >> 8) & 0xff; 
-                break;
-        }
-        decodeObj.rightOperand = 1;
-    }
-    else if (fetchObj.opcode== 0xcd) {              // int imm8
-        decodeObj.instruction = "int";
-        decodeObj.reg = 16;
-        decodeObj.immediate = next_byte();      
-    }
-    else if (fetchObj.opcode == 0xeb) {             // jmp rel8
-        decodeObj.instruction = "jmp";
-        decodeObj.immediate = next_byte();
-        decodeObj.leftOperand = get_pc();
-        decodeObj.rightOperand = decodeObj.immediate;
-    }
-    else if (fetchObj.opcode == 0x74) {             // je imm8
-        decodeObj.instruction = "je";
-        decodeObj.reg = 16;
-        decodeObj.immediate = next_byte();
-        decodeObj.leftOperand = get_pc(); 
-        decodeObj.rightOperand = decodeObj.immediate;
-    }
-    else if (fetchObj.opcode == 0x8a){
-        decodeObj.instruction = "mov";              // mov rb, [m8]
-        decodeObj.immediate = next_byte();
-        switch (decodeObj.immediate % 8){
-            // [bx]
-            case 7:
-                decodeObj.reg = decodeObj.immediate % 7; 
-                decodeObj.immediate = memory_read<uint8_t>(get_xreg(3));
-                break;
-            // [si]
-            case 4:
-                decodeObj.reg = (decodeObj.immediate - 4) / 4 - 1;
-                break;
-        }
-        decodeObj.regi = reg_to_register(&decodeObj.reg);
-        decodeObj.leftOperand = get_xreg(decodeObj.regi) & 0x00ff;
-        decodeObj.rightOperand = decodeObj.immediate;
-    }
-    else if ( (fetchObj.opcode & 0x40) == 0x40) {   // inc rw
-        decodeObj.instruction = "inc";
-        decodeObj.immediate = fetchObj.opcode - 0x40;
-        fetchObj.opcode &= 0x40;
-        decodeObj.regi = decodeObj.immediate;
-        decodeObj.reg = decodeObj.regi + 8;
-        decodeObj.leftOperand = get_xreg(decodeObj.regi);
-        decodeObj.rightOperand = 1;
-    }
-    else if ((fetchObj.opcode & 0xb0) == 0xb0) {   // mov rb, imm16
-        decodeObj.reg = fetchObj.opcode - 0xb0;     
-        fetchObj.opcode &= 0xb0;
-        decodeObj.instruction = "mov";
-        decodeObj.immediate = next_byte();
-        if (decodeObj.reg > 7){                    // mov rw, rw
-            byte_to_word(&decodeObj.immediate);
-        }
-        decodeObj.regi = reg_to_register(&decodeObj.reg);
-        decodeObj.leftOperand = (get_xreg(decodeObj.regi) >> 8);
-        decodeObj.rightOperand = decodeObj.immediate;
-    }
-}
-Machine::Decode &Machine::debug_decode_out() { 
-    return decodeObj; 
-}
-
-// EXECUTE
-void Machine::execute() {
-    switch (fetchObj.opcode){
-        case 0x81:      // add rw, imm16
-            executeObj.result = decodeObj.leftOperand + decodeObj.rightOperand;
-            break;
-        case 0xfe:      // inc rb
-            executeObj.result = decodeObj.leftOperand + decodeObj.rightOperand;
-            if (executeObj.result > SHRT_MAX) {
-                set_carry_flag();
-            }
-            break;
-        case 0x40:
-            executeObj.result = decodeObj.leftOperand + decodeObj.rightOperand;
-            if (executeObj.result > SHRT_MAX) {
-                set_carry_flag();
-            }
-            break;
-        case 0x3c:      // cmp al, imm16
-            executeObj.result = decodeObj.leftOperand - decodeObj.rightOperand;
-            break;
-        case 0xeb:      // jmp rel8
-            executeObj.result = decodeObj.leftOperand + decodeObj.rightOperand;
-            break;
-        case 0x74:      // je imm8
-            executeObj.result = decodeObj.leftOperand + decodeObj.rightOperand;
-            break;
-        case 0xb0:      // mov rb, imm8
-            executeObj.result = decodeObj.immediate;
-            break;
-        case 0x8a:
-            executeObj.result = decodeObj.immediate;
-            break;
-    }
-}
-Machine::Execute &Machine::debug_execute_out() { 
-    return executeObj; 
-}
-
-// // MEMORY
-// void Machine::memory_access() {
-// }
-// Machine::Memory &Machine::debug_memory_out() { 
-//     return memoryObj; 
-// }
-
-// WRITEBACK
-void Machine::write_back() {
-    switch (fetchObj.opcode) {
-        case 0x81:      // add rw, imm16
-            set_xreg(decodeObj.reg, executeObj.result);
-            break;
-        case 0x3c:      // cmp al, imm16
-            if (executeObj.result == 0) set_zero_flag();
-            else if (executeObj.result < 0) set_sign_flag();
-            else set_carry_flag();
-            break;
-        case 0xfe:      // inc rb
-            set_xreg(decodeObj.reg, executeObj.result); 
-            break;
-        case 0x40:      // inc rw
-            set_xreg(decodeObj.regi, executeObj.result);
-            break;
-        case 0xcd:      // int imm8
-            if (decodeObj.immediate == 0x10) { 
-                if ( (get_xreg(decodeObj.regi) >> 8) == 0x0e ) {
-                    putchar( (get_xreg(decodeObj.regi) & 0xff) );
-                }
-            }
-            break;
-        case 0xeb:      // jmp rel8
-            set_pc(executeObj.result);
-            break;
-        case 0x74:      // je imm8
-            if (check_zero_flag()) set_pc(executeObj.result);
-            break;
-        case 0x8a:      // mov rb, m8
-            set_xreg(decodeObj.regi, 
-                            (get_xreg(decodeObj.regi) & 0xff00)
-                            | decodeObj.immediate);
-            break;
-        case 0xb0:      // mov rb, imm8
-            if (decodeObj.reg > 7){ // 16-Bit Immediate
-                set_xreg(decodeObj.regi, executeObj.result);
-            }
-            else{
-                switch (decodeObj.reg){
-                case 0: // Lower 8-Bit Registers
-                case 1:
-                case 2:
-                case 3:
-                    set_xreg(decodeObj.regi, 
-                            (get_xreg(decodeObj.regi) & 0xff00)
-                            | executeObj.result);
-                    break;
-                case 4: // Upper 8-Bit Registers
-                case 5:
-                case 6:
-                case 7:
-                    set_xreg(decodeObj.regi, 
-                            (get_xreg(decodeObj.regi) & 0x00ff)
-                            | (executeObj.result << 8));
-                    break;
-                }
-            }
-            break;
-    }
-}
\ No newline at end of file
+#include <algorithm>
+#include <cstring>
+#include "machine.h"
+
+// MEMORY
+template<typename T>
+T Machine::memory_read(int16_t address) const {
+    return *reinterpret_cast<T*>(memory + address);
+}
+template<typename T>
+void Machine::memory_write(int16_t address, T value) {
+    *reinterpret_cast<T*>(memory + address) = value;
+    written(address, sizeof(T));
+}  
+int8_t Machine::next_byte() {
+    set_pc(get_pc() + 1);
+    return *reinterpret_cast<uint8_t*>(memory + get_pc());
+}
+void Machine::byte_to_word(int16_t *immediate){
+    *immediate = ((*immediate) & 0xff) | (next_byte() << 8);
+}
+
+// CPU
+Machine::Machine(char *buffer, int size) {
+    memory = buffer;
+    memorySize = size;
+    programCounter = 0;
+    bios = nullptr;
+    halted = false;
+    retired = 0;
+    coverage = nullptr;
+    digest = nullptr;
+    predecoded = nullptr;
+    codeStart = codeEnd = 0;
+    breakHit = false;
+    dirty.resize(size);
+    memset(registers, 0, sizeof(registers));
+}
+int16_t Machine::get_pc() const {
+    return programCounter;
+}
+void Machine::set_pc(int16_t new_PC) {
+    programCounter = new_PC;
+}
+int16_t Machine::get_xreg(int which) const {
+    which &= 0x1f; // Make sure the register number is 0 - 31
+    return registers[which];
+}
+void Machine::set_xreg(int which, int16_t value) {
+    which &= 0x1f;
+    registers[which] = value;
+}
+void Machine::set_bios(Bios *services) {
+    bios = services;
+}
+void Machine::set_coverage(EdgeCoverage *cov) {
+    coverage = cov;
+}
+void Machine::set_digest(StateDigest *dig) {
+    digest = dig;
+    digest->attach(memory, memorySize);
+}
+// Hash of the registers, PC and memory (needs set_digest)
+uint64_t Machine::state_digest() {
+    return digest->state(registers, sizeof(registers), programCounter);
+}
+// Every write to guest memory reports here, the debugger's included
+void Machine::written(uint16_t address, size_t size) {
+    dirty.mark_range(address, size);
+    if (digest) digest->touch(address, size);
+    if (predecoded && address < codeEnd && address + size > (size_t)codeStart) code_written(address, size);
+}
+// Self-modifying code: every record whose instruction covers a written byte
+// goes back to the slow path. Breakpoints stay set.
+void Machine::code_written(int address, size_t size) {
+    int last = std::min<int>(address + size, codeEnd);
+    for (int at = std::max(address - MAX_INSTRUCTION_LENGTH + 1, codeStart); at < last; at++) {
+        Predecoded &pd = predecoded[at - codeStart];
+        if (at + pd.length >= address) pd.flags &= ~(PREDECODE_VALID | PREDECODE_PARKED);
+    }
+}
+bool Machine::is_halted() const {
+    return halted;
+}
+uint64_t Machine::get_retired() const {
+    return retired;
+}
+// Opcode of the current instruction as execute() and write_back() see it
+int Machine::get_category() const {
+    return fetchObj.opcode & 0xff;
+}
+// Captures registers, PC and memory, and starts tracking dirty pages
+void Machine::snapshot(Snapshot &snap) {
+    snap.programCounter = programCounter;
+    memcpy(snap.registers, registers, sizeof(registers));
+    snap.halted = halted;
+    snap.retired = retired;
+    snap.memory.assign(memory, memory + memorySize);
+    dirty.clear();
+}
+// Rewinds to the most recent snapshot, copying back only the dirty pages
+void Machine::restore(const Snapshot &snap) {
+    for (uint32_t page : dirty.pages()) {
+        size_t offset = (size_t)page << PAGE_SHIFT;
+        memcpy(memory + offset, snap.memory.data() + offset, PAGE_SIZE);
+        if (digest) digest->touch(offset, PAGE_SIZE);
+    }
+    dirty.clear();
+    programCounter = snap.programCounter;
+    memcpy(registers, snap.registers, sizeof(registers));
+    halted = snap.halted;
+    retired = snap.retired;
+}
+int16_t Machine::reg_to_register(uint16_t* reg){
+    switch (*reg){
+        case 0:     // al
+        case 4:     // ah
+        case 8:     // ax
+            return 0;
+        case 1:     // cl
+        case 5:     // ch
+        case 9:     // cx
+            return 1;
+        case 2:     // dl
+        case 6:     // dh
+        case 10:    // dx
+            return 2;
+        case 3:     // bl
+        case 7:     // bh
+        case 11:    // bx
+            return 3;
+        case 12:    // sp
+        case 13:    // bp
+        case 14:    // si
+        case 15:    // di
+            return *reg - 8;
+    }
+    return 0;
+}
+
+// EFLAGS
+void Machine::set_carry_flag(){
+    registers[EFLAGS_REG] |= (1 << 0);
+}
+void Machine::set_zero_flag(){
+    registers[EFLAGS_REG] |= (1 << 6);
+}
+void Machine::set_sign_flag(){
+    registers[EFLAGS_REG] |= (1 << 7);
+}
+void Machine::set_direction_flag(){
+    registers[EFLAGS_REG] |= (1 << 10);
+}
+void Machine::unset_carry_flag(){
+    registers[EFLAGS_REG] &= ~(1 << 0);
+}
+void Machine::unset_zero_flag(){
+    registers[EFLAGS_REG] &= ~(1 << 6);
+}
+void Machine::unset_sign_flag(){
+    registers[EFLAGS_REG] &= ~(1 << 7);
+}
+void Machine::unset_direction_flag(){
+    registers[EFLAGS_REG] &= ~(1 << 10);
+}
+bool Machine::check_carry_flag(){
+    return (registers[EFLAGS_REG] >> 0) & 1;
+}
+bool Machine::check_zero_flag(){
+    return (registers[EFLAGS_REG] >> 6) & 1;
+}
+bool Machine::check_sign_flag(){
+    return (registers[EFLAGS_REG] >> 7) & 1;
+}
+bool Machine::check_direction_flag(){
+    return (registers[EFLAGS_REG] >> 10) & 1;
+}
+// Flags for left - right on size-byte operands (cmps)
+void Machine::set_compare_flags(uint16_t left, uint16_t right, int size){
+    uint16_t sign = size == 1 ? 0x80 : 0x8000;
+    unset_zero_flag();
+    unset_sign_flag();
+    unset_carry_flag();
+    if (left == right) set_zero_flag();
+    if ((uint16_t)(left - right) & sign) set_sign_flag();
+    if (left < right) set_carry_flag();
+}
+
+// INSTRUCTION CYCLE
+
+// FETCH
+void Machine::fetch() {
+    fetchObj.opcode = memory_read<uint8_t>(programCounter);
+}
+Machine::Fetch &Machine::debug_fetch_out() { 
+    return fetchObj; 
+}
+
+// DECODE
+void Machine::decode() {
+    uint16_t pc = get_pc();
+    const Predecoded *record = (predecoded && pc >= codeStart && pc < codeEnd) ? &predecoded[pc - codeStart] : nullptr;
+    if (record && (record->flags & PREDECODE_VALID)) {
+        const Predecoded &pd = *record;
+        fetchObj.opcode = pd.opcode;
+        decodeObj.instruction = pd.instruction;
+        decodeObj.rep = pd.rep;
+        decodeObj.reg = pd.reg;
+        decodeObj.regi = pd.regi;
+        decodeObj.immediate = pd.immediate;
+        set_pc(pc + pd.length);
+    }
+    else {
+        if (record && (record->flags & PREDECODE_BREAK)) breakHit = true;
+        decode_fields();
+    }
+    decodeObj.length = (uint16_t)get_pc() - pc + 1;
+    decode_operands();
+}
+// Everything that depends only on the instruction bytes; false if the
+// opcode is not one this core knows
+bool Machine::decode_fields() {
+    decodeObj.rep = 0;
+    if (fetchObj.opcode == 0xf3 || fetchObj.opcode == 0xf2) { // rep/repe, repne prefix
+        decodeObj.rep = fetchObj.opcode;
+        fetchObj.opcode = next_byte() & 0xff;
+    }
+    if (fetchObj.opcode == 0x04) {                  // add al, imm8
+        decodeObj.instruction = "add";
+        decodeObj.immediate = next_byte();
+        decodeObj.reg = 0; // AL
+        decodeObj.regi = 0; // AX - registers[0]
+    }
+    else if (fetchObj.opcode == 0x81) {             // add rw, imm16
+        decodeObj.instruction = "add";
+        decodeObj.reg = next_byte() - 0xc0 + 8;
+        decodeObj.regi = reg_to_register(&decodeObj.reg);
+        decodeObj.immediate = next_byte();
+        byte_to_word(&decodeObj.immediate);
+    }
+    else if (fetchObj.opcode == 0x3c) {             // cmp al, imm16
+        decodeObj.instruction = "cmp";
+        decodeObj.reg = 0;
+        decodeObj.regi = reg_to_register(&decodeObj.reg);
+        decodeObj.immediate = next_byte();
+    }
+    else if (fetchObj.opcode == 0xfe) {             // inc r8
+        decodeObj.instruction = "inc";
+        decodeObj.immediate = next_byte();
+        decodeObj.reg = decodeObj.immediate - 0xc0;
+        decodeObj.regi = reg_to_register(&decodeObj.reg);
+    }
+    else if (fetchObj.opcode== 0xcd) {              // int imm8
+        decodeObj.instruction = "int";
+        decodeObj.reg = 16;
+        decodeObj.immediate = next_byte();      
+    }
+    else if (fetchObj.opcode == 0xeb) {             // jmp rel8
+        decodeObj.instruction = "jmp";
+        decodeObj.immediate = next_byte();
+    }
+    else if (fetchObj.opcode == 0x74) {             // je imm8
+        decodeObj.instruction = "je";
+        decodeObj.reg = 16;
+        decodeObj.immediate = next_byte();
+    }
+    else if (fetchObj.opcode == 0xf4) {             // hlt
+        decodeObj.instruction = "hlt";
+        decodeObj.reg = 16;
+    }
+    else if (fetchObj.opcode == 0xfc || fetchObj.opcode == 0xfd) { // cld, std
+        decodeObj.instruction = fetchObj.opcode == 0xfc ? "cld" : "std";
+        decodeObj.reg = 16;
+    }
+    else if (fetchObj.opcode == 0xa4 || fetchObj.opcode == 0xa5) { // movsb, movsw
+        decodeObj.instruction = fetchObj.opcode == 0xa4 ? "movsb" : "movsw";
+        decodeObj.reg = 16;
+    }
+    else if (fetchObj.opcode == 0xaa || fetchObj.opcode == 0xab) { // stosb, stosw
+        decodeObj.instruction = fetchObj.opcode == 0xaa ? "stosb" : "stosw";
+        decodeObj.reg = 16;
+    }
+    else if (fetchObj.opcode == 0xa6 || fetchObj.opcode == 0xa7) { // cmpsb, cmpsw
+        decodeObj.instruction = fetchObj.opcode == 0xa6 ? "cmpsb" : "cmpsw";
+        decodeObj.reg = 16;
+    }
+    else if (fetchObj.opcode == 0x8a){
+        decodeObj.instruction = "mov";              // mov rb, [m8]
+        decodeObj.immediate = next_byte();
+        switch (decodeObj.immediate % 8){
+            // [bx], read by decode_operands()
+            case 7:
+                decodeObj.reg = decodeObj.immediate % 7; 
+                break;
+            // [si]
+            case 4:
+                decodeObj.reg = (decodeObj.immediate - 4) / 4 - 1;
+                break;
+        }
+        decodeObj.regi = reg_to_register(&decodeObj.reg);
+    }
+    else if ( (fetchObj.opcode & 0x40) == 0x40) {   // inc rw
+        decodeObj.instruction = "inc";
+        decodeObj.immediate = fetchObj.opcode - 0x40;
+        fetchObj.opcode &= 0x40;
+        decodeObj.regi = decodeObj.immediate;
+        decodeObj.reg = decodeObj.regi + 8;
+    }
+    else if ((fetchObj.opcode & 0xb0) == 0xb0) {   // mov rb, imm16
+        decodeObj.reg = fetchObj.opcode - 0xb0;     
+        fetchObj.opcode &= 0xb0;
+        decodeObj.instruction = "mov";
+        decodeObj.immediate = next_byte();
+        if (decodeObj.reg > 7){                    // mov rw, rw
+            byte_to_word(&decodeObj.immediate);
+        }
+        decodeObj.regi = reg_to_register(&decodeObj.reg);
+    }
+    else return false;
+    if (decodeObj.rep) {
+        decodeObj.instruction.insert(0, decodeObj.rep == 0xf3 ? "rep " : "repne ");
+    }
+    return true;
+}
+// Operands that depend on registers and memory
+void Machine::decode_operands() {
+    switch (fetchObj.opcode) {
+        case 0x04:      // add al, imm8
+            decodeObj.leftOperand = (get_xreg(0) & 0xff); 
+            decodeObj.rightOperand = decodeObj.immediate;
+            break;
+        case 0x81:      // add rw, imm16
+            decodeObj.leftOperand = get_xreg(decodeObj.regi);
+            decodeObj.rightOperand = decodeObj.immediate;
+            break;
+        case 0x3c:      // cmp al, imm16
+            decodeObj.leftOperand = (get_xreg(decodeObj.regi) & 0x00ff);   
+            decodeObj.rightOperand = decodeObj.immediate;
+            break;
+        case 0xfe:      // inc r8
+            switch (decodeObj.reg){
+                case 0x00: // Lower-Byte Registers
+                case 0x01:
+                case 0x02:
+                case 0x03:
+                    decodeObj.leftOperand = get_xreg(decodeObj.regi) & 0xff; 
+                    break;
+                case 0x04: // Upper-Byte Registers
+                case 0x05:
+                case 0x06:
+                case 0x07:
+                    decodeObj.leftOperand = (get_xreg(decodeObj.regi) >> 8) & 0xff; 
+                    break;
+            }
+            decodeObj.rightOperand = 1;
+            break;
+        case 0xeb:      // jmp rel8
+        case 0x74:      // je imm8
+            decodeObj.leftOperand = get_pc(); 
+            decodeObj.rightOperand = decodeObj.immediate;
+            break;
+        case 0x8a:      // mov rb, [m8]
+            if (decodeObj.immediate % 8 == 7) { // [bx]
+                decodeObj.immediate = memory_read<uint8_t>(get_xreg(3));
+            }
+            decodeObj.leftOperand = get_xreg(decodeObj.regi) & 0x00ff;
+            decodeObj.rightOperand = decodeObj.immediate;
+            break;
+        case 0x40:      // inc rw
+            decodeObj.leftOperand = get_xreg(decodeObj.regi);
+            decodeObj.rightOperand = 1;
+            break;
+        case 0xb0:      // mov rb, imm16
+            decodeObj.leftOperand = (get_xreg(decodeObj.regi) >> 8);
+            decodeObj.rightOperand = decodeObj.immediate;
+            break;
+    }
+}
+// Runs decode_fields() at every byte of [start, end) into out[], marking
+// where basic blocks start. Records for instructions that run past end are
+// left invalid, so only writes inside [start, end) can make them stale.
+void Machine::predecode(Predecoded *out, int start, int end) {
+    int16_t pc = get_pc();
+    Predecoded *table = predecoded;
+    predecoded = nullptr;   // Decode the slow way meanwhile
+    for (int address = start; address < end; address++) {
+        Predecoded &pd = out[address - start];
+        memset(&pd, 0, sizeof(pd));
+        set_pc(address);
+        fetch();
+        if (!decode_fields()) continue;
+        int length = (uint16_t)get_pc() - address;
+        if (address + length >= end || length >= MAX_INSTRUCTION_LENGTH ||
+            decodeObj.instruction.size() >= sizeof(pd.instruction)) continue;
+        pd.opcode = fetchObj.opcode;
+        pd.length = length;
+        pd.rep = decodeObj.rep;
+        pd.flags = PREDECODE_VALID;
+        pd.reg = decodeObj.reg;
+        pd.regi = decodeObj.regi;
+        pd.immediate = decodeObj.immediate;
+        strcpy(pd.instruction, decodeObj.instruction.c_str());
+    }
+    set_pc(pc);
+    predecoded = table;
+
+    if (end > start) out[0].flags |= PREDECODE_LEADER;
+    for (int address = start; address < end; address++) {
+        const Predecoded &pd = out[address - start];
+        if (!(pd.flags & PREDECODE_VALID)) continue;
+        int next = address + pd.length + 1;
+        switch (pd.opcode) {
+            case 0xeb:      // jmp rel8
+            case 0x74: {    // je imm8
+                int target = next + pd.immediate;
+                if (target >= start && target < end) out[target - start].flags |= PREDECODE_LEADER;
+            }
+                [[fallthrough]]; // The next instruction starts a block too
+            case 0xcd:      // int imm8
+            case 0xf4:      // hlt
+                if (next < end) out[next - start].flags |= PREDECODE_LEADER;
+                break;
+        }
+    }
+}
+// Decodes [start, end) from records until the next call (nullptr for none).
+// The machine writes to them: stores into the program clear PREDECODE_VALID
+// on the records they overlap. The caller keeps them alive meanwhile.
+void Machine::set_predecode(Predecoded *records, int start, int end) {
+    predecoded = records;
+    codeStart = start;
+    codeEnd = end;
+}
+// Describes the instruction that just retired from pc
+void Machine::trace(TraceRecord &rec, int16_t pc) const {
+    rec.pc = (uint16_t)pc;
+    rec.length = decodeObj.length;
+    rec.instruction = 0;
+    memcpy(&rec.instruction, memory + (uint16_t)pc, std::min<size_t>(rec.length, 4));
+    rec.flags = 0;
+    switch (fetchObj.opcode) {
+        case 0x8a:      // mov rb, [m8]
+            if (memory_read<int8_t>((uint16_t)pc + 1) % 8 == 7) { // [bx]
+                rec.flags = TRACE_LOAD;
+                rec.memSize = 1;
+                rec.memAddress = (uint16_t)get_xreg(3);
+                rec.memValue = decodeObj.immediate & 0xff;
+            }
+            [[fallthrough]];
+        case 0x81:      // add rw, imm16
+        case 0x40:      // inc rw
+        case 0xb0:      // mov rb, imm8
+            rec.flags |= TRACE_RD;
+            rec.rd = decodeObj.regi;
+            break;
+        case 0xfe:      // inc rb
+            rec.flags |= TRACE_RD;
+            rec.rd = decodeObj.reg;
+            break;
+    }
+    if (rec.flags & TRACE_RD) rec.rdValue = (uint16_t)get_xreg(rec.rd);
+}
+// Counts the instruction that just retired from pc (before the PC steps past it)
+void Machine::profile(Profiler &prof, int16_t pc) const {
+    prof.retire((uint16_t)pc, decodeObj.length, fetchObj.opcode);
+    switch (fetchObj.opcode) {
+        case 0xeb:      // jmp rel8
+        case 0x74:      // je imm8
+        case 0xcd:      // int imm8
+        case 0xf4: {    // hlt
+            uint16_t next = get_pc() + 1;
+            prof.transfer((uint16_t)pc, next, next != (uint16_t)(pc + decodeObj.length));
+            break;
+        }
+    }
+}
+// Adds the instruction that just retired from pc to the run counters
+void Machine::count(Metrics &metrics, int16_t pc) const {
+    metrics.retired++;
+    metrics.categories[fetchObj.opcode & 0xff]++;
+    switch (fetchObj.opcode) {
+        case 0x8a:      // mov rb, [m8]
+            if (memory_read<int8_t>((uint16_t)pc + 1) % 8 == 7) metrics.load(1); // [bx]
+            break;
+        case 0x74:      // je imm8
+            metrics.branch((uint16_t)(get_pc() + 1) != (uint16_t)(pc + decodeObj.length));
+            break;
+        case 0xeb:      // jmp rel8
+            metrics.jumps++;
+            break;
+        case 0xcd:      // int imm8
+            metrics.syscalls++;
+            break;
+        case 0xa4:      // movsb
+        case 0xa5:      // movsw
+            metrics.load(fetchObj.opcode == 0xa4 ? 1 : 2, executeObj.elements);
+            metrics.store(fetchObj.opcode == 0xa4 ? 1 : 2, executeObj.elements);
+            break;
+        case 0xaa:      // stosb
+        case 0xab:      // stosw
+            metrics.store(fetchObj.opcode == 0xaa ? 1 : 2, executeObj.elements);
+            break;
+        case 0xa6:      // cmpsb
+        case 0xa7:      // cmpsw
+            metrics.load(fetchObj.opcode == 0xa6 ? 1 : 2, 2 * executeObj.elements);
+            break;
+    }
+}
+// Describes the control transfer that just retired from pc (before the PC
+// steps past it); false if the instruction was not one
+bool Machine::branch(BranchEvent &e, int16_t pc) const {
+    switch (fetchObj.opcode) {
+        case 0x74:      // je imm8
+            e.kind = BRANCH_COND;
+            break;
+        case 0xeb:      // jmp rel8
+            e.kind = BRANCH_JUMP;
+            break;
+        default:
+            return false;
+    }
+    e.pc = (uint16_t)pc;
+    e.fallthrough = (uint16_t)(pc + decodeObj.length);
+    e.target = (uint16_t)(get_pc() + 1);
+    e.taken = e.target != e.fallthrough;
+    return true;
+}
+// Calls visit(address, bytes, store, down) for each block of data the
+// instruction that just retired from pc read or wrote. String instructions
+// have already moved SI and DI past their elements, so the blocks they
+// touched are worked out backwards.
+template<typename Visit>
+void Machine::data_accesses(int16_t pc, Visit visit) const {
+    int size = 1;
+    switch (fetchObj.opcode) {
+        case 0x8a:      // mov rb, [m8]
+            if (memory_read<int8_t>((uint16_t)pc + 1) % 8 == 7) { // [bx]
+                visit((uint16_t)get_xreg(3), 1, false, false);
+            }
+            break;
+        case 0xa5:      // movsw
+        case 0xab:      // stosw
+        case 0xa7:      // cmpsw
+            size = 2;
+            [[fallthrough]];
+        case 0xa4:      // movsb
+        case 0xaa:      // stosb
+        case 0xa6: {    // cmpsb
+            bool down = (get_xreg(EFLAGS_REG) >> 10) & 1;
+            uint32_t bytes = executeObj.elements * size;
+            if (!bytes) break;
+            // Lowest address of the block that ends (exclusive) at the register
+            auto low = [&](int reg) {
+                uint16_t after = get_xreg(reg);
+                return down ? (uint16_t)(after + size) : (uint16_t)(after - bytes);
+            };
+            bool stos = fetchObj.opcode == 0xaa || fetchObj.opcode == 0xab;
+            bool cmps = fetchObj.opcode == 0xa6 || fetchObj.opcode == 0xa7;
+            if (!stos) visit(low(6), bytes, false, down);  // SI
+            visit(low(7), bytes, !cmps, down);             // DI
+            break;
+        }
+    }
+}
+// Feeds the caches the fetch and the data accesses of the instruction that
+// just retired from pc
+void Machine::cache(CacheHierarchy &caches, int16_t pc) const {
+    caches.fetch((uint16_t)pc, decodeObj.length);
+    data_accesses(pc, [&](uint64_t address, uint32_t bytes, bool store, bool down) {
+        caches.block((uint16_t)pc, address, bytes, store, down);
+    });
+}
+// Feeds the reuse analyzer the data accesses of the instruction that just
+// retired from pc
+void Machine::reuse(ReuseAnalyzer &analyzer, int16_t pc) const {
+    data_accesses(pc, [&](uint64_t address, uint32_t bytes, bool, bool) {
+        analyzer.access(address, bytes, retired);
+    });
+}
+// Assembly text of the instruction at pc, decoded without running it
+std::string Machine::disassemble(int16_t pc) {
+    int16_t savedPc = programCounter;
+    Fetch savedFetch = fetchObj;
+    Decode savedDecode = decodeObj;
+
+    char text[64];
+    char *end;
+    set_pc(pc);
+    fetch();
+    if (!decode_fields()) {
+        end = text_str(text, "db 0x");
+        end = text_hex(end, fetchObj.opcode & 0xff, 2);
+    }
+    else {
+        decodeObj.length = (uint16_t)get_pc() - (uint16_t)pc + 1;
+        end = disassemble(text, pc);
+    }
+
+    programCounter = savedPc;
+    fetchObj = savedFetch;
+    decodeObj = savedDecode;
+    return std::string(text, end);
+}
+
+// Operand layouts in the disassembler's mnemonic table
+enum OperandFormat : uint8_t {
+    FMT_INVALID, FMT_NONE, FMT_AL_IMM, FMT_REG_IMM, FMT_REG, FMT_IMM, FMT_REL, FMT_REG_MEM, FMT_STRING
+};
+// Mnemonics by opcode as execute() and write_back() see it, built at compile time
+struct MnemonicTable {
+    Mnemonic entries[256];
+};
+constexpr MnemonicTable build_mnemonics() {
+    MnemonicTable t{};
+    t.entries[0x04] = make_mnemonic("add", FMT_AL_IMM);
+    t.entries[0x81] = make_mnemonic("add", FMT_REG_IMM);
+    t.entries[0x3c] = make_mnemonic("cmp", FMT_AL_IMM);
+    t.entries[0xfe] = make_mnemonic("inc", FMT_REG);
+    t.entries[0x40] = make_mnemonic("inc", FMT_REG);
+    t.entries[0xcd] = make_mnemonic("int", FMT_IMM);
+    t.entries[0xeb] = make_mnemonic("jmp", FMT_REL);
+    t.entries[0x74] = make_mnemonic("je", FMT_REL);
+    t.entries[0xf4] = make_mnemonic("hlt", FMT_NONE);
+    t.entries[0xfc] = make_mnemonic("cld", FMT_NONE);
+    t.entries[0xfd] = make_mnemonic("std", FMT_NONE);
+    t.entries[0xa4] = make_mnemonic("movsb", FMT_STRING);
+    t.entries[0xa5] = make_mnemonic("movsw", FMT_STRING);
+    t.entries[0xaa] = make_mnemonic("stosb", FMT_STRING);
+    t.entries[0xab] = make_mnemonic("stosw", FMT_STRING);
+    t.entries[0xa6] = make_mnemonic("cmpsb", FMT_STRING);
+    t.entries[0xa7] = make_mnemonic("cmpsw", FMT_STRING);
+    t.entries[0x8a] = make_mnemonic("mov", FMT_REG_MEM);
+    t.entries[0xb0] = make_mnemonic("mov", FMT_REG_IMM);
+    return t;
+}
+constexpr MnemonicTable MNEMONICS = build_mnemonics();
+
+// Assembly text of the instruction just decoded from pc, written at out
+// (64 bytes is plenty) from the decode stage's fields; returns its end
+char *Machine::disassemble(char *out, int16_t pc) const {
+    const Mnemonic &m = MNEMONICS.entries[fetchObj.opcode & 0xff];
+    const std::string &reg = decodeObj.reg < 17 ? reg_name[decodeObj.reg] : reg_name[16];
+    char *p = out;
+    if (decodeObj.rep) {
+        p = decodeObj.rep == 0xf3 ? text_str(p, "rep ") : text_str(p, "repne ");
+    }
+    p = text_mnemonic(p, m);
+    switch (m.format) {
+        case FMT_AL_IMM:    // add/cmp al, imm8
+            p = text_str(p, " AL, 0x");
+            p = text_hex(p, decodeObj.immediate & 0xff);
+            break;
+        case FMT_REG_IMM:   // add rw, imm16; mov rb/rw, imm
+            *p++ = ' ';
+            p = text_str(p, reg.data(), reg.size());
+            p = text_str(p, ", 0x");
+            p = text_hex(p, decodeObj.reg > 7 ? (uint16_t)decodeObj.immediate : decodeObj.immediate & 0xff);
+            break;
+        case FMT_REG:       // inc rb/rw
+            *p++ = ' ';
+            p = text_str(p, reg.data(), reg.size());
+            break;
+        case FMT_IMM:       // int imm8
+            p = text_str(p, " 0x");
+            p = text_hex(p, decodeObj.immediate & 0xff);
+            break;
+        case FMT_REL:       // jmp/je rel8
+            p = text_str(p, " 0x");
+            p = text_hex(p, (uint16_t)(pc + decodeObj.length + decodeObj.immediate));
+            break;
+        case FMT_REG_MEM:   // mov rb, [m8]
+            *p++ = ' ';
+            p = text_str(p, reg.data(), reg.size());
+            p = memory_read<int8_t>((uint16_t)pc + 1) % 8 == 7 ? text_str(p, ", [bx]") : text_str(p, ", [si]");
+            break;
+        case FMT_INVALID:
+            p = text_str(out, "db 0x");
+            p = text_hex(p, fetchObj.opcode & 0xff, 2);
+            break;
+    }
+    return p;
+}
+// Name of an opcode as execute() and write_back() see it, for reports
+std::string Machine::opcode_name(int opcode) {
+    const char *name;
+    switch (opcode) {
+        case 0x04: case 0x81: name = "add"; break;
+        case 0x3c: name = "cmp"; break;
+        case 0xfe: case 0x40: name = "inc"; break;
+        case 0xcd: name = "int"; break;
+        case 0xeb: name = "jmp"; break;
+        case 0x74: name = "je"; break;
+        case 0xf4: name = "hlt"; break;
+        case 0xfc: name = "cld"; break;
+        case 0xfd: name = "std"; break;
+        case 0xa4: case 0xa5: name = "movs"; break;
+        case 0xaa: case 0xab: name = "stos"; break;
+        case 0xa6: case 0xa7: name = "cmps"; break;
+        case 0x8a: case 0xb0: name = "mov"; break;
+        default: name = "?"; break;
+    }
+    std::ostringstream sout;
+    sout << "0x" << std::hex << std::setw(2) << std::setfill('0') << opcode << ' ' << name;
+    return sout.str();
+}
+Machine::Decode &Machine::debug_decode_out() { 
+    return decodeObj; 
+}
+
+// EXECUTE
+void Machine::execute() {
+    switch (fetchObj.opcode){
+        case 0x81:      // add rw, imm16
+            executeObj.result = decodeObj.leftOperand + decodeObj.rightOperand;
+            break;
+        case 0xfe:      // inc rb
+            executeObj.result = decodeObj.leftOperand + decodeObj.rightOperand;
+            if (executeObj.result > SHRT_MAX) {
+                set_carry_flag();
+            }
+            break;
+        case 0x40:
+            executeObj.result = decodeObj.leftOperand + decodeObj.rightOperand;
+            if (executeObj.result > SHRT_MAX) {
+                set_carry_flag();
+            }
+            break;
+        case 0x3c:      // cmp al, imm16
+            executeObj.result = decodeObj.leftOperand - decodeObj.rightOperand;
+            break;
+        case 0xeb:      // jmp rel8
+            executeObj.result = decodeObj.leftOperand + decodeObj.rightOperand;
+            break;
+        case 0x74:      // je imm8
+            executeObj.result = decodeObj.leftOperand + decodeObj.rightOperand;
+            break;
+        case 0xb0:      // mov rb, imm8
+            executeObj.result = decodeObj.immediate;
+            break;
+        case 0x8a:
+            executeObj.result = decodeObj.immediate;
+            break;
+    }
+}
+Machine::Execute &Machine::debug_execute_out() { 
+    return executeObj; 
+}
+
+// // MEMORY
+// void Machine::memory_access() {
+// }
+// Machine::Memory &Machine::debug_memory_out() { 
+//     return memoryObj; 
+// }
+
+// WRITEBACK
+void Machine::write_back() {
+    switch (fetchObj.opcode) {
+        case 0x81:      // add rw, imm16
+            set_xreg(decodeObj.regi, executeObj.result);
+            break;
+        case 0x3c:      // cmp al, imm16
+            unset_zero_flag();
+            unset_sign_flag();
+            unset_carry_flag();
+            if (executeObj.result == 0) set_zero_flag();
+            else if (executeObj.result < 0) set_sign_flag();
+            else set_carry_flag();
+            break;
+        case 0xfe:      // inc rb
+            set_xreg(decodeObj.reg, executeObj.result); 
+            break;
+        case 0x40:      // inc rw
+            set_xreg(decodeObj.regi, executeObj.result);
+            break;
+        case 0xcd:      // int imm8
+            if (bios) {
+                bios->interrupt(*this, decodeObj.immediate & 0xff);
+            }
+            else if (decodeObj.immediate == 0x10) { 
+                if ( (get_xreg(0) >> 8) == 0x0e ) {
+                    putchar( (get_xreg(0) & 0xff) );
+                }
+            }
+            break;
+        case 0xf4:      // hlt
+            halted = true;
+            break;
+        case 0xfc:      // cld
+            unset_direction_flag();
+            break;
+        case 0xfd:      // std
+            set_direction_flag();
+            break;
+        case 0xa4:      // movsb
+        case 0xa5:      // movsw
+            string_move(fetchObj.opcode == 0xa4 ? 1 : 2);
+            break;
+        case 0xaa:      // stosb
+        case 0xab:      // stosw
+            string_store(fetchObj.opcode == 0xaa ? 1 : 2);
+            break;
+        case 0xa6:      // cmpsb
+        case 0xa7:      // cmpsw
+            string_compare(fetchObj.opcode == 0xa6 ? 1 : 2);
+            break;
+        case 0xeb:      // jmp rel8
+            if (coverage) coverage->edge(get_pc(), executeObj.result + 1);
+            set_pc(executeObj.result);
+            break;
+        case 0x74:      // je imm8
+            if (check_zero_flag()) {
+                if (coverage) coverage->edge(get_pc(), executeObj.result + 1);
+                set_pc(executeObj.result);
+            }
+            else if (coverage) coverage->edge(get_pc(), get_pc() + 1);
+            break;
+        case 0x8a:      // mov rb, m8
+            set_xreg(decodeObj.regi, 
+                            (get_xreg(decodeObj.regi) & 0xff00)
+                            | decodeObj.immediate);
+            break;
+        case 0xb0:      // mov rb, imm8
+            if (decodeObj.reg > 7){ // 16-Bit Immediate
+                set_xreg(decodeObj.regi, executeObj.result);
+            }
+            else{
+                switch (decodeObj.reg){
+                case 0: // Lower 8-Bit Registers
+                case 1:
+                case 2:
+                case 3:
+                    set_xreg(decodeObj.regi, 
+                            (get_xreg(decodeObj.regi) & 0xff00)
+                            | executeObj.result);
+                    break;
+                case 4: // Upper 8-Bit Registers
+                case 5:
+                case 6:
+                case 7:
+                    set_xreg(decodeObj.regi, 
+                            (get_xreg(decodeObj.regi) & 0x00ff)
+                            | (executeObj.result << 8));
+                    break;
+                }
+            }
+            break;
+    }
+    retired++;
+}
+
+// One whole instruction, with no debug output, leaving the PC on the next one
+void Machine::step() {
+    fetch();
+    decode();
+    execute();
+    write_back();
+    set_pc(get_pc() + 1);
+}
+// Runs at most limit instructions for a debugger (gdbstub.h) while the PC
+// stays in [start, end). A breakpoint stops the run before its instruction
+// unless it is the first one and the debugger is resuming from it; a
+// watchpoint fault sets stop, which ends the run after the instruction.
+GdbStop Machine::debug_run(volatile bool &stop, uint64_t limit, int start, int end, bool resuming) {
+    for (uint64_t n = 0; n < limit; n++) {
+        int16_t pc = get_pc();
+        if (halted || pc < start || pc >= end) return GDB_STOP_EXIT;
+        breakHit = false;
+        fetch();
+        decode();
+        if (breakHit && (n || !resuming)) {
+            set_pc(pc);
+            return GDB_STOP_BREAK;
+        }
+        execute();
+        write_back();
+        set_pc(get_pc() + 1);
+        if (stop) return GDB_STOP_WATCH;
+    }
+    return (halted || get_pc() < start || get_pc() >= end) ? GDB_STOP_EXIT : GDB_STOP_LIMIT;
+}
@@ -1,45 +1,393 @@
-#include "CPU.h"
-
-int main(int argc, char **argv){
-    if (argc < 2) {
-        std::cerr << "include file\n";
-        return 1; 
-    }
-
-    char* bin_file = argv[1]; // Reads the command-line argument into a char buffer
-    std::ifstream ifs (bin_file, std::ios::binary);
-    if (!(ifs.is_open())) { // Ends program if the binary file does not open
-        std::cerr << "invalid file type\n";
-        return 1;
-    }
-    
-    // File Size
-    ifs.seekg (0, ifs.end); // Goes to last byte
-    int fileSize = ifs.tellg();
-    ifs.clear(); // Clear error flags and return back to top of file for reading
-    ifs.seekg (0, ifs.beg); 
-
-    if (fileSize > MEM_SIZE) {
-        std::cerr << "File is too big\n";
-        return 1;
-    }
-
-    char* buffer = new char[MEM_SIZE]; // Initialize and read in binary file into char buffer
-    ifs.read(buffer, fileSize);
-
-    Machine mach(buffer, fileSize);
-    while (mach.get_pc() < fileSize) {
-        mach.fetch();
-        // std::cout << mach.debug_fetch_out() << '\n';
-        mach.decode();
-        // std::cout << mach.debug_decode_out() << '\n';
-        mach.execute();
-        // std::cout << mach.debug_execute_out() << '\n';
-        mach.write_back();
-        mach.set_pc(mach.get_pc() + 1);
-    }
-
-    ifs.close();
-    delete[] buffer;
-    return 0;
-}
\ No newline at end of file
+#include "CPU.h"
+#include <cinttypes>
+#include "options.h"
+
+// The machine as GDB's i8086 architecture sees it: the i386 register file
+// (eax-edi, eip, eflags, cs, ss, ds, es, fs, gs), zero-extended from 16
+// bits. Breakpoints live in the predecoded program the machine runs from,
+// as on RISC-V, and are all removed when the debugger goes.
+class GdbMachine : public GdbTarget {
+    static constexpr int REGISTER_OF[16] = { 0, 1, 2, 3, 4, 5, 6, 7, -1, EFLAGS_REG, 9, 8, 10, 11, 12, 13 };
+
+    Machine &mach;
+    char *buffer;
+    int start;      // The program; the run ends when the PC leaves it
+    int end;
+    Predecoded *table;  // From --predecode, if set
+    BreakpointTable<Predecoded> breaks;
+
+public:
+    GdbMachine(Machine &m, char *memory, int programStart, int programEnd, Predecoded *predecoded)
+        : mach(m), buffer(memory), start(programStart), end(programEnd), table(predecoded) {
+        if (table) breaks.adopt(table, end - start);
+        else {
+            mach.predecode(breaks.build(end - start), start, end);
+            mach.set_predecode(breaks.data(), start, end);
+        }
+    }
+    ~GdbMachine() {
+        breaks.clear();
+        if (table) mach.set_predecode(table, start, end);
+        else mach.set_predecode(nullptr, 0, 0);
+    }
+    int registers() const override {
+        return 16;
+    }
+    int register_bytes() const override {
+        return 4;
+    }
+    int pc_register() const override {
+        return 8;
+    }
+    uint64_t get_register(int n) override {
+        int16_t value = n == 8 ? mach.get_pc() : mach.get_xreg(REGISTER_OF[n]);
+        return (uint16_t)value;
+    }
+    void set_register(int n, uint64_t value) override {
+        if (n == 8) mach.set_pc(value);
+        else mach.set_xreg(REGISTER_OF[n], value);
+    }
+    char *memory() override {
+        return buffer;
+    }
+    uint64_t memory_size() const override {
+        return MEM_SIZE;
+    }
+    void memory_written(uint64_t address, uint64_t length) override {
+        if (address <= UINT16_MAX) mach.written(address, length); // The rest is out of the guest's reach
+    }
+    bool breakpoint(uint64_t address, bool insert) override {
+        return address >= (uint64_t)start && breaks.set(address - start, insert);
+    }
+    GdbStop run(volatile bool &stop, uint64_t limit, bool resuming) override {
+        return mach.debug_run(stop, limit, start, end, resuming);
+    }
+};
+
+// One instruction with the output of each stage printed, for --debug
+static void debug_stages(Machine &mach) {
+    mach.fetch();
+    std::cout << mach.debug_fetch_out() << '\n';
+    mach.decode();
+    std::cout << mach.debug_decode_out() << '\n';
+    mach.execute();
+    std::cout << mach.debug_execute_out() << '\n';
+    mach.write_back();
+}
+
+int main(int argc, char **argv){
+    Options opts;
+    if (!parse_options(argc, argv, opts)) return 1;
+    if (!opts.binary && !opts.disk) {
+        std::cerr << "include file\n";
+        return 1;
+    }
+
+    // Zeroed so stray reads see empty memory, and page aligned so that a
+    // debugger's watchpoints can protect pages of it
+    char* buffer = static_cast<char*>(mmap(nullptr, MEM_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+    if (buffer == MAP_FAILED) {
+        std::cerr << "cannot allocate guest memory\n";
+        return 1;
+    }
+    Bios bios;
+    if (opts.keyboard && !bios.open_keyboard(opts.keyboard)) {
+        std::cerr << "invalid keyboard file\n";
+        return 1;
+    }
+
+    InputLog input;
+    if (opts.record && !input.record(opts.record)) {
+        std::cerr << "cannot record to " << opts.record << '\n';
+        return 1;
+    }
+    if (opts.replay && !input.replay(opts.replay)) {
+        std::cerr << "invalid replay log\n";
+        return 1;
+    }
+    bios.set_input_log(&input);
+
+    Machine mach(buffer, MEM_SIZE);
+    mach.set_bios(&bios);
+
+    EdgeCoverage coverage;
+    coverage.set_mode(opts.coverageBlocks ? COVERAGE_BLOCKS : COVERAGE_EDGES);
+    if (coverage.attach_afl() || opts.coverage) mach.set_coverage(&coverage);
+
+    // Digests are written as "<retired instructions> <hash>" lines
+    StateDigest digest;
+    FILE *digestOut = nullptr;
+    if (opts.digest) {
+        digestOut = fopen(opts.digest, "w");
+        if (!digestOut) {
+            std::cerr << "cannot write digests to " << opts.digest << '\n';
+            return 1;
+        }
+        mach.set_digest(&digest);
+    }
+    auto write_digest = [&]() {
+        fprintf(digestOut, "%" PRIu64 " %016" PRIx64 "\n", mach.get_retired(), mach.state_digest());
+    };
+    int start = 0;
+    int end = 0;
+
+    if (opts.disk) { // Boot sector mode: the BIOS loads sector 0 at 0x7c00
+        if (!bios.open_disk(opts.disk)) {
+            std::cerr << "invalid disk image\n";
+            return 1;
+        }
+        start = BOOT_ADDRESS;
+        end = start + bios.boot(mach, buffer);
+    }
+    else {
+        std::ifstream ifs (opts.binary, std::ios::binary);
+        if (!(ifs.is_open())) { // Ends program if the binary file does not open
+            std::cerr << "invalid file type\n";
+            return 1;
+        }
+
+        // File Size
+        ifs.seekg (0, ifs.end); // Goes to last byte
+        int fileSize = ifs.tellg();
+        ifs.clear(); // Clear error flags and return back to top of file for reading
+        ifs.seekg (0, ifs.beg);
+
+        if (fileSize > MEM_SIZE) {
+            std::cerr << "File is too big\n";
+            return 1;
+        }
+        ifs.read(buffer, fileSize); // Read in binary file into the buffer
+        ifs.close();
+        end = fileSize;
+    }
+
+    // Decode the program once per binary and keep it for later runs
+    PredecodeCache<Predecoded> predecode;
+    if (opts.predecode) {
+        if (!predecode.open(opts.predecode, "x86", buffer + start, end - start, end - start)) {
+            mach.predecode(predecode.build(), start, end);
+            if (!predecode.save()) {
+                std::cerr << "cannot write predecode cache to " << opts.predecode << '\n';
+            }
+        }
+        mach.set_predecode(predecode.data(), start, end);
+    }
+
+    TraceWriter trace;
+    if (opts.trace && !trace.open(opts.trace, "x86")) {
+        std::cerr << "cannot write trace to " << opts.trace << '\n';
+        return 1;
+    }
+    TraceRecord record;
+    TextTrace textTrace;
+    if (opts.textTrace && !textTrace.open(opts.textTrace, "x86", REGISTER_NAMES)) {
+        std::cerr << "cannot write text trace to " << opts.textTrace << '\n';
+        return 1;
+    }
+
+    Profiler profiler;
+    if (opts.profile || opts.folded) profiler.init(start, end - start, 0, start);
+
+    // Host counters, sampled around single guest instructions
+    HostPerf hostPerf;
+    if (opts.hostperf) {
+        std::string why;
+        if (!hostPerf.open(opts.hostperfEvery, why)) {
+            std::cerr << "host counters unavailable (" << why << "), running without them\n";
+        }
+    }
+
+    // Caches, fed by every fetch, load and store
+    HierarchyConfig cacheConfig;
+    if (opts.cacheConfig && !cacheConfig.parse(opts.cacheConfig)) {
+        std::cerr << "bad cache configuration " << opts.cacheConfig << '\n';
+        return 1;
+    }
+    CacheHierarchy caches(cacheConfig);
+
+    // Branch predictors, run side by side on every control transfer
+    BranchBench branches;
+    BranchEvent branchEvent;
+    BranchTraceWriter branchTrace;
+    bool predicting = opts.branch || opts.branchTrace;
+    if (opts.branch && !branches.add(opts.branchPredictors ? opts.branchPredictors : DEFAULT_PREDICTORS)) return 1;
+    if (opts.branchTrace && !branchTrace.open(opts.branchTrace, "x86")) {
+        std::cerr << "cannot write branch trace to " << opts.branchTrace << '\n';
+        return 1;
+    }
+
+    // Reuse distances and working sets of the data accesses
+    ReuseAnalyzer reuse(opts.reuseWindow);
+
+    // Metrics: a JSON summary at exit, and JSON lines every metricsEvery instructions
+    Metrics metrics;
+    bool counting = opts.metrics || opts.metricsLog;
+    FILE *metricsLog = nullptr;
+    if (opts.metricsLog && !(metricsLog = fopen(opts.metricsLog, "w"))) {
+        std::cerr << "cannot write metrics to " << opts.metricsLog << '\n';
+        return 1;
+    }
+
+    // Everything above is fed only inside the detail window
+    if (opts.marker) {
+        std::cerr << "--marker needs the RISC-V simulator\n";
+        return 1;
+    }
+    DetailWindow window(opts.skip, opts.detail, opts.startPc, false, opts.exitAfter);
+
+    Machine::Snapshot loaded;
+    if (opts.runs > 1) mach.snapshot(loaded);
+
+    // A debugger drives the guest until it detaches; the loop below runs
+    // whatever is left. If it kills the guest instead, nothing is left but
+    // the reports.
+    bool killed = false;
+    if (opts.gdb) {
+        GdbServer gdb;
+        if (!gdb.listen(opts.gdb)) {
+            std::cerr << "cannot listen for gdb on " << opts.gdb << '\n';
+            return 1;
+        }
+        std::cerr << "waiting for gdb on " << opts.gdb << '\n';
+        GdbMachine target(mach, buffer, start, end, opts.predecode ? predecode.data() : nullptr);
+        killed = !gdb.serve(target);
+    }
+
+    uint64_t detailed = 0; // Instructions retired inside the detail window, over every run
+    for (long run = 0; run < opts.runs && !killed; run++) {
+        if (run > 0) {
+            mach.restore(loaded);
+            bios.rewind();
+            profiler.restart();
+            window.restart();
+        }
+        uint64_t nextDigest = (digestOut && opts.digestEvery > 0) ? mach.get_retired() + opts.digestEvery : UINT64_MAX;
+        uint64_t nextMetrics = (metricsLog && opts.metricsEvery > 0) ? metrics.retired + opts.metricsEvery : UINT64_MAX;
+        uint64_t runStart = mach.get_retired();
+        hostPerf.start_loop(mach.get_retired());
+        while (!mach.is_halted() && mach.get_pc() >= start && mach.get_pc() < end) {
+            int16_t pc = mach.get_pc();
+            if (!window.before(pc, mach.get_retired(), runStart)) {
+                metrics.stop();
+                mach.step(); // Fast-forward
+                window.after(false, mach.get_retired(), runStart);
+                if (mach.get_retired() == nextDigest) {
+                    write_digest();
+                    nextDigest += opts.digestEvery;
+                }
+                continue;
+            }
+            metrics.start();
+            bool sampled = hostPerf.sample();
+            if (sampled) hostPerf.begin();
+            if (opts.debug) debug_stages(mach);
+            else {
+                mach.fetch();
+                mach.decode();
+                mach.execute();
+                mach.write_back();
+            }
+            detailed++;
+            if (sampled) hostPerf.end(mach.get_category());
+            if (trace.is_open() || textTrace.is_open()) {
+                mach.trace(record, pc);
+                if (trace.is_open()) trace.write(record);
+                if (textTrace.is_open()) textTrace.write(record, [&](char *out) { return mach.disassemble(out, pc); });
+            }
+            if (opts.profile || opts.folded) mach.profile(profiler, pc);
+            if (opts.cache) mach.cache(caches, pc);
+            if (opts.reuse || opts.reuseCurve) mach.reuse(reuse, pc);
+            if (predicting && mach.branch(branchEvent, pc)) {
+                if (opts.branch) branches.resolve(branchEvent);
+                if (branchTrace.is_open()) branchTrace.write(branchEvent, detailed);
+            }
+            if (counting) {
+                mach.count(metrics, pc);
+                if (metrics.retired == nextMetrics) {
+                    metrics.write_snapshot(metricsLog);
+                    nextMetrics += opts.metricsEvery;
+                }
+            }
+            mach.set_pc(mach.get_pc() + 1);
+            window.after(false, mach.get_retired(), runStart);
+            if (mach.get_retired() == nextDigest) {
+                write_digest();
+                nextDigest += opts.digestEvery;
+            }
+            if (window.done()) break;
+        }
+        hostPerf.stop_loop(mach.get_retired());
+        if (digestOut) write_digest();
+        if (window.done()) break;
+    }
+    metrics.stop();
+    if (digestOut) fclose(digestOut);
+    trace.close();
+    if (!textTrace.close()) std::cerr << "cannot write text trace to " << opts.textTrace << '\n';
+    if (!branchTrace.close(detailed)) std::cerr << "cannot write branch trace to " << opts.branchTrace << '\n';
+    if (opts.branch) {
+        FILE *out = fopen(opts.branch, "w");
+        if (out) {
+            branches.report(out, detailed, 20);
+            fclose(out);
+        }
+        else std::cerr << "cannot write branch report to " << opts.branch << '\n';
+    }
+    if (opts.reuse) {
+        FILE *out = fopen(opts.reuse, "w");
+        if (out) {
+            reuse.report(out);
+            fclose(out);
+        }
+        else std::cerr << "cannot write reuse report to " << opts.reuse << '\n';
+    }
+    if (opts.reuseCurve && !reuse.write_curve(opts.reuseCurve)) {
+        std::cerr << "cannot write miss-ratio curve to " << opts.reuseCurve << '\n';
+    }
+    if (opts.cache) {
+        FILE *out = fopen(opts.cache, "w");
+        if (out) {
+            caches.report(out, 20);
+            fclose(out);
+        }
+        else std::cerr << "cannot write cache report to " << opts.cache << '\n';
+    }
+    if (opts.hostperf && hostPerf.active()) {
+        FILE *out = fopen(opts.hostperf, "w");
+        if (out) {
+            hostPerf.report(out, Machine::opcode_name);
+            fclose(out);
+        }
+        else std::cerr << "cannot write host counters to " << opts.hostperf << '\n';
+    }
+    if (metricsLog) fclose(metricsLog);
+    if (opts.metrics) {
+        FILE *out = fopen(opts.metrics, "w");
+        if (out) {
+            metrics.write_json(out, "x86", Machine::opcode_name);
+            fclose(out);
+        }
+        else std::cerr << "cannot write metrics to " << opts.metrics << '\n';
+    }
+    if (opts.profile) {
+        FILE *out = fopen(opts.profile, "w");
+        if (out) {
+            profiler.report(out, [&](uint64_t pc) { return mach.disassemble(pc); }, Machine::opcode_name, 20);
+            fclose(out);
+        }
+        else std::cerr << "cannot write profile to " << opts.profile << '\n';
+    }
+    if (opts.folded && !profiler.write_folded(opts.folded)) {
+        std::cerr << "cannot write folded stacks to " << opts.folded << '\n';
+    }
+
+    bios.flush();
+    if (opts.coverage && !coverage.write(opts.coverage)) {
+        std::cerr << "cannot write coverage to " << opts.coverage << '\n';
+    }
+    if (input.get_mode() == INPUT_REPLAY && !input.exhausted()) {
+        std::cerr << "[REPLAY] Run ended with unconsumed events in the log\n";
+    }
+    munmap(buffer, MEM_SIZE);
+    return 0;
+}
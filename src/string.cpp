@@ -0,0 +1,218 @@
+#include <algorithm>
+#include <cstring>
+#include "machine.h"
+
+// String instructions (movs, stos, cmps) run a whole rep count at once
+// through host memmove/memset/memcmp instead of one element per cycle.
+// The final SI, DI, CX and flags match what element-at-a-time execution
+// would leave behind, including 64 KiB offset wrap-around.
+
+const int CX_REG = 1;
+const int SI_REG = 6;
+const int DI_REG = 7;
+const int COMPARE_BLOCK = 64; // Bytes compared per memcmp when scanning
+
+// Elements that fit between address and the end of the 64 KiB offset space
+// in the direction of travel, or 0 if the first element straddles the wrap
+static uint32_t run_length(uint16_t address, int size, bool down) {
+    if (address + size > 0x10000) return 0;
+    return down ? address / size + 1 : (0x10000 - address) / size;
+}
+
+static uint16_t element(const char *p, int size) {
+    uint8_t lo = p[0];
+    return size == 1 ? lo : (lo | (uint8_t(p[1]) << 8));
+}
+
+// Copies len bytes with the same result as copying one element at a time
+// in ascending (or descending) order, even when the ranges overlap
+static void serial_copy(char *dst, const char *src, size_t len, int size, bool down) {
+    ptrdiff_t lag = down ? src - dst : dst - src; // How far the writes trail the reads
+    if (lag <= 0 || lag >= (ptrdiff_t)len) {
+        memmove(dst, src, len); // Reads never see this copy's own writes
+        return;
+    }
+    if (lag < size) {
+        // Each element rereads part of the previous one
+        char tmp[2];
+        for (size_t i = 0; i < len; i += size) {
+            size_t off = down ? len - size - i : i;
+            memcpy(tmp, src + off, size);
+            memcpy(dst + off, tmp, size);
+        }
+        return;
+    }
+    // The copy replicates a lag-byte pattern; copy it lag bytes at a time so
+    // every chunk only reads bytes that are already final
+    if (!down) {
+        for (size_t off = 0; off < len; off += lag) {
+            memcpy(dst + off, src + off, std::min<size_t>(lag, len - off));
+        }
+    }
+    else {
+        for (size_t end = len; end > 0; ) {
+            size_t chunk = std::min<size_t>(lag, end);
+            end -= chunk;
+            memcpy(dst + end, src + end, chunk);
+        }
+    }
+}
+
+// Index (in execution order) of the first of n elements that differ, or n
+static uint32_t first_mismatch(const char *a, const char *b, uint32_t n, int size, bool down) {
+    size_t len = (size_t)n * size;
+    if (!down) {
+        for (size_t off = 0; off < len; off += COMPARE_BLOCK) {
+            size_t block = std::min<size_t>(COMPARE_BLOCK, len - off);
+            if (memcmp(a + off, b + off, block) == 0) continue;
+            for (size_t i = off; i < off + block; i++) {
+                if (a[i] != b[i]) return i / size;
+            }
+        }
+    }
+    else {
+        // Descending order starts from the highest element
+        for (size_t end = len; end > 0; ) {
+            size_t block = std::min<size_t>(COMPARE_BLOCK, end);
+            end -= block;
+            if (memcmp(a + end, b + end, block) == 0) continue;
+            for (size_t i = end + block; i-- > end; ) {
+                if (a[i] != b[i]) return n - 1 - i / size;
+            }
+        }
+    }
+    return n;
+}
+
+// movs: [DI] = [SI]
+void Machine::string_move(int size) {
+    uint32_t count = decodeObj.rep ? (uint16_t)get_xreg(CX_REG) : 1;
+    bool down = check_direction_flag();
+    uint16_t si = get_xreg(SI_REG);
+    uint16_t di = get_xreg(DI_REG);
+    executeObj.elements = count;
+
+    while (count) {
+        uint32_t n = std::min({count, run_length(si, size, down), run_length(di, size, down)});
+        if (n == 0) { // An element straddles the wrap, so copy it byte by byte
+            char tmp[2] = { memory[si], memory[(uint16_t)(si + 1)] };
+            for (int b = 0; b < size; b++) {
+                memory[(uint16_t)(di + b)] = tmp[b];
+                written(di + b, 1);
+            }
+            n = 1;
+        }
+        else {
+            uint32_t span = (n - 1) * size;
+            serial_copy(memory + (down ? di - span : di),
+                        memory + (down ? si - span : si),
+                        (size_t)n * size, size, down);
+            written(down ? di - span : di, (size_t)n * size);
+        }
+        int32_t step = (down ? -1 : 1) * (int32_t)(n * size);
+        si += step;
+        di += step;
+        count -= n;
+    }
+
+    set_xreg(SI_REG, si);
+    set_xreg(DI_REG, di);
+    if (decodeObj.rep) set_xreg(CX_REG, 0);
+}
+
+// stos: [DI] = AL or AX
+void Machine::string_store(int size) {
+    uint32_t count = decodeObj.rep ? (uint16_t)get_xreg(CX_REG) : 1;
+    bool down = check_direction_flag();
+    uint16_t di = get_xreg(DI_REG);
+    uint16_t value = get_xreg(0);
+    executeObj.elements = count;
+
+    while (count) {
+        uint32_t n = std::min(count, run_length(di, size, down));
+        if (n == 0) {
+            memory[di] = value & 0xff;
+            memory[(uint16_t)(di + 1)] = value >> 8;
+            written(di, 1);
+            written(di + 1, 1);
+            n = 1;
+        }
+        else {
+            char *dst = memory + (down ? di - (n - 1) * size : di);
+            size_t len = (size_t)n * size;
+            written(dst - memory, len);
+            if (size == 1 || (value & 0xff) == (value >> 8)) {
+                memset(dst, value & 0xff, len);
+            }
+            else {
+                // Lay down one word, then keep doubling the filled prefix
+                dst[0] = value & 0xff;
+                dst[1] = value >> 8;
+                for (size_t filled = size; filled < len; filled *= 2) {
+                    memcpy(dst + filled, dst, std::min(filled, len - filled));
+                }
+            }
+        }
+        di += (down ? -1 : 1) * (int32_t)(n * size);
+        count -= n;
+    }
+
+    set_xreg(DI_REG, di);
+    if (decodeObj.rep) set_xreg(CX_REG, 0);
+}
+
+// cmps: flags of [SI] - [DI], repeated while equal (repe) or not equal (repne)
+void Machine::string_compare(int size) {
+    uint32_t count = decodeObj.rep ? (uint16_t)get_xreg(CX_REG) : 1;
+    executeObj.elements = 0;
+    if (count == 0) return; // Flags are left alone
+    bool down = check_direction_flag();
+    uint16_t si = get_xreg(SI_REG);
+    uint16_t di = get_xreg(DI_REG);
+    uint16_t left = 0, right = 0;
+    bool stop = false;
+
+    while (count && !stop) {
+        uint32_t n = std::min({count, run_length(si, size, down), run_length(di, size, down)});
+        uint32_t done;
+        if (n == 0) {
+            char a[2] = { memory[si], memory[(uint16_t)(si + 1)] };
+            char b[2] = { memory[di], memory[(uint16_t)(di + 1)] };
+            left = element(a, size);
+            right = element(b, size);
+            stop = (decodeObj.rep == 0xf3) ? left != right : left == right;
+            done = 1;
+        }
+        else {
+            uint32_t span = (n - 1) * size;
+            const char *a = memory + (down ? si - span : si);
+            const char *b = memory + (down ? di - span : di);
+            if (decodeObj.rep == 0xf3) {
+                uint32_t at = first_mismatch(a, b, n, size, down);
+                stop = at < n;
+                done = stop ? at + 1 : n;
+            }
+            else {
+                // repne (or a single cmps) has no host kernel, so scan elements
+                for (done = 0; done < n && !stop; done++) {
+                    uint32_t off = (down ? n - 1 - done : done) * size;
+                    stop = element(a + off, size) == element(b + off, size);
+                }
+                if (!decodeObj.rep) stop = true;
+            }
+            uint32_t last = (down ? n - done : done - 1) * size;
+            left = element(a + last, size);
+            right = element(b + last, size);
+        }
+        int32_t step = (down ? -1 : 1) * (int32_t)(done * size);
+        si += step;
+        di += step;
+        count -= done;
+        executeObj.elements += done;
+    }
+
+    set_xreg(SI_REG, si);
+    set_xreg(DI_REG, di);
+    if (decodeObj.rep) set_xreg(CX_REG, count);
+    set_compare_flags(left, right, size);
+}
@@ -0,0 +1,42 @@
+BITS 16
+[org 0x7c00]
+
+; Load the second sector of the disk right after the boot sector
+mov ah, 0x02    ; read sectors
+mov al, 1       ; sector count
+mov ch, 0       ; cylinder
+mov cl, 2       ; sector (1-based)
+mov dh, 0       ; head
+mov bx, 0x7e00  ; buffer
+int 0x13
+
+print:
+    mov al, [bx]
+    cmp al, 0
+    je echo
+    mov ah, 0x0e ; tty mode
+    int 0x10
+    inc bx
+    jmp print
+
+; Echo keystrokes back until a newline
+echo:
+    mov ah, 0x00 ; read keystroke
+    int 0x16
+    mov ah, 0x0e
+    int 0x10
+    cmp al, 10
+    je done
+    jmp echo
+
+done:
+    hlt
+
+; Boot Sector
+times 510-($-$$) db 0
+dw 0xaa55
+
+; Sector 2
+MESSAGE:
+    db 'Hello from sector 2!', 10, 0
+times 1024-($-$$) db 0
@@ -0,0 +1,221 @@
+#include <cerrno>
+#include <chrono>
+#include <cinttypes>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+
+// Times the benchmark suite and compares it against a stored baseline:
+// bench [--runs <n>] [--tolerance <percent>] [--baseline <file>] [--save] <suite>
+//
+// Every line of the suite names a benchmark, the simulator that runs it, the
+// binary, and the digest (retired instructions and state hash) it has to end
+// with. Each benchmark is run once with --digest to check it still computes
+// the same thing, then `runs` times with its output thrown away. A
+// benchmark whose MIPS falls more than `tolerance` percent below the
+// baseline is a regression, and any regression makes the exit status 1.
+// --save writes the measured MIPS as the new baseline instead.
+
+struct Benchmark {
+    std::string name;
+    std::string simulator;
+    std::string binary;
+    uint64_t retired;
+    std::string hash;
+};
+
+// Runs simulator binary [extra], with stdout and stderr sent to /dev/null;
+// false if it could not be started or did not exit with status 0
+static bool run(const Benchmark &b, const char *extra, const char *value) {
+    pid_t pid = fork();
+    if (pid < 0) return false;
+    if (pid == 0) {
+        int null = open("/dev/null", O_WRONLY);
+        if (null >= 0) {
+            dup2(null, STDOUT_FILENO);
+            dup2(null, STDERR_FILENO);
+        }
+        if (extra) execl(b.simulator.c_str(), b.simulator.c_str(), b.binary.c_str(), extra, value, (char *)nullptr);
+        else execl(b.simulator.c_str(), b.simulator.c_str(), b.binary.c_str(), (char *)nullptr);
+        _exit(127);
+    }
+    int status;
+    if (waitpid(pid, &status, 0) != pid) return false;
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+static bool read_suite(const char *path, std::vector<Benchmark> &suite) {
+    std::ifstream in(path);
+    if (!in.is_open()) return false;
+    std::string line;
+    while (std::getline(in, line)) {
+        if (line.empty() || line[0] == '#') continue;
+        std::istringstream fields(line);
+        Benchmark b;
+        if (!(fields >> b.name >> b.simulator >> b.binary >> b.retired >> b.hash)) {
+            std::cerr << "bad suite line: " << line << '\n';
+            return false;
+        }
+        suite.push_back(b);
+    }
+    return true;
+}
+
+// "name mips" lines; a missing file is an empty baseline
+static std::map<std::string, double> read_baseline(const char *path) {
+    std::map<std::string, double> baseline;
+    std::ifstream in(path);
+    std::string name;
+    double mips;
+    while (in >> name >> mips) baseline[name] = mips;
+    return baseline;
+}
+
+// An option's value: a number with nothing after it and at least min, or
+// false (after printing why)
+static bool parse_count(const char *arg, const char *value, long min, long &out) {
+    char *end;
+    errno = 0;
+    long n = strtol(value, &end, 0);
+    if (end == value || *end || errno || n < min) {
+        std::cerr << arg << " needs a whole number of at least " << min << ", not " << value << '\n';
+        return false;
+    }
+    out = n;
+    return true;
+}
+static bool parse_number(const char *arg, const char *value, double min, double &out) {
+    char *end;
+    errno = 0;
+    double x = strtod(value, &end);
+    if (end == value || *end || errno || !std::isfinite(x) || x < min) {
+        std::cerr << arg << " needs a number of at least " << min << ", not " << value << '\n';
+        return false;
+    }
+    out = x;
+    return true;
+}
+
+int main(int argc, char **argv) {
+    long runs = 5;
+    double tolerance = 5;
+    const char *baselinePath = "bench/baseline.txt";
+    bool save = false;
+    const char *suitePath = nullptr;
+    bool usage = false;
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--save")) save = true;
+        else if (!strcmp(argv[i], "--runs") && i + 1 < argc) {
+            if (!parse_count(argv[i], argv[i + 1], 1, runs)) return 1;
+            i++;
+        }
+        else if (!strcmp(argv[i], "--tolerance") && i + 1 < argc) {
+            if (!parse_number(argv[i], argv[i + 1], 0, tolerance)) return 1;
+            i++;
+        }
+        else if (!strcmp(argv[i], "--baseline") && i + 1 < argc) baselinePath = argv[++i];
+        else if (!suitePath) suitePath = argv[i];
+        else usage = true;
+    }
+    if (usage || !suitePath) {
+        std::cerr << "usage: bench [--runs <n>] [--tolerance <percent>] [--baseline <file>] [--save] <suite>\n";
+        return 1;
+    }
+    std::vector<Benchmark> suite;
+    if (!read_suite(suitePath, suite)) {
+        std::cerr << "cannot read suite " << suitePath << '\n';
+        return 1;
+    }
+    std::map<std::string, double> baseline = read_baseline(baselinePath);
+
+    char digestPath[] = "/tmp/benchXXXXXX";
+    int fd = mkstemp(digestPath);
+    if (fd < 0) {
+        std::cerr << "cannot create a digest file\n";
+        return 1;
+    }
+    close(fd);
+
+    printf("%-10s %12s %10s %9s %7s %9s %9s %8s\n",
+           "benchmark", "instructions", "mean ms", "stddev ms", "cv", "MIPS", "baseline", "change");
+    std::map<std::string, double> measured;
+    int regressions = 0, failures = 0;
+    for (const Benchmark &b : suite) {
+        // The calibration run checks the result and warms the page cache
+        uint64_t retired = 0;
+        char hash[32] = "";
+        bool ok = run(b, "--digest", digestPath);
+        if (ok) {
+            FILE *digest = fopen(digestPath, "r");
+            ok = digest && fscanf(digest, "%" SCNu64 " %31s", &retired, hash) == 2;
+            if (digest) fclose(digest);
+        }
+        if (!ok || retired != b.retired || b.hash != hash) {
+            printf("%-10s FAILED: ", b.name.c_str());
+            if (!ok) printf("%s did not run\n", b.simulator.c_str());
+            else printf("ended with %" PRIu64 " %s, expected %" PRIu64 " %s\n", retired, hash, b.retired, b.hash.c_str());
+            failures++;
+            continue;
+        }
+
+        std::vector<double> seconds;
+        for (long r = 0; r < runs && ok; r++) {
+            auto start = std::chrono::steady_clock::now();
+            ok = run(b, nullptr, nullptr);
+            seconds.push_back(std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+        }
+        if (!ok) {
+            printf("%-10s FAILED: %s did not run\n", b.name.c_str(), b.simulator.c_str());
+            failures++;
+            continue;
+        }
+        double mean = 0, variance = 0;
+        for (double s : seconds) mean += s;
+        mean /= seconds.size();
+        for (double s : seconds) variance += (s - mean) * (s - mean);
+        variance /= seconds.size() > 1 ? seconds.size() - 1 : 1;
+        double stddev = sqrt(variance);
+        double mips = retired / mean / 1e6;
+        measured[b.name] = mips;
+
+        printf("%-10s %12" PRIu64 " %10.2f %9.2f %6.2f%% %9.2f",
+               b.name.c_str(), retired, mean * 1e3, stddev * 1e3, 100 * stddev / mean, mips);
+        auto found = baseline.find(b.name);
+        if (found == baseline.end() || save) {
+            printf("\n");
+            continue;
+        }
+        double change = 100 * (mips - found->second) / found->second;
+        printf(" %9.2f %7.1f%%", found->second, change);
+        if (change < -tolerance) {
+            printf("  REGRESSION");
+            regressions++;
+        }
+        printf("\n");
+    }
+    unlink(digestPath);
+
+    if (save) {
+        FILE *out = fopen(baselinePath, "w");
+        if (!out) {
+            std::cerr << "cannot write baseline to " << baselinePath << '\n';
+            return 1;
+        }
+        for (const auto &m : measured) fprintf(out, "%s %.2f\n", m.first.c_str(), m.second);
+        fclose(out);
+        printf("baseline saved to %s\n", baselinePath);
+    }
+    else if (baseline.empty()) printf("no baseline in %s; `make bench-baseline` records one\n", baselinePath);
+    else if (regressions) printf("%d regression%s beyond %.1f%%\n", regressions, regressions == 1 ? "" : "s", tolerance);
+    return (regressions || failures) ? 1 : 0;
+}
@@ -0,0 +1,27 @@
+#include <cstdio>
+#include <iostream>
+#include "branch.h"
+
+// Runs branch predictors over a trace written with --branch-trace, so they
+// can be compared without running the guest again:
+// branchsim <trace> [predictors]
+
+int main(int argc, char **argv) {
+    if (argc != 2 && argc != 3) {
+        std::cerr << "usage: branchsim <trace> [predictors]\n";
+        return 1;
+    }
+    BranchTraceReader reader;
+    if (!reader.open(argv[1])) {
+        std::cerr << "invalid branch trace file\n";
+        return 1;
+    }
+    BranchBench bench;
+    if (!bench.add(argc == 3 ? argv[2] : DEFAULT_PREDICTORS)) return 1;
+
+    BranchEvent e;
+    while (reader.next(e)) bench.resolve(e);
+    printf("%s trace %s\n", reader.isa(), argv[1]);
+    bench.report(stdout, reader.instructions(), 20);
+    return 0;
+}
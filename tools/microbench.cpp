@@ -0,0 +1,345 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "machine.h"
+#include "../riscv/machine.h"
+
+// Times the per-instruction kernels of both simulators in isolation:
+// microbench [--samples <n>] [--filter <text>] [--riscv <binary>]
+//
+// Each kernel runs over an instruction stream generated up front (or, with
+// --riscv, the words of a real RV64 program), so only the kernel itself is
+// timed. A sample repeats the stream until it takes at least 5 ms, and the
+// report gives the mean ns per operation over the samples with a 95%
+// confidence interval from Student's t distribution.
+
+static volatile uint64_t sink; // Keeps the compiler from dropping results
+
+// splitmix64 with a fixed seed, so every run times the same streams
+static uint64_t rng = 1;
+static uint64_t next() {
+    rng += 0x9e3779b97f4a7c15ULL;
+    uint64_t z = rng;
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+static int below(int n) {
+    return (int)(next() % n);
+}
+// Mostly small immediates, as compilers emit them, inside `bits` signed bits
+static int64_t immediate(int bits) {
+    int64_t limit = 1LL << (bits - 1);
+    int64_t small = std::min<int64_t>(64, limit);
+    if (below(10) < 8) return (int64_t)below(2 * small) - small;
+    return (int64_t)(next() % (2 * limit)) - limit;
+}
+
+// RV64 encodings
+static uint32_t r_type(int opcode, int rd, int funct3, int rs1, int rs2, int funct7) {
+    return funct7 << 25 | rs2 << 20 | rs1 << 15 | funct3 << 12 | rd << 7 | opcode;
+}
+static uint32_t i_type(int opcode, int rd, int funct3, int rs1, int64_t imm) {
+    return (uint32_t)(imm & 0xfff) << 20 | rs1 << 15 | funct3 << 12 | rd << 7 | opcode;
+}
+static uint32_t s_type(int opcode, int funct3, int rs1, int rs2, int64_t imm) {
+    return (uint32_t)((imm >> 5) & 0x7f) << 25 | rs2 << 20 | rs1 << 15 | funct3 << 12 |
+           (uint32_t)(imm & 0x1f) << 7 | opcode;
+}
+static uint32_t b_type(int funct3, int rs1, int rs2, int64_t imm) {
+    return (uint32_t)((imm >> 12) & 1) << 31 | (uint32_t)((imm >> 5) & 0x3f) << 25 | rs2 << 20 | rs1 << 15 |
+           funct3 << 12 | (uint32_t)((imm >> 1) & 0xf) << 8 | (uint32_t)((imm >> 11) & 1) << 7 | 0x63;
+}
+static uint32_t j_type(int rd, int64_t imm) {
+    return (uint32_t)((imm >> 20) & 1) << 31 | (uint32_t)((imm >> 1) & 0x3ff) << 21 |
+           (uint32_t)((imm >> 11) & 1) << 20 | (uint32_t)((imm >> 12) & 0xff) << 12 | rd << 7 | 0x6f;
+}
+
+// A mix close to compiled integer code: about a quarter loads, a tenth
+// stores, one in seven a branch, the rest mostly register-immediate
+// arithmetic
+static std::vector<uint32_t> riscv_stream(size_t n) {
+    std::vector<uint32_t> s;
+    s.reserve(n);
+    while (s.size() < n) {
+        int rd = 1 + below(31), rs1 = below(32), rs2 = below(32);
+        int pick = below(100);
+        if (pick < 22) {
+            static const int LOADS[] = { 0, 1, 2, 3, 4, 5, 6 };
+            s.push_back(i_type(0x03, rd, LOADS[below(7)], rs1, immediate(12)));
+        }
+        else if (pick < 32) s.push_back(s_type(0x23, below(4), rs1, rs2, immediate(12)));
+        else if (pick < 46) {
+            static const int BRANCHES[] = { 0, 1, 4, 5, 6, 7 };
+            s.push_back(b_type(BRANCHES[below(6)], rs1, rs2, immediate(13) & ~1LL));
+        }
+        else if (pick < 72) {
+            int funct3 = below(8);
+            int64_t imm = immediate(12);
+            if (funct3 == 1) imm = below(64);
+            if (funct3 == 5) imm = below(64) | (below(2) ? 0x400 : 0);
+            s.push_back(i_type(0x13, rd, funct3, rs1, imm));
+        }
+        else if (pick < 84) {
+            int funct3 = below(8);
+            int funct7 = below(4) ? 0 : 1;
+            if (!funct7 && (funct3 == 0 || funct3 == 5) && below(2)) funct7 = 0x20;
+            s.push_back(r_type(0x33, rd, funct3, rs1, rs2, funct7));
+        }
+        else if (pick < 88) s.push_back((uint32_t)(next() & 0xfffff000) | rd << 7 | 0x37);
+        else if (pick < 90) s.push_back((uint32_t)(next() & 0xfffff000) | rd << 7 | 0x17);
+        else if (pick < 94) s.push_back(j_type(below(2), immediate(21) & ~1LL));
+        else if (pick < 97) s.push_back(i_type(0x67, below(2), 0, rs1, immediate(12)));
+        else if (pick < 99) s.push_back(i_type(0x1b, rd, 0, rs1, immediate(12)));
+        else s.push_back(r_type(0x3b, rd, 0, rs1, rs2, below(2) ? 0 : 0x20));
+    }
+    return s;
+}
+
+// The 32-bit words of a flat binary that this core can decode
+static bool riscv_program(const char *path, std::vector<uint32_t> &s) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in.is_open()) return false;
+    uint32_t word;
+    while (in.read(reinterpret_cast<char *>(&word), sizeof(word))) {
+        if ((word & 3) != 3) continue;
+        riscv::OpcodeCategories op = riscv::OPCODE_MAP[(word >> 5) & 3][(word >> 2) & 7];
+        if (op != riscv::UNIMPL && op != riscv::SYSTEM) s.push_back(word);
+    }
+    return !s.empty();
+}
+
+struct AluOp {
+    riscv::AluCommands cmd;
+    int64_t left;
+    int64_t right;
+};
+
+// Operations as execute() issues them: mostly additions (address
+// arithmetic included), never a zero divisor or a shift past 63
+static std::vector<AluOp> alu_stream(size_t n) {
+    static const riscv::AluCommands MIX[] = {
+        riscv::ALU_ADD, riscv::ALU_ADD, riscv::ALU_ADD, riscv::ALU_ADD, riscv::ALU_ADD, riscv::ALU_ADD,
+        riscv::ALU_SUB, riscv::ALU_AND, riscv::ALU_OR, riscv::ALU_XOR, riscv::ALU_SLL, riscv::ALU_SRL,
+        riscv::ALU_SRA, riscv::ALU_MUL, riscv::ALU_DIV, riscv::ALU_REM
+    };
+    std::vector<AluOp> s(n);
+    for (AluOp &op : s) {
+        op.cmd = MIX[below(sizeof(MIX) / sizeof(MIX[0]))];
+        op.left = below(4) ? immediate(32) : (int64_t)next();
+        op.right = immediate(12);
+        if (op.cmd == riscv::ALU_SLL || op.cmd == riscv::ALU_SRL || op.cmd == riscv::ALU_SRA) op.right &= 63;
+        if ((op.cmd == riscv::ALU_DIV || op.cmd == riscv::ALU_REM) && !op.right) op.right = 7;
+    }
+    return s;
+}
+
+// x86 code made of the instructions this core decodes, weighted like the
+// loops it runs; returns the offset of each instruction
+static std::vector<uint16_t> x86_stream(char *memory, int limit) {
+    std::vector<uint16_t> starts;
+    int at = 0;
+    auto emit = [&](std::initializer_list<int> bytes) {
+        starts.push_back(at);
+        for (int b : bytes) memory[at++] = (char)b;
+    };
+    while (at + 4 <= limit) {
+        int pick = below(100);
+        if (pick < 14) emit({ 0xb8 + below(8), below(256), below(0x70) });          // mov rw, imm16
+        else if (pick < 22) emit({ 0xb0 + below(4), below(0x80) });                // mov rb, imm8
+        else if (pick < 32) emit({ 0x8a, 0x07 + 8 * below(4) });                   // mov rb, [bx]
+        else if (pick < 50) emit({ 0x3c, below(0x80) });                           // cmp al, imm8
+        else if (pick < 68) emit({ 0x74, below(256) });                            // je rel8
+        else if (pick < 76) emit({ 0xeb, below(256) });                            // jmp rel8
+        else if (pick < 88) emit({ 0x40 + below(8) });                             // inc rw
+        else if (pick < 92) emit({ 0x04, below(0x80) });                           // add al, imm8
+        else if (pick < 95) emit({ 0x81, 0xc0 + below(8), below(256), below(256) }); // add rw, imm16
+        else if (pick < 98) emit({ 0xf3, 0xa4 + below(4) });                       // rep movs/cmps
+        else emit({ 0xcd, 0x10 });                                                 // int 0x10
+    }
+    return starts;
+}
+
+struct Kernel {
+    std::string name;
+    size_t ops;                         // Operations per call of run
+    std::function<uint64_t()> run;
+};
+
+class MicroBench {
+    std::vector<Kernel> kernels;
+
+public:
+    void add(const std::string &name, size_t ops, std::function<uint64_t()> run) {
+        kernels.push_back(Kernel{ name, ops, run });
+    }
+
+    // RISC-V: the decode helpers read only the fetched word and registers
+    void add_riscv(riscv::Machine &m, const std::vector<uint32_t> &code, const std::vector<AluOp> &ops) {
+        std::vector<std::pair<int64_t, int8_t>> fields;
+        for (uint32_t inst : code) {
+            static const int8_t SIGN_BITS[] = { 11, 11, 12, 20, 31 };
+            int8_t index = SIGN_BITS[fields.size() % 5];
+            fields.push_back(std::make_pair((int64_t)(inst >> (31 - index)), index));
+        }
+        add("riscv sign_extend", fields.size(), [fields]() {
+            uint64_t sum = 0;
+            for (const std::pair<int64_t, int8_t> &f : fields) sum += riscv::sign_extend(f.first, f.second);
+            return sum;
+        });
+
+        typedef void (riscv::Machine::*Decoder)();
+        static const std::pair<const char *, Decoder> FORMATS[] = {
+            { "riscv decode_b", &riscv::Machine::decode_b },
+            { "riscv decode_i", &riscv::Machine::decode_i },
+            { "riscv decode_j", &riscv::Machine::decode_j },
+            { "riscv decode_r", &riscv::Machine::decode_r },
+            { "riscv decode_s", &riscv::Machine::decode_s },
+            { "riscv decode_u", &riscv::Machine::decode_u },
+        };
+        for (const std::pair<const char *, Decoder> &f : FORMATS) {
+            Decoder decoder = f.second;
+            add(f.first, code.size(), [&m, &code, decoder]() {
+                uint64_t sum = 0;
+                for (uint32_t inst : code) {
+                    m.mFO.instruction = inst;
+                    (m.*decoder)();
+                    sum += m.mDO.right_val + m.mDO.offset + m.mDO.rd;
+                }
+                return sum;
+            });
+        }
+        add("riscv decode", code.size(), [&m, &code]() {
+            uint64_t sum = 0;
+            for (uint32_t inst : code) {
+                m.mFO.instruction = inst;
+                m.decode();
+                sum += m.mDO.op + m.mDO.right_val + m.mDO.offset;
+            }
+            return sum;
+        });
+        add("riscv alu", ops.size(), [&m, &ops]() {
+            uint64_t sum = 0;
+            for (const AluOp &op : ops) {
+                riscv::Machine::ExecuteOut eo = m.alu(op.cmd, op.left, op.right);
+                sum += eo.result + eo.n + eo.z + eo.c + eo.v;
+            }
+            return sum;
+        });
+    }
+
+    // x86: decode() is the whole chain (decode_fields, then
+    // decode_operands), run from each instruction's first byte
+    void add_x86(Machine &m, const std::vector<uint16_t> &starts) {
+        add("x86 decode_fields", starts.size(), [&m, &starts]() {
+            uint64_t sum = 0;
+            for (uint16_t pc : starts) {
+                m.set_pc(pc);
+                m.fetch();
+                sum += m.decode_fields() + m.decodeObj.immediate;
+            }
+            return sum;
+        });
+        add("x86 decode", starts.size(), [&m, &starts]() {
+            uint64_t sum = 0;
+            for (uint16_t pc : starts) {
+                m.set_pc(pc);
+                m.fetch();
+                m.decode();
+                sum += m.decodeObj.leftOperand + m.decodeObj.rightOperand;
+            }
+            return sum;
+        });
+    }
+
+    void run(int samples, const char *filter) {
+        // Two-sided 95% critical values of Student's t for 1..30 degrees of freedom
+        static const double T95[] = {
+            12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+            2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+            2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042
+        };
+        printf("%-20s %10s %10s %10s %10s %10s\n", "kernel", "ops", "ns/op", "+-95%", "min", "max");
+        for (const Kernel &k : kernels) {
+            if (filter && k.name.find(filter) == std::string::npos) continue;
+            // Warm up, and find how many calls make a 5 ms sample
+            long calls = 1;
+            for (;;) {
+                auto start = std::chrono::steady_clock::now();
+                for (long c = 0; c < calls; c++) sink = sink + k.run();
+                double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+                if (seconds >= 0.005) break;
+                calls *= 2;
+            }
+            std::vector<double> ns;
+            for (int s = 0; s < samples; s++) {
+                auto start = std::chrono::steady_clock::now();
+                for (long c = 0; c < calls; c++) sink = sink + k.run();
+                double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+                ns.push_back(seconds * 1e9 / ((double)calls * k.ops));
+            }
+            double mean = 0, variance = 0;
+            for (double v : ns) mean += v;
+            mean /= ns.size();
+            for (double v : ns) variance += (v - mean) * (v - mean);
+            variance /= ns.size() > 1 ? ns.size() - 1 : 1;
+            size_t df = ns.size() > 1 ? ns.size() - 1 : 1;
+            double t = df <= 30 ? T95[df - 1] : 1.96;
+            double interval = t * sqrt(variance / ns.size());
+            printf("%-20s %10zu %10.3f %10.3f %10.3f %10.3f\n", k.name.c_str(), k.ops, mean, interval,
+                   *std::min_element(ns.begin(), ns.end()), *std::max_element(ns.begin(), ns.end()));
+        }
+    }
+};
+
+int main(int argc, char **argv) {
+    int samples = 20;
+    const char *filter = nullptr;
+    const char *program = nullptr;
+    bool usage = false;
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--samples") && i + 1 < argc) samples = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--filter") && i + 1 < argc) filter = argv[++i];
+        else if (!strcmp(argv[i], "--riscv") && i + 1 < argc) program = argv[++i];
+        else usage = true;
+    }
+    if (usage || samples < 2) {
+        std::cerr << "usage: microbench [--samples <n>] [--filter <text>] [--riscv <binary>]\n";
+        return 1;
+    }
+
+    std::vector<uint32_t> code;
+    if (program) {
+        if (!riscv_program(program, code)) {
+            std::cerr << "no RISC-V instructions in " << program << '\n';
+            return 1;
+        }
+    }
+    else code = riscv_stream(16384);
+    std::vector<AluOp> ops = alu_stream(16384);
+    char *riscvMemory = new char[riscv::MEM_SIZE]();
+    riscv::Machine rv(riscvMemory, riscv::MEM_SIZE);
+    for (int r = 0; r < riscv::NUM_REGS; r++) rv.set_xreg(r, immediate(16));
+
+    // Below 0x7000 so every PC and [bx] stays a positive int16
+    char *x86Memory = new char[MEM_SIZE]();
+    std::vector<uint16_t> starts = x86_stream(x86Memory, 0x7000);
+    Machine x86(x86Memory, MEM_SIZE);
+    for (int r = 0; r < 8; r++) x86.set_xreg(r, below(0x7000));
+
+    MicroBench bench;
+    bench.add_riscv(rv, code, ops);
+    bench.add_x86(x86, starts);
+    bench.run(samples, filter);
+    delete[] riscvMemory;
+    delete[] x86Memory;
+    return 0;
+}
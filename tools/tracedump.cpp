@@ -0,0 +1,54 @@
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include "trace.h"
+
+// Prints a trace written with --trace, one retired instruction per line:
+// tracedump <trace>
+
+const char *x86_reg_name[] {
+    "AX", "CX", "DX", "BX", "SP", "BP", "SI", "DI",
+    "SS", "CS", "DS", "ES", "FS", "GS", "EFLAGS", "IP"
+};
+
+int main(int argc, char **argv) {
+    if (argc != 2) {
+        std::cerr << "usage: tracedump <trace>\n";
+        return 1;
+    }
+    TraceReader reader;
+    if (!reader.open(argv[1])) {
+        std::cerr << "invalid trace file\n";
+        return 1;
+    }
+    bool x86 = !strcmp(reader.isa(), "x86");
+
+    TraceRecord rec;
+    uint64_t count = 0;
+    while (reader.next(rec)) {
+        count++;
+        if (x86) {
+            printf("%04" PRIx64 "  ", rec.pc);
+            for (int i = 0; i < 4; i++) {
+                if (i < rec.length) printf("%02x", (rec.instruction >> (8 * i)) & 0xff);
+                else printf("  ");
+            }
+        }
+        else printf("%08" PRIx64 "  %08x", rec.pc, rec.instruction);
+
+        if (rec.flags & TRACE_RD) {
+            if (x86) printf("  %s=0x%04" PRIx64, x86_reg_name[rec.rd & 15], rec.rdValue);
+            else printf("  x%d=0x%016" PRIx64, rec.rd, rec.rdValue);
+        }
+        if (rec.flags & TRACE_LOAD) {
+            printf("  [0x%" PRIx64 "]->0x%" PRIx64 " (%d)", rec.memAddress, rec.memValue, rec.memSize);
+        }
+        if (rec.flags & TRACE_STORE) {
+            printf("  [0x%" PRIx64 "]<-0x%" PRIx64 " (%d)", rec.memAddress, rec.memValue, rec.memSize);
+        }
+        putchar('\n');
+    }
+    std::cerr << count << " instructions\n";
+    return 0;
+}